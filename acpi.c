@@ -1,28 +1,217 @@
-// acpi.c — ACPI parser stub
+// acpi.c — ACPI table parser (MADT, FADT, HPET, MCFG)
 #include "kernel.h"
 
+struct irq_override {
+    uint8_t  source;            // ISA IRQ
+    uint32_t gsi;
+    uint16_t flags;
+};
+
+struct pcie_segment {
+    uint64_t base;              // ECAM base of bus 0 (even if start_bus > 0)
+    uint16_t segment;
+    uint8_t  start_bus;
+    uint8_t  end_bus;
+};
+
 static bool acpi_init_done = false;
 static uint8_t acpi_major = 0, acpi_minor = 0;
 static uint32_t num_cpus = 1;
 static uint8_t cpu_apic_ids[MAX_CPUS];
+static uint8_t cpu_acpi_ids[MAX_CPUS];
+static uint64_t lapic_addr = 0xFEE00000;
 static uint32_t num_ioapics = 1;
 static uint32_t ioapic_addrs[MAX_IOAPICS] = {0xFEC00000};
 static uint32_t ioapic_gsi_bases[MAX_IOAPICS] = {0};
+static struct irq_override irq_overrides[MAX_IRQ_OVERRIDES];
+static uint32_t num_irq_overrides = 0;
+static uint16_t sci_irq = 9;
+static uint64_t hpet_base = 0;
+static uint16_t hpet_min_tick = 0;
+static struct pcie_segment pcie_segments[MAX_PCIE_SEGMENTS];
+static uint32_t num_pcie_segments = 0;
+
+static bool acpi_checksum_ok(const void* table, uint32_t len) {
+    const uint8_t* p = (const uint8_t*)table;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) sum += p[i];
+    return sum == 0;
+}
+
+static struct acpi_sdt_header* acpi_map_table(uint64_t phys) {
+    struct acpi_sdt_header* h = (struct acpi_sdt_header*)PHYS_TO_VIRT(phys);
+    if (h->length < sizeof(struct acpi_sdt_header) || !acpi_checksum_ok(h, h->length)) {
+        kprintf("ACPI: Bad checksum on %c%c%c%c at 0x%lx, ignored\n",
+            h->signature[0], h->signature[1], h->signature[2], h->signature[3], phys);
+        return NULL;
+    }
+    return h;
+}
+
+// Walk the RSDT (32-bit entries) or XSDT (64-bit entries) for a signature
+static struct acpi_sdt_header* acpi_find_table(struct acpi_sdt_header* root, bool xsdt,
+                                               const char* sig) {
+    uint32_t entry_size = xsdt ? 8 : 4;
+    uint32_t count = (root->length - sizeof(struct acpi_sdt_header)) / entry_size;
+    uint8_t* entries = (uint8_t*)root + sizeof(struct acpi_sdt_header);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t phys = xsdt ? *(uint64_t*)(entries + i * 8)
+                             : *(uint32_t*)(entries + i * 4);
+        if (!phys) continue;
+        struct acpi_sdt_header* h = (struct acpi_sdt_header*)PHYS_TO_VIRT(phys);
+        if (memcmp(h->signature, sig, 4) == 0) return acpi_map_table(phys);
+    }
+    return NULL;
+}
+
+static void acpi_add_cpu(uint32_t apic_id, uint8_t acpi_id, uint32_t flags) {
+    // Bit 0: enabled, bit 1: online capable (may be started)
+    if (!(flags & 3) || num_cpus >= MAX_CPUS || apic_id > 0xFF) return;
+    for (uint32_t i = 0; i < num_cpus; i++) {
+        if (cpu_apic_ids[i] == apic_id) return;
+    }
+    cpu_apic_ids[num_cpus] = apic_id;
+    cpu_acpi_ids[num_cpus] = acpi_id;
+    num_cpus++;
+}
+
+static void acpi_parse_madt(struct madt_header* madt) {
+    lapic_addr = madt->local_apic_addr;
+    num_cpus = 0;
+    num_ioapics = 0;
+    
+    uint8_t* p = (uint8_t*)madt + sizeof(struct madt_header);
+    uint8_t* end = (uint8_t*)madt + madt->length;
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        switch (p[0]) {
+        case ACPI_MADT_TYPE_LOCAL_APIC: {
+            struct madt_lapic* l = (struct madt_lapic*)p;
+            acpi_add_cpu(l->apic_id, l->acpi_id, l->flags);
+            break;
+        }
+        case ACPI_MADT_TYPE_PROCESSOR_X2APIC: {
+            struct madt_x2apic* x = (struct madt_x2apic*)p;
+            acpi_add_cpu(x->x2apic_id, (uint8_t)x->acpi_uid, x->flags);
+            break;
+        }
+        case ACPI_MADT_TYPE_IO_APIC: {
+            struct madt_ioapic* io = (struct madt_ioapic*)p;
+            if (num_ioapics < MAX_IOAPICS) {
+                ioapic_addrs[num_ioapics] = io->addr;
+                ioapic_gsi_bases[num_ioapics] = io->gsi_base;
+                num_ioapics++;
+            }
+            break;
+        }
+        case ACPI_MADT_TYPE_INTERRUPT_SOURCE: {
+            struct madt_iso* iso = (struct madt_iso*)p;
+            if (iso->bus == 0 && num_irq_overrides < MAX_IRQ_OVERRIDES) {
+                irq_overrides[num_irq_overrides].source = iso->source;
+                irq_overrides[num_irq_overrides].gsi = iso->gsi;
+                irq_overrides[num_irq_overrides].flags = iso->flags;
+                num_irq_overrides++;
+            }
+            break;
+        }
+        case ACPI_MADT_TYPE_LOCAL_APIC_OVERRIDE:
+            lapic_addr = ((struct madt_lapic_override*)p)->addr;
+            break;
+        }
+        p += p[1];
+    }
+    
+    if (num_cpus == 0) {
+        cpu_apic_ids[0] = 0;
+        num_cpus = 1;
+    }
+    if (num_ioapics == 0) {
+        ioapic_addrs[0] = 0xFEC00000;
+        ioapic_gsi_bases[0] = 0;
+        num_ioapics = 1;
+    }
+}
+
+static void acpi_parse_fadt(struct acpi_fadt* fadt) {
+    sci_irq = fadt->sci_int;
+    acpi_major = fadt->header.revision;
+    // minor_version exists from FADT 5.1 on
+    if (fadt->header.length >= offsetof(struct acpi_fadt, minor_version) + 1) {
+        acpi_minor = fadt->minor_version & 0xF;
+    }
+}
+
+static void acpi_parse_hpet(struct acpi_hpet* hpet) {
+    if (hpet->base.space_id != 0) return;   // Must be memory mapped
+    hpet_base = hpet->base.address;
+    hpet_min_tick = hpet->min_tick;
+}
+
+static void acpi_parse_mcfg(struct acpi_sdt_header* mcfg) {
+    // 8 reserved bytes follow the header
+    uint8_t* p = (uint8_t*)mcfg + sizeof(struct acpi_sdt_header) + 8;
+    uint8_t* end = (uint8_t*)mcfg + mcfg->length;
+    for (; p + sizeof(struct acpi_mcfg_alloc) <= end; p += sizeof(struct acpi_mcfg_alloc)) {
+        struct acpi_mcfg_alloc* a = (struct acpi_mcfg_alloc*)p;
+        if (num_pcie_segments >= MAX_PCIE_SEGMENTS) break;
+        pcie_segments[num_pcie_segments].base = a->base;
+        pcie_segments[num_pcie_segments].segment = a->segment;
+        pcie_segments[num_pcie_segments].start_bus = a->start_bus;
+        pcie_segments[num_pcie_segments].end_bus = a->end_bus;
+        num_pcie_segments++;
+    }
+}
 
 bool acpi_init(uint8_t* rsdp) {
-    (void)rsdp;
+    if (!rsdp) return false;
+    uint64_t start = rdtsc();
     
-    kprintf("ACPI: Initializing (stub)\n");
+    struct rsdp_descriptor* desc = (struct rsdp_descriptor*)rsdp;
+    if (memcmp(desc->signature, "RSD PTR ", 8) != 0 || !acpi_checksum_ok(desc, 20)) {
+        kprintf("ACPI: Bad RSDP\n");
+        return false;
+    }
+    bool xsdt = desc->revision >= 2 && desc->xsdt_address &&
+                acpi_checksum_ok(desc, desc->length);
     
-    // Assume single core for now
-    cpu_apic_ids[0] = 0;
-    num_cpus = 1;
+    struct acpi_sdt_header* root = acpi_map_table(xsdt ? desc->xsdt_address
+                                                       : (uint64_t)desc->rsdt_address);
+    if (!root) return false;
     
-    acpi_init_done = true;
-    acpi_major = 5;
+    acpi_major = desc->revision >= 2 ? 2 : 1;
     acpi_minor = 0;
     
-    kprintf("ACPI: Version %u.%u, %u CPUs\n", acpi_major, acpi_minor, num_cpus);
+    struct madt_header* madt = (struct madt_header*)acpi_find_table(root, xsdt, "APIC");
+    if (madt) {
+        acpi_parse_madt(madt);
+    } else {
+        kprintf("ACPI: No MADT, assuming a single CPU\n");
+        cpu_apic_ids[0] = 0;
+        num_cpus = 1;
+    }
+    
+    struct acpi_fadt* fadt = (struct acpi_fadt*)acpi_find_table(root, xsdt, "FACP");
+    if (fadt) acpi_parse_fadt(fadt);
+    
+    struct acpi_hpet* hpet = (struct acpi_hpet*)acpi_find_table(root, xsdt, "HPET");
+    if (hpet) acpi_parse_hpet(hpet);
+    
+    struct acpi_sdt_header* mcfg = acpi_find_table(root, xsdt, "MCFG");
+    if (mcfg) acpi_parse_mcfg(mcfg);
+    
+    acpi_init_done = true;
+    uint64_t cycles = rdtsc() - start;
+    
+    kprintf("ACPI: Version %u.%u (%s), %u CPUs, %u IOAPICs, %u IRQ overrides\n",
+        acpi_major, acpi_minor, xsdt ? "XSDT" : "RSDT", num_cpus, num_ioapics,
+        num_irq_overrides);
+    if (hpet_base) kprintf("ACPI: HPET at 0x%lx\n", hpet_base);
+    for (uint32_t i = 0; i < num_pcie_segments; i++) {
+        kprintf("ACPI: PCIe segment %u buses %u-%u ECAM at 0x%lx\n",
+            pcie_segments[i].segment, pcie_segments[i].start_bus,
+            pcie_segments[i].end_bus, pcie_segments[i].base);
+    }
+    kprintf("ACPI: Tables parsed in %lu cycles\n", cycles);
     
     return true;
 }
@@ -45,6 +234,10 @@ uint32_t acpi_get_cpu_count(void) { return num_cpus; }
 uint8_t acpi_get_cpu_apic_id(uint32_t idx) { 
     return (idx < num_cpus) ? cpu_apic_ids[idx] : 0; 
 }
+uint8_t acpi_get_cpu_acpi_id(uint32_t idx) {
+    return (idx < num_cpus) ? cpu_acpi_ids[idx] : 0;
+}
+uint64_t acpi_get_lapic_addr(void) { return lapic_addr; }
 uint32_t acpi_get_ioapic_count(void) { return num_ioapics; }
 uint32_t acpi_get_ioapic_addr(uint32_t idx) { 
     return (idx < num_ioapics) ? ioapic_addrs[idx] : 0; 
@@ -52,3 +245,30 @@ uint32_t acpi_get_ioapic_addr(uint32_t idx) {
 uint32_t acpi_get_ioapic_gsi_base(uint32_t idx) { 
     return (idx < num_ioapics) ? ioapic_gsi_bases[idx] : 0; 
 }
+
+// ISA IRQ routing: the GSI and MPS INTI flags if the MADT overrides it
+bool acpi_get_irq_override(uint8_t irq, uint32_t* gsi, uint16_t* flags) {
+    for (uint32_t i = 0; i < num_irq_overrides; i++) {
+        if (irq_overrides[i].source == irq) {
+            if (gsi) *gsi = irq_overrides[i].gsi;
+            if (flags) *flags = irq_overrides[i].flags;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint16_t acpi_get_sci_irq(void) { return sci_irq; }
+uint64_t acpi_get_hpet_base(void) { return hpet_base; }
+uint16_t acpi_get_hpet_min_tick(void) { return hpet_min_tick; }
+
+// Physical ECAM address of a bus's config space, 0 if no MCFG covers it
+uint64_t acpi_get_pcie_ecam(uint16_t segment, uint8_t bus) {
+    for (uint32_t i = 0; i < num_pcie_segments; i++) {
+        struct pcie_segment* s = &pcie_segments[i];
+        if (s->segment == segment && bus >= s->start_bus && bus <= s->end_bus) {
+            return s->base + ((uint64_t)bus << 20);
+        }
+    }
+    return 0;
+}
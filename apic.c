@@ -1,10 +1,72 @@
-// apic.c — Local APIC driver stub
+// apic.c — Local APIC driver (x2APIC with xAPIC fallback)
 #include "kernel.h"
 
+// Registers are named by their xAPIC MMIO offset. In x2APIC mode the same
+// register is MSR 0x800 + offset / 16, the ICR is one 64-bit MSR (no
+// delivery status to poll) and EOI is a single wrmsr.
+
+#define MSR_APIC_BASE       0x1B
+#define APIC_BASE_ENABLE    (1 << 11)
+#define APIC_BASE_X2APIC    (1 << 10)
+
+#define ICR_SHORTHAND_OTHERS 0x000C0000
+#define ICR_LEVEL_ASSERT    0x00004000
+#define ICR_DELIVERY_STATUS 0x00001000
+#define ICR_INIT            0x00000500
+#define ICR_STARTUP         0x00000600
+#define ICR_SHORTHAND_SELF  0x00040000
+
 static volatile uint32_t* lapic_base = NULL;
+static bool x2apic = false;
 static uint64_t timer_freq = 0;
 static void (*timer_handler)(void) = NULL;
 
+#define LAPIC_CALIBRATE_MS  10
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    if (x2apic) return (uint32_t)rdmsr(X2APIC_MSR_BASE + (reg >> 4));
+    return lapic_base[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    if (x2apic) wrmsr(X2APIC_MSR_BASE + (reg >> 4), val);
+    else lapic_base[reg / 4] = val;
+}
+
+// Wait for the previous IPI to leave the ICR (xAPIC only: Delivery Status)
+static void lapic_icr_wait(void) {
+    while (lapic_base[LAPIC_ICR_LOW / 4] & ICR_DELIVERY_STATUS) pause();
+}
+
+static void lapic_write_icr(uint32_t dest, uint32_t low) {
+    if (x2apic) {
+        // x2APIC MSR writes are not serializing: order prior stores
+        // (e.g. need_resched) before the IPI becomes visible
+        asm volatile ("mfence; lfence" ::: "memory");
+        wrmsr(X2APIC_MSR_ICR, ((uint64_t)dest << 32) | low);
+        return;
+    }
+    lapic_icr_wait();
+    lapic_base[LAPIC_ICR_HIGH / 4] = dest << 24;
+    lapic_base[LAPIC_ICR_LOW / 4] = low;
+}
+
+// xAPIC flat logical model: CPU N answers logical destination bit N, so
+// an IOAPIC entry can target a set of CPUs. x2APIC's LDR is read-only.
+static void lapic_set_logical_id(void) {
+    if (x2apic) return;
+    lapic_write(LAPIC_DFR, 0xFFFFFFFF);
+    lapic_write(LAPIC_LDR, (1u << this_cpu_read(id)) << 24);
+}
+
+// Global enable, plus x2APIC mode when the BSP chose it
+static void lapic_enable(void) {
+    uint64_t apic_base = rdmsr(MSR_APIC_BASE);
+    apic_base |= APIC_BASE_ENABLE;
+    if (x2apic) apic_base |= APIC_BASE_X2APIC;
+    wrmsr(MSR_APIC_BASE, apic_base);
+}
+
 void lapic_init(void) {
     // Disable legacy PIC
     outb(0x21, 0xFF);
@@ -16,66 +78,119 @@ void lapic_init(void) {
     if (!(edx & (1 << 9))) {
         kernel_panic("APIC not supported");
     }
+    x2apic = ecx & (1 << 21);
     
-    // Enable APIC via MSR
-    uint64_t apic_base = rdmsr(0x1B);
-    if (!(apic_base & (1 << 11))) {
-        wrmsr(0x1B, apic_base | (1 << 11));
-    }
-    
-    // Map LAPIC (typically at 0xFEE00000)
-    uint64_t phys_base = apic_base & 0xFFFFF000;
+    // xAPIC MMIO window (typically at 0xFEE00000), unused in x2APIC mode
+    uint64_t phys_base = rdmsr(MSR_APIC_BASE) & 0xFFFFF000;
     lapic_base = (volatile uint32_t*)PHYS_TO_VIRT(phys_base);
+    lapic_enable();
     
     // Software enable
-    lapic_base[0x0F0 / 4] = 0x1FF;
+    lapic_write(LAPIC_SVR, 0x1FF);
+    lapic_set_logical_id();
     
-    kprintf("LAPIC: ID=%u, Version=%u\n", 
-        lapic_base[0x020 / 4] >> 24, 
-        lapic_base[0x030 / 4] & 0xFF);
+    kprintf("LAPIC: %s mode, ID=%u, Version=%u\n",
+        x2apic ? "x2APIC" : "xAPIC", lapic_get_id(),
+        lapic_read(LAPIC_VERSION) & 0xFF);
 }
 
 void lapic_init_ap(void) {
     // AP initialization
-    lapic_base[0x0F0 / 4] = 0x1FF;
-    lapic_base[0x080 / 4] = 0;
+    lapic_enable();
+    lapic_write(LAPIC_SVR, 0x1FF);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_set_logical_id();
     lapic_eoi();
 }
 
+bool lapic_is_x2apic(void) {
+    return x2apic;
+}
+
 uint32_t lapic_get_id(void) {
     if (!lapic_base) return 0;
-    return lapic_base[0x020 / 4] >> 24;
+    uint32_t id = lapic_read(LAPIC_ID);
+    return x2apic ? id : id >> 24;
 }
 
 void lapic_eoi(void) {
-    if (lapic_base) {
-        lapic_base[0x0B0 / 4] = 0;
+    if (x2apic) {
+        wrmsr(X2APIC_MSR_EOI, 0);
+    } else if (lapic_base) {
+        lapic_base[LAPIC_EOI / 4] = 0;
     }
 }
 
+static void lapic_count_ipi(uint8_t vector) {
+    irq_count_ipi(vector == IPI_VECTOR_RESCHEDULE ? IPI_TYPE_RESCHEDULE : IPI_TYPE_OTHER);
+}
+
 void lapic_send_ipi(uint8_t apic_id, uint8_t vector) {
     if (!lapic_base) return;
-    
-    lapic_base[0x310 / 4] = ((uint32_t)apic_id) << 24;
-    lapic_base[0x300 / 4] = vector | 0x4000;
+    lapic_count_ipi(vector);
+    lapic_write_icr(apic_id, vector | ICR_LEVEL_ASSERT);
+}
+
+// IPI to the calling CPU: one wrmsr to the x2APIC SELF IPI register
+void lapic_send_self_ipi(uint8_t vector) {
+    lapic_count_ipi(vector);
+    if (x2apic) {
+        asm volatile ("mfence; lfence" ::: "memory");
+        wrmsr(X2APIC_MSR_SELF_IPI, vector);
+    } else if (lapic_base) {
+        lapic_write_icr(0, ICR_SHORTHAND_SELF | ICR_LEVEL_ASSERT | vector);
+    }
+}
+
+// INIT to every CPU except self (shorthand), level assert
+void lapic_broadcast_init(void) {
+    if (!lapic_base) return;
+    irq_count_ipi(IPI_TYPE_INIT);
+    lapic_write_icr(0, ICR_SHORTHAND_OTHERS | ICR_LEVEL_ASSERT | ICR_INIT);
+    if (!x2apic) lapic_icr_wait();
+}
+
+// Startup IPI to every CPU except self: APs start in real mode at page << 12
+void lapic_broadcast_sipi(uint8_t page) {
+    if (!lapic_base) return;
+    irq_count_ipi(IPI_TYPE_STARTUP);
+    lapic_write_icr(0, ICR_SHORTHAND_OTHERS | ICR_LEVEL_ASSERT | ICR_STARTUP | page);
+    if (!x2apic) lapic_icr_wait();
 }
 
+// Count the timer down (divide by 16, masked) over a TSC-timed window.
+// Needs clock_init().
 void lapic_timer_calibrate(void) {
-    kprintf("LAPIC: Timer calibration (stub)\n");
-    timer_freq = 1000000; // Assume 1MHz for now
+    if (!lapic_base) return;
+    lapic_write(LAPIC_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | (1 << 16));
+    lapic_write(LAPIC_TIMER_INIT_COUNT, 0xFFFFFFFF);
+    mdelay(LAPIC_CALIBRATE_MS);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT_COUNT, 0);
+    
+    timer_freq = (uint64_t)elapsed * 1000 / LAPIC_CALIBRATE_MS;
+    kprintf("LAPIC: Timer %lu Hz (bus / 16)\n", timer_freq);
 }
 
 uint64_t lapic_get_timer_freq(void) { return timer_freq; }
 uint64_t lapic_get_timer_ticks(void) { 
     if (!lapic_base) return 0;
-    return lapic_base[0x390 / 4]; 
+    return lapic_read(LAPIC_TIMER_CURRENT);
 }
 
 void lapic_timer_set_handler(void (*handler)(void)) {
     timer_handler = handler;
 }
 
+// Periodic tick on the calling CPU (APs share the BSP's calibration)
 void lapic_timer_start_periodic(uint64_t ms) {
-    (void)ms;
-    // Would configure periodic timer
+    if (!lapic_base || !timer_freq) return;
+    lapic_write(LAPIC_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR | (1 << 17));
+    lapic_write(LAPIC_TIMER_INIT_COUNT, (uint32_t)(timer_freq * ms / 1000));
+}
+
+void lapic_timer_interrupt(void) {
+    if (timer_handler) timer_handler();
 }
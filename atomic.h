@@ -0,0 +1,116 @@
+// atomic.h — Atomic operations over GCC __atomic builtins
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Every operation takes an explicit memory order. On x86-64 all locked
+// RMW instructions are full barriers, so the order mostly constrains the
+// compiler; ATOMIC_RELAXED loads/stores are plain aligned movs.
+//
+// cmpxchg writes the value it found to *expected on failure, so a retry
+// loop needs no separate reload.
+
+#define ATOMIC_RELAXED  __ATOMIC_RELAXED
+#define ATOMIC_ACQUIRE  __ATOMIC_ACQUIRE
+#define ATOMIC_RELEASE  __ATOMIC_RELEASE
+#define ATOMIC_ACQ_REL  __ATOMIC_ACQ_REL
+#define ATOMIC_SEQ_CST  __ATOMIC_SEQ_CST
+
+// Failure order of a cmpxchg may not be release or stronger than success
+#define ATOMIC_FAIL_ORDER(o) \
+    ((o) == ATOMIC_ACQ_REL ? ATOMIC_ACQUIRE : (o) == ATOMIC_RELEASE ? ATOMIC_RELAXED : (o))
+
+// Barriers
+static inline void barrier(void) {
+    asm volatile ("" ::: "memory");
+}
+
+static inline void smp_mb(void) {
+    __atomic_thread_fence(ATOMIC_SEQ_CST);
+}
+
+// x86 never reorders loads with loads or stores with stores
+static inline void smp_rmb(void) { barrier(); }
+static inline void smp_wmb(void) { barrier(); }
+
+// 32-bit
+static inline uint32_t atomic_load32(const volatile uint32_t* p, int order) {
+    return __atomic_load_n(p, order);
+}
+
+static inline void atomic_store32(volatile uint32_t* p, uint32_t v, int order) {
+    __atomic_store_n(p, v, order);
+}
+
+static inline uint32_t atomic_fetch_add32(volatile uint32_t* p, uint32_t v, int order) {
+    return __atomic_fetch_add(p, v, order);
+}
+
+static inline uint32_t atomic_fetch_sub32(volatile uint32_t* p, uint32_t v, int order) {
+    return __atomic_fetch_sub(p, v, order);
+}
+
+static inline uint32_t atomic_fetch_and32(volatile uint32_t* p, uint32_t v, int order) {
+    return __atomic_fetch_and(p, v, order);
+}
+
+static inline uint32_t atomic_fetch_or32(volatile uint32_t* p, uint32_t v, int order) {
+    return __atomic_fetch_or(p, v, order);
+}
+
+static inline uint32_t atomic_xchg32(volatile uint32_t* p, uint32_t v, int order) {
+    return __atomic_exchange_n(p, v, order);
+}
+
+static inline bool atomic_cmpxchg32(volatile uint32_t* p, uint32_t* expected,
+                                    uint32_t desired, int order) {
+    return __atomic_compare_exchange_n(p, expected, desired, false,
+                                       order, ATOMIC_FAIL_ORDER(order));
+}
+
+// 64-bit
+static inline uint64_t atomic_load64(const volatile uint64_t* p, int order) {
+    return __atomic_load_n(p, order);
+}
+
+static inline void atomic_store64(volatile uint64_t* p, uint64_t v, int order) {
+    __atomic_store_n(p, v, order);
+}
+
+static inline uint64_t atomic_fetch_add64(volatile uint64_t* p, uint64_t v, int order) {
+    return __atomic_fetch_add(p, v, order);
+}
+
+static inline uint64_t atomic_fetch_sub64(volatile uint64_t* p, uint64_t v, int order) {
+    return __atomic_fetch_sub(p, v, order);
+}
+
+static inline uint64_t atomic_fetch_and64(volatile uint64_t* p, uint64_t v, int order) {
+    return __atomic_fetch_and(p, v, order);
+}
+
+static inline uint64_t atomic_fetch_or64(volatile uint64_t* p, uint64_t v, int order) {
+    return __atomic_fetch_or(p, v, order);
+}
+
+static inline uint64_t atomic_xchg64(volatile uint64_t* p, uint64_t v, int order) {
+    return __atomic_exchange_n(p, v, order);
+}
+
+static inline bool atomic_cmpxchg64(volatile uint64_t* p, uint64_t* expected,
+                                    uint64_t desired, int order) {
+    return __atomic_compare_exchange_n(p, expected, desired, false,
+                                       order, ATOMIC_FAIL_ORDER(order));
+}
+
+// Pointers: macros keep the pointee type (p is a pointer to the pointer)
+#define atomic_load_ptr(p, order)       __atomic_load_n((p), (order))
+#define atomic_store_ptr(p, v, order)   __atomic_store_n((p), (v), (order))
+#define atomic_xchg_ptr(p, v, order)    __atomic_exchange_n((p), (v), (order))
+#define atomic_cmpxchg_ptr(p, expected, desired, order) \
+    __atomic_compare_exchange_n((p), (expected), (desired), false, \
+                                (order), ATOMIC_FAIL_ORDER(order))
+
+#endif
@@ -0,0 +1,47 @@
+// boottime.c — TSC-stamped boot milestones
+#include "kernel.h"
+
+// kernel_main() calls boot_mark() after each init stage. Stamps are raw
+// TSC reads: the first ones are taken long before clock_init() knows the
+// frequency, so conversion waits for boot_report(). The first stamp is
+// also the time from CPU reset to kernel entry (firmware and loader),
+// since the TSC starts at zero on reset.
+//
+// boot_report() prints one line per stage for tests/bench_boot.sh:
+//   BOOT: tsc_khz=<khz> cpus=<n>
+//   BOOT: stage=<name> us=<since previous stage>
+//   BOOT: total_us=<entry to last stage>
+//   BOOT: done
+
+#define BOOT_MAX_MARKS      32
+
+struct boot_mark {
+    const char* stage;
+    uint64_t tsc;
+};
+
+static struct boot_mark marks[BOOT_MAX_MARKS];
+static uint32_t mark_count = 0;
+
+// BSP only, before the idle loop; safe before any other subsystem is up
+void boot_mark(const char* stage) {
+    if (mark_count < BOOT_MAX_MARKS) {
+        marks[mark_count].stage = stage;
+        marks[mark_count].tsc = rdtsc();
+        mark_count++;
+    }
+}
+
+void boot_report(void) {
+    if (!mark_count) return;
+    kprintf("BOOT: tsc_khz=%lu cpus=%u\n", clock_tsc_khz(), smp_get_cpu_count());
+    kprintf("BOOT: stage=%s us=%lu\n", marks[0].stage,
+        clock_cycles_to_ns(marks[0].tsc) / 1000);
+    for (uint32_t i = 1; i < mark_count; i++) {
+        kprintf("BOOT: stage=%s us=%lu\n", marks[i].stage,
+            clock_cycles_to_ns(marks[i].tsc - marks[i - 1].tsc) / 1000);
+    }
+    kprintf("BOOT: total_us=%lu\n",
+        clock_cycles_to_ns(marks[mark_count - 1].tsc - marks[0].tsc) / 1000);
+    kprintf("BOOT: done\n");
+}
@@ -0,0 +1,186 @@
+// clock.c — TSC clocksource, calibration and delays
+#include "kernel.h"
+
+// ktime_ns() = (tsc + per-CPU offset - boot_tsc) * mult >> CLOCK_SHIFT.
+// The TSC is calibrated once against the HPET (or PIT channel 2) and,
+// when it is invariant, is a monotonic clock on every CPU.
+
+#define CLOCK_SHIFT         32
+#define CLOCK_CALIBRATE_MS  10
+#define CLOCK_SYNC_ROUNDS   8
+#define CLOCK_SYNC_WAIT_NS  10000000    // Per round; the BSP stops answering after smp_init()
+#define HPET_CAP            0x000   // Bits 63:32: counter period in fs
+#define HPET_CONFIG         0x010
+#define HPET_COUNTER        0x0F0
+
+// Calibration result, read as one snapshot under clock_seq so a reader
+// never mixes a new mult with an old boot_tsc
+struct clock_data {
+    uint64_t tsc_khz;
+    uint64_t mult;              // ns per cycle, 32.32 fixed point
+    uint64_t ns_mult;           // Cycles per ns, 32.32 fixed point, rounded up
+    uint64_t boot_tsc;
+};
+
+static struct clock_data clock_data;
+static seqlock_t clock_seq;
+static bool tsc_invariant = false;
+
+// AP <-> BSP offset handshake (clock_sync_ap / clock_sync_service).
+// One AP at a time holds sync_lock, raises sync_request and waits for the
+// BSP to clear it after publishing its TSC. An AP that gets no answer in
+// time takes the request back itself.
+static spinlock_t sync_lock;
+static volatile uint32_t sync_request = 0;
+static volatile uint64_t sync_bsp_tsc = 0;
+
+static void clock_read(struct clock_data* d) {
+    uint32_t seq;
+    do {
+        seq = read_seqbegin(&clock_seq);
+        *d = clock_data;
+    } while (read_seqretry(&clock_seq, seq));
+}
+
+static uint64_t hpet_read(volatile uint8_t* hpet, uint32_t reg) {
+    return *(volatile uint64_t*)(hpet + reg);
+}
+
+// TSC cycles over a CLOCK_CALIBRATE_MS window timed by the HPET counter
+static uint64_t hpet_measure_tsc(uint64_t base) {
+    volatile uint8_t* hpet = (volatile uint8_t*)PHYS_TO_VIRT(base);
+    uint64_t period_fs = hpet_read(hpet, HPET_CAP) >> 32;
+    if (period_fs == 0 || period_fs > 100000000) return 0;  // Spec: <= 100 ns
+    
+    *(volatile uint64_t*)(hpet + HPET_CONFIG) |= 1;         // ENABLE_CNF
+    uint64_t ticks = (uint64_t)CLOCK_CALIBRATE_MS * 1000000000000ULL / period_fs;
+    
+    uint64_t h0 = hpet_read(hpet, HPET_COUNTER);
+    uint64_t t0 = rdtsc();
+    while (hpet_read(hpet, HPET_COUNTER) - h0 < ticks) pause();
+    return rdtsc() - t0;
+}
+
+void clock_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000007) {
+        cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+        tsc_invariant = edx & (1 << 8);
+    }
+    
+    const char* source = "HPET";
+    uint64_t cycles = 0;
+    uint64_t hpet = acpi_get_hpet_base();
+    if (hpet) cycles = hpet_measure_tsc(hpet);
+    if (!cycles) {
+        source = "PIT";
+        // Best of three: an SMI or emulator hiccup only ever makes it longer
+        for (int i = 0; i < 3; i++) {
+            uint64_t c = pit_measure_tsc(CLOCK_CALIBRATE_MS);
+            if (!cycles || c < cycles) cycles = c;
+        }
+    }
+    
+    uint64_t khz = cycles / CLOCK_CALIBRATE_MS;
+    if (khz == 0) kernel_panic("Clock: TSC calibration failed");
+    uint64_t flags = write_seqlock_irqsave(&clock_seq);
+    clock_data.tsc_khz = khz;
+    clock_data.mult = (1000000ULL << CLOCK_SHIFT) / khz;
+    clock_data.ns_mult = ((khz << CLOCK_SHIFT) + 999999) / 1000000;
+    clock_data.boot_tsc = rdtsc();
+    write_sequnlock_irqrestore(&clock_seq, flags);
+    spin_init(&sync_lock);
+    
+    kprintf("Clock: TSC %lu kHz via %s%s\n", khz, source,
+        tsc_invariant ? ", invariant" : " (not invariant, per-CPU drift possible)");
+}
+
+uint64_t clock_tsc_khz(void) {
+    struct clock_data d;
+    clock_read(&d);
+    return d.tsc_khz;
+}
+
+static inline uint64_t cycles_to_ns(const struct clock_data* d, uint64_t cycles) {
+    return (uint64_t)(((unsigned __int128)cycles * d->mult) >> CLOCK_SHIFT);
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    struct clock_data d;
+    clock_read(&d);
+    return cycles_to_ns(&d, cycles);
+}
+
+uint64_t clock_ns_to_cycles(uint64_t ns) {
+    struct clock_data d;
+    clock_read(&d);
+    // Before calibration assume 4 GHz: delays come out long, never short
+    uint64_t ns_mult = d.ns_mult ? d.ns_mult : 4ULL << CLOCK_SHIFT;
+    return (uint64_t)(((unsigned __int128)ns * ns_mult) >> CLOCK_SHIFT);
+}
+
+// Nanoseconds since clock_init(), comparable across CPUs
+uint64_t ktime_ns(void) {
+    struct clock_data d;
+    clock_read(&d);
+    uint64_t tsc = rdtsc() + this_cpu_read(tsc_offset);
+    return tsc > d.boot_tsc ? cycles_to_ns(&d, tsc - d.boot_tsc) : 0;
+}
+
+void ndelay(uint64_t ns) {
+    uint64_t start = rdtsc();
+    uint64_t cycles = clock_ns_to_cycles(ns);
+    while (rdtsc() - start < cycles) pause();
+}
+
+void udelay(uint64_t us) {
+    ndelay(us * 1000);
+}
+
+void mdelay(uint64_t ms) {
+    ndelay(ms * 1000000);
+}
+
+// Called on each AP before it goes online. Estimates this CPU's TSC offset
+// from the BSP as the midpoint of a request/reply round trip, keeping the
+// round with the smallest RTT. An offset within RTT/2 is measurement noise.
+// An AP that comes up after smp_init() has stopped answering gets no reply
+// and keeps offset 0.
+void clock_sync_ap(struct cpu* c) {
+    uint64_t best_rtt = ~0ULL;
+    int64_t best_offset = 0;
+    uint64_t wait = clock_ns_to_cycles(CLOCK_SYNC_WAIT_NS);
+    
+    for (int i = 0; i < CLOCK_SYNC_ROUNDS; i++) {
+        spin_lock(&sync_lock);
+        uint64_t t0 = rdtsc();
+        sync_request = 1;
+        while (sync_request && rdtsc() - t0 < wait) pause();
+        uint64_t t1 = rdtsc();
+        uint32_t pending = 1;
+        bool timed_out = atomic_cmpxchg32(&sync_request, &pending, 0, ATOMIC_ACQ_REL);
+        uint64_t bsp = sync_bsp_tsc;
+        spin_unlock(&sync_lock);
+        
+        if (timed_out) {
+            c->tsc_offset = 0;
+            return;
+        }
+        uint64_t rtt = t1 - t0;
+        if (rtt < best_rtt) {
+            best_rtt = rtt;
+            best_offset = (int64_t)(bsp - (t0 + rtt / 2));
+        }
+    }
+    
+    uint64_t mag = best_offset < 0 ? (uint64_t)-best_offset : (uint64_t)best_offset;
+    c->tsc_offset = (mag <= best_rtt / 2) ? 0 : best_offset;
+}
+
+// BSP side of the handshake: answer one pending request, if any
+void clock_sync_service(void) {
+    if (!sync_request) return;
+    atomic_store64(&sync_bsp_tsc, rdtsc(), ATOMIC_RELAXED);
+    atomic_store32(&sync_request, 0, ATOMIC_RELEASE);
+}
@@ -91,19 +91,72 @@ static void fb_putchar(char c) {
     }
 }
 
-static void print_hex(uint64_t val, int digits) {
+// kprintf() formats into a small buffer on the caller's stack and hands
+// each full buffer, and the tail, to every registered backend. Backends
+// are only ever added (at the head, published with a release store), so
+// writers walk the list without a lock. VGA is built in; serial.c adds
+// COM1.
+
+#define CONSOLE_CHUNK       128
+
+static void vga_write(const char* s, size_t n) {
+    for (size_t i = 0; i < n; i++) vga_putchar(s[i]);
+}
+
+static struct console_backend vga_console = {
+    .name = "vga",
+    .write = vga_write,
+};
+
+static struct console_backend* backends = &vga_console;
+static volatile bool console_panicking = false;
+
+void console_register(struct console_backend* con) {
+    con->next = backends;
+    atomic_store_ptr(&backends, con, ATOMIC_RELEASE);
+}
+
+// Panic only: push out whatever the backends still have queued
+void console_flush(void) {
+    for (struct console_backend* con = atomic_load_ptr(&backends, ATOMIC_ACQUIRE);
+         con; con = con->next) {
+        if (con->flush) con->flush();
+    }
+}
+
+struct console_buf {
+    char data[CONSOLE_CHUNK];
+    size_t len;
+};
+
+static void console_emit(struct console_buf* b) {
+    if (!b->len) return;
+    for (struct console_backend* con = atomic_load_ptr(&backends, ATOMIC_ACQUIRE);
+         con; con = con->next) {
+        if (console_panicking && con->panic_write) con->panic_write(b->data, b->len);
+        else con->write(b->data, b->len);
+    }
+    b->len = 0;
+}
+
+static void console_putchar(struct console_buf* b, char c) {
+    if (b->len == CONSOLE_CHUNK) console_emit(b);
+    b->data[b->len++] = c;
+}
+
+static void print_hex(struct console_buf* b, uint64_t val, int digits) {
     const char* hex = "0123456789ABCDEF";
     for (int i = digits - 1; i >= 0; i--) {
-        vga_putchar(hex[(val >> (i * 4)) & 0xF]);
+        console_putchar(b, hex[(val >> (i * 4)) & 0xF]);
     }
 }
 
-static void print_dec(uint64_t val) {
+static void print_dec(struct console_buf* b, uint64_t val) {
     char buf[32];
     int i = 30;
     buf[31] = 0;
     if (val == 0) {
-        vga_putchar('0');
+        console_putchar(b, '0');
         return;
     }
     while (val && i >= 0) {
@@ -111,60 +164,63 @@ static void print_dec(uint64_t val) {
         val /= 10;
     }
     while (++i < 31) {
-        vga_putchar(buf[i]);
+        console_putchar(b, buf[i]);
     }
 }
 
 void kvprintf(const char* fmt, va_list args) {
+    struct console_buf buf = { .len = 0 };
+    struct console_buf* b = &buf;
     while (*fmt) {
         if (*fmt == '%' && *(fmt + 1)) {
             fmt++;
             switch (*fmt) {
                 case 's': {
                     const char* s = va_arg(args, const char*);
-                    if (s) while (*s) vga_putchar(*s++);
+                    if (s) while (*s) console_putchar(b, *s++);
                     break;
                 }
                 case 'd':
                 case 'i':
-                    print_dec(va_arg(args, int));
+                    print_dec(b, va_arg(args, int));
                     break;
                 case 'u':
-                    print_dec(va_arg(args, unsigned int));
+                    print_dec(b, va_arg(args, unsigned int));
                     break;
                 case 'x':
-                    print_hex(va_arg(args, unsigned int), 8);
+                    print_hex(b, va_arg(args, unsigned int), 8);
                     break;
                 case 'l':
                     if (*(fmt + 1) == 'x') {
                         fmt++;
-                        print_hex(va_arg(args, uint64_t), 16);
+                        print_hex(b, va_arg(args, uint64_t), 16);
                     } else if (*(fmt + 1) == 'u') {
                         fmt++;
-                        print_dec(va_arg(args, uint64_t));
+                        print_dec(b, va_arg(args, uint64_t));
                     }
                     break;
                 case 'p':
-                    vga_putchar('0');
-                    vga_putchar('x');
-                    print_hex(va_arg(args, uint64_t), 16);
+                    console_putchar(b, '0');
+                    console_putchar(b, 'x');
+                    print_hex(b, va_arg(args, uint64_t), 16);
                     break;
                 case 'c':
-                    vga_putchar((char)va_arg(args, int));
+                    console_putchar(b, (char)va_arg(args, int));
                     break;
                 case '%':
-                    vga_putchar('%');
+                    console_putchar(b, '%');
                     break;
                 default:
-                    vga_putchar('%');
-                    vga_putchar(*fmt);
+                    console_putchar(b, '%');
+                    console_putchar(b, *fmt);
                     break;
             }
         } else {
-            vga_putchar(*fmt);
+            console_putchar(b, *fmt);
         }
         fmt++;
     }
+    console_emit(b);
 }
 
 void kprintf(const char* fmt, ...) {
@@ -176,10 +232,50 @@ void kprintf(const char* fmt, ...) {
 
 void kernel_panic(const char* msg) {
     cli();
+    // Lockless from here: push out what is queued, then poll the message
+    console_panicking = true;
+    console_flush();
     kprintf("\n\n!!! KERNEL PANIC !!!\n%s\nSystem halted.\n", msg);
     while (1) hlt();
 }
 
+// Console hotkeys on the PS/2 keyboard (IRQ 1). The top half only reads
+// the scancode; the dumps are long, so they run from a tasklet.
+#define PS2_DATA            0x60
+#define PS2_STATUS          0x64
+#define PS2_STATUS_OUTPUT   0x01
+#define SCANCODE_F12        0x58        // Set 1 make code
+
+static struct tasklet stats_tasklet;
+
+static void console_dump_stats(void* data) {
+    (void)data;
+    uint64_t total, used, free;
+    irq_dump_stats();
+    lock_stat_dump();
+    rcu_dump_stats();
+    pmm_get_stats(&total, &used, &free);
+    kprintf("PMM: %lu MB used, %lu MB free of %lu MB\n",
+        used / (1024 * 1024), free / (1024 * 1024), total / (1024 * 1024));
+    kmalloc_dump_stats();
+    serial_dump_stats();
+}
+
+static bool console_kbd_irq(void* context) {
+    (void)context;
+    if (!(inb(PS2_STATUS) & PS2_STATUS_OUTPUT)) return false;
+    if (inb(PS2_DATA) == SCANCODE_F12) tasklet_schedule(&stats_tasklet);
+    return true;
+}
+
+void console_input_init(void) {
+    tasklet_init(&stats_tasklet, console_dump_stats, NULL);
+    irq_register_handler(1, console_kbd_irq, NULL);
+    ioapic_set_irq(1, IRQ_KEYBOARD, 0);
+    ioapic_unmask_irq(1);
+    kprintf("Console: F12 dumps interrupt, lock, memory and serial statistics\n");
+}
+
 // Helper to convert color
 uint32_t rgb_to_color(uint8_t r, uint8_t g, uint8_t b) {
     return (r << 16) | (g << 8) | b;
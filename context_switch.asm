@@ -6,6 +6,7 @@ bits 64
 
 ; Экспортируем функции
 global context_switch
+global kthread_start
 global switch_to_user
 global restore_kernel_context
 global get_rip
@@ -16,9 +17,6 @@ global invlpg
 global rdmsr
 global wrmsr
 
-; Импорты
-extern current_thread
-
 ; ============================================================
 ; context_switch — переключение между потоками
 ; Аргументы:
@@ -68,6 +66,20 @@ context_switch:
     ; Возвращаемся в новый поток
     ret
 
+; ============================================================
+; kthread_start — первый вход в kernel-поток
+; Кадр подготовлен kthread_create(): r12 = функция, r13 = аргумент
+; ============================================================
+extern kthread_exit
+extern schedule_tail
+
+kthread_start:
+    and rsp, -16            ; Выравнивание по ABI перед call
+    call schedule_tail      ; Снимаем блокировку runqueue, включаем прерывания
+    mov rdi, r13
+    call r12
+    call kthread_exit       ; Не возвращается
+
 ; ============================================================
 ; switch_to_user — переключение в пользовательский режим
 ; Аргументы:
@@ -87,8 +99,8 @@ switch_to_user:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     mov ss, ax
+    ; GS не трогаем: его база — per-CPU область, меняется через swapgs
     
     ; Подготавливаем стек для iret в userspace
     push 0x23               ; SS userspace
@@ -97,6 +109,9 @@ switch_to_user:
     push 0x1B               ; CS userspace (64-bit)
     push rsi                ; RIP userspace
     
+    ; Пользовательская база GS <-> per-CPU область ядра
+    swapgs
+    
     ; Возврат в userspace
     iretq
 
@@ -114,7 +129,6 @@ restore_kernel_context:
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
     mov ss, ax
     
     ret
@@ -221,13 +235,5 @@ cpuid_func:
     cpuid
     ret
 
-section .data
-
-; Глобальные переменные
-global kernel_rsp0
-kernel_rsp0:
-    dq 0                    ; RSP0 для текущего CPU
-
-global current_cpu
-current_cpu:
-    dq 0                    ; Указатель на текущую структуру cpu
+; RSP0, текущий поток и указатель на CPU живут в per-CPU области
+; (struct cpu в kernel.h), доступной через %gs
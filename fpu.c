@@ -0,0 +1,103 @@
+// fpu.c — SSE/AVX enable and kernel-mode SIMD sections
+#include "kernel.h"
+
+// The kernel is built with -mgeneral-regs-only, so the compiler never
+// touches vector registers on its own. Code that wants SIMD brackets it
+// with kernel_fpu_begin()/kernel_fpu_end(): preemption is off and the
+// CPU's vector state is saved to a per-CPU area and restored afterwards.
+// A section interrupted by a handler that also wants SIMD is not nested;
+// kernel_fpu_usable() is false there and the handler takes its integer path.
+
+#define CR0_MP              (1 << 1)
+#define CR0_EM              (1 << 2)
+#define CR0_TS              (1 << 3)
+#define CR4_OSFXSR          (1 << 9)
+#define CR4_OSXMMEXCPT      (1 << 10)
+
+#define XCR0_X87            (1 << 0)
+#define XCR0_SSE            (1 << 1)
+#define XCR0_AVX            (1 << 2)
+
+#define FPU_AREA_SIZE       1024    // Legacy 512 + header 64 + AVX 256
+
+static uint8_t fpu_area[MAX_CPUS][FPU_AREA_SIZE] __attribute__((aligned(64)));
+static bool use_xsave = false;
+static bool have_avx2 = false;
+static uint64_t xcr0 = 0;
+
+static inline void xsetbv(uint32_t reg, uint64_t val) {
+    asm volatile ("xsetbv" : : "c"(reg), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+// BSP: probe once. Every CPU: enable SSE (and AVX through XCR0).
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    bool bsp = this_cpu_read(bsp);
+
+    if (bsp) {
+        cpuid(1, &eax, &ebx, &ecx, &edx);
+        use_xsave = ecx & (1 << 26);
+        bool avx = use_xsave && (ecx & (1 << 28));
+        xcr0 = XCR0_X87 | XCR0_SSE | (avx ? XCR0_AVX : 0);
+        if (avx) {
+            cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+            have_avx2 = ebx & (1 << 5);
+        }
+    }
+
+    uint64_t cr0 = read_cr0();
+    cr0 = (cr0 & ~(uint64_t)(CR0_EM | CR0_TS)) | CR0_MP;
+    write_cr0(cr0);
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (use_xsave) cr4 |= CR4_OSXSAVE;
+    write_cr4(cr4);
+    if (use_xsave) xsetbv(0, xcr0);
+    asm volatile ("fninit");
+
+    if (bsp && use_xsave) {
+        cpuid_count(0xD, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx > FPU_AREA_SIZE) kernel_panic("FPU: XSAVE area too large");
+    }
+    this_cpu_write(fpu_state, FPU_IDLE);
+
+    if (bsp) {
+        kprintf("FPU: SSE2%s%s, state via %s\n", (xcr0 & XCR0_AVX) ? ", AVX" : "",
+            have_avx2 ? ", AVX2" : "", use_xsave ? "XSAVE" : "FXSAVE");
+    }
+}
+
+bool fpu_has_avx2(void) {
+    return have_avx2;
+}
+
+// False before fpu_init() on this CPU and inside another SIMD section
+bool kernel_fpu_usable(void) {
+    return this_cpu_read(fpu_state) == FPU_IDLE;
+}
+
+// Caller checked kernel_fpu_usable(). No sleeping until kernel_fpu_end().
+void kernel_fpu_begin(void) {
+    this_cpu_inc(preempt_count);
+    this_cpu_write(fpu_state, FPU_BUSY);
+    barrier();
+    uint8_t* area = fpu_area[this_cpu_read(id)];
+    if (use_xsave) {
+        asm volatile ("xsave64 (%0)" : : "r"(area), "a"((uint32_t)xcr0),
+                      "d"((uint32_t)(xcr0 >> 32)) : "memory");
+    } else {
+        asm volatile ("fxsave64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+void kernel_fpu_end(void) {
+    uint8_t* area = fpu_area[this_cpu_read(id)];
+    if (use_xsave) {
+        asm volatile ("xrstor64 (%0)" : : "r"(area), "a"((uint32_t)xcr0),
+                      "d"((uint32_t)(xcr0 >> 32)) : "memory");
+    } else {
+        asm volatile ("fxrstor64 (%0)" : : "r"(area) : "memory");
+    }
+    barrier();
+    this_cpu_write(fpu_state, FPU_IDLE);
+    this_cpu_dec(preempt_count);
+}
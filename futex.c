@@ -0,0 +1,172 @@
+// futex.c — Address-keyed wait queues (wait_on_address / wake_address)
+#include "kernel.h"
+
+// Waiters hash by address into buckets, each with its own lock, so
+// unrelated addresses never contend. A waiter lives on the sleeping
+// thread's stack and is only touched under its bucket (or timeout) lock.
+
+#define FUTEX_HASH_BITS     6
+#define FUTEX_HASH_SIZE     (1 << FUTEX_HASH_BITS)
+
+struct futex_waiter {
+    volatile uint32_t* addr;
+    struct thread* thread;
+    uint64_t deadline;              // sched_get_ticks() value, 0 = none
+    bool woken;
+    bool timed;                     // Linked on timed_waiters
+    struct futex_waiter* next;
+    struct futex_waiter* prev;
+    struct futex_waiter* timed_next;
+};
+
+struct futex_bucket {
+    spinlock_t lock;
+    struct futex_waiter* head;
+    struct futex_waiter* tail;
+} __attribute__((aligned(64)));
+
+static struct futex_bucket buckets[FUTEX_HASH_SIZE];
+static struct futex_waiter* timed_waiters = NULL;
+static spinlock_t timed_lock;
+
+static struct futex_bucket* futex_bucket(volatile uint32_t* addr) {
+    // Fibonacci hashing; the low 2 bits of an aligned u32 carry nothing
+    uint64_t key = (uint64_t)addr >> 2;
+    return &buckets[(key * 0x9E3779B97F4A7C15ULL) >> (64 - FUTEX_HASH_BITS)];
+}
+
+static void bucket_remove(struct futex_bucket* b, struct futex_waiter* w) {
+    if (w->prev) w->prev->next = w->next;
+    else b->head = w->next;
+    if (w->next) w->next->prev = w->prev;
+    else b->tail = w->prev;
+    w->next = w->prev = NULL;
+}
+
+static void timed_remove(struct futex_waiter* w) {
+    spin_lock(&timed_lock);
+    if (w->timed) {
+        for (struct futex_waiter** pp = &timed_waiters; *pp; pp = &(*pp)->timed_next) {
+            if (*pp == w) {
+                *pp = w->timed_next;
+                break;
+            }
+        }
+        w->timed = false;
+    }
+    spin_unlock(&timed_lock);
+}
+
+void futex_init(void) {
+    for (uint32_t i = 0; i < FUTEX_HASH_SIZE; i++) {
+        spin_init(&buckets[i].lock);
+        buckets[i].head = buckets[i].tail = NULL;
+    }
+    spin_init(&timed_lock);
+    timed_waiters = NULL;
+}
+
+// Sleep while *addr == expected. The value check and the enqueue happen
+// under the bucket lock, so a wake_address() that follows a store to
+// *addr can never be missed.
+int wait_on_address(volatile uint32_t* addr, uint32_t expected, uint64_t timeout_ms) {
+    struct futex_bucket* b = futex_bucket(addr);
+    struct thread* self = (struct thread*)this_cpu_read(current_thread);
+    struct futex_waiter w = {
+        .addr = addr,
+        .thread = self,
+        .deadline = 0,
+    };
+    int ret = FUTEX_OK;
+    
+    uint64_t flags = local_irq_save();
+    spin_lock(&b->lock);
+    if (*addr != expected) {
+        spin_unlock(&b->lock);
+        local_irq_restore(flags);
+        return FUTEX_AGAIN;
+    }
+    
+    w.prev = b->tail;
+    if (b->tail) b->tail->next = &w;
+    else b->head = &w;
+    b->tail = &w;
+    self->state = TASK_BLOCKED;
+    spin_unlock(&b->lock);
+    
+    if (timeout_ms) {
+        w.deadline = sched_get_ticks() + (timeout_ms + SCHED_TICK_MS - 1) / SCHED_TICK_MS;
+        spin_lock(&timed_lock);
+        w.timed = true;
+        w.timed_next = timed_waiters;
+        timed_waiters = &w;
+        spin_unlock(&timed_lock);
+    }
+    
+    while (1) {
+        schedule();
+        
+        spin_lock(&b->lock);
+        if (w.woken) {
+            spin_unlock(&b->lock);
+            break;
+        }
+        if (w.deadline && sched_get_ticks() >= w.deadline) {
+            bucket_remove(b, &w);
+            spin_unlock(&b->lock);
+            ret = FUTEX_TIMEDOUT;
+            break;
+        }
+        // Stale wake-up from an earlier wait: go back to sleep
+        self->state = TASK_BLOCKED;
+        spin_unlock(&b->lock);
+    }
+    
+    if (w.deadline) timed_remove(&w);
+    local_irq_restore(flags);
+    return ret;
+}
+
+// Wake up to n threads waiting on addr, oldest first
+uint32_t wake_address(volatile uint32_t* addr, uint32_t n) {
+    struct futex_bucket* b = futex_bucket(addr);
+    uint32_t woken = 0;
+    
+    uint64_t flags = local_irq_save();
+    spin_lock(&b->lock);
+    struct futex_waiter* w = b->head;
+    while (w && woken < n) {
+        struct futex_waiter* next = w->next;
+        if (w->addr == addr) {
+            bucket_remove(b, w);
+            w->woken = true;
+            sched_wake(w->thread);
+            woken++;
+        }
+        w = next;
+    }
+    spin_unlock(&b->lock);
+    local_irq_restore(flags);
+    
+    return woken;
+}
+
+// Timer tick: wake waiters whose timeout has expired. The waiter itself
+// notices the deadline and unlinks from its bucket.
+void futex_tick(void) {
+    uint64_t now = sched_get_ticks();
+    
+    spin_lock(&timed_lock);
+    struct futex_waiter** pp = &timed_waiters;
+    while (*pp) {
+        struct futex_waiter* w = *pp;
+        if (now >= w->deadline) {
+            *pp = w->timed_next;
+            w->timed = false;
+            sched_wake(w->thread);
+        } else {
+            pp = &w->timed_next;
+        }
+    }
+    spin_unlock(&timed_lock);
+}
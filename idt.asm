@@ -7,12 +7,10 @@ bits 64
 ; Экспортируем функции
 global idt_install
 global idt_set_gate
-global interrupt_handler
 
 ; Импорты из C
 extern idt_ptr
-extern isr_handler
-extern irq_handler
+extern interrupt_handler
 
 ; IDT установка — загрузка таблицы прерываний
 idt_install:
@@ -123,6 +121,12 @@ ISR_NOERR 31    ; Reserved
 
 ; Общий обработчик для исключений
 isr_common:
+    ; Из ring 3: переключаем GS на per-CPU область ядра
+    ; [rsp+24] = CS прерванного кода
+    test qword [rsp + 24], 3
+    jz .kernel_entry
+    swapgs
+.kernel_entry:
     ; Сохраняем регистры на стеке
     push rax
     push rcx
@@ -144,9 +148,12 @@ isr_common:
     ; +120 = номер вектора
     ; +128 = код ошибки
     
-    ; Вызываем C обработчик
-    mov rdi, rsp              ; Указатель на struct registers
-    call isr_handler
+    ; Вызываем C обработчик:
+    ; interrupt_handler(frame, vector, error_code)
+    mov rdi, rsp
+    mov rsi, [rsp + 120]
+    mov rdx, [rsp + 128]
+    call interrupt_handler
     
     ; Восстанавливаем регистры и возвращаемся
     pop r15
@@ -168,6 +175,11 @@ isr_common:
     ; Добавляем 16 байт (номер вектора + код ошибки)
     add rsp, 16
     
+    ; Возврат в ring 3: возвращаем пользовательскую базу GS
+    test qword [rsp + 8], 3
+    jz .kernel_exit
+    swapgs
+.kernel_exit:
     ; Возврат из прерывания
     iretq
 
@@ -202,8 +214,36 @@ IRQ 13   ; IRQ13 — FPU
 IRQ 14   ; IRQ14 — primary ATA
 IRQ 15   ; IRQ15 — secondary ATA
 
+; ============================================================
+; Векторы 48-255: MSI/MSI-X, таймер LAPIC, IPI, spurious
+; Адреса заглушек собраны в таблицу irq_vector_stubs для idt_init
+; ============================================================
+
+%macro VECTOR 1
+irq_vector%1:
+    push 0
+    push %1
+    jmp irq_common
+%endmacro
+
+%macro VECTOR_ADDR 1
+    dq irq_vector%1
+%endmacro
+
+%assign vec 48
+%rep 256 - 48
+VECTOR vec
+%assign vec vec + 1
+%endrep
+
 ; Общий обработчик для IRQ
 irq_common:
+    ; Из ring 3: переключаем GS на per-CPU область ядра
+    ; [rsp+24] = CS прерванного кода
+    test qword [rsp + 24], 3
+    jz .kernel_entry
+    swapgs
+.kernel_entry:
     ; Сохраняем все регистры
     push rax
     push rcx
@@ -221,28 +261,13 @@ irq_common:
     push r14
     push r15
     
-    ; Вызываем C обработчик
+    ; Вызываем C обработчик:
+    ; interrupt_handler(frame, vector, error_code)
+    ; EOI отправляет сам обработчик через LAPIC (PIC замаскирован)
     mov rdi, rsp
-    call irq_handler
-    
-    ; Отправляем End of Interrupt (EOI)
-    ; Проверяем какой контроллер прерываний вызвал
-    ; Получаем номер IRQ из стека
-    mov rax, [rsp + 120]     ; Номер вектора
-    sub rax, 32              ; Получаем номер IRQ
-    
-    ; Если IRQ >= 8, нужно послать EOI на slave контроллер
-    cmp al, 8
-    jb .send_eoi_only
-    
-    ; EOI на slave PIC
-    mov al, 0xA0
-    out 0xA0, al
-    
-.send_eoi_only:
-    ; EOI на master PIC
-    mov al, 0x20
-    out 0x20, al
+    mov rsi, [rsp + 120]     ; Номер вектора
+    mov rdx, [rsp + 128]     ; Код ошибки
+    call interrupt_handler
     
     ; Восстанавливаем регистры
     pop r15
@@ -262,6 +287,11 @@ irq_common:
     pop rax
     
     add rsp, 16
+    
+    test qword [rsp + 8], 3
+    jz .kernel_exit
+    swapgs
+.kernel_exit:
     iretq
 
 ; ============================================================
@@ -325,6 +355,18 @@ isr_syscall:
     ; Это упрощённая версия — полная нуждается в проверках
     iretq
 
+section .rodata
+
+; Адреса заглушек векторов 48-255 (IRQ_VECTOR_STUB_BASE в kernel.h)
+global irq_vector_stubs
+align 8
+irq_vector_stubs:
+%assign vec 48
+%rep 256 - 48
+VECTOR_ADDR vec
+%assign vec vec + 1
+%endrep
+
 section .data
 
 ; Таблица IDT (заполняется программно или здесь)
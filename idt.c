@@ -18,10 +18,37 @@ struct idt_ptr {
     uint64_t base;
 } __attribute__((packed));
 
+// One handler on a vector; devices sharing a vector form a chain
+struct irq_action {
+    irq_handler_t handler;
+    void* context;
+    struct irq_action* next;
+    struct rcu_head rcu;
+};
+
 static struct idt_entry idt[IDT_ENTRIES];
 static struct idt_ptr idtp;
-static void (*irq_handlers[16])(void) = {0};
-static void* irq_contexts[16] = {0};
+
+// Vectors 48-239 are allocated per CPU: the same number can mean different
+// devices on different CPUs. ISA IRQ vectors 32-47 are the same everywhere.
+static struct irq_action* vector_actions[MAX_CPUS][IDT_ENTRIES];
+static uint64_t vector_used[MAX_CPUS][IDT_ENTRIES / 64];
+static uint32_t vector_count[MAX_CPUS];
+static uint32_t vector_cursor[MAX_CPUS];
+static spinlock_t vector_lock;
+
+// Per CPU and vector: top-half time, plus bottom-half time of softirqs
+// the vector raised. Timer and reschedule vectors may switch threads,
+// so they are counted but not timed.
+struct irq_stat {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t bh_cycles;
+    uint64_t unhandled;         // No handler in the chain claimed it
+};
+static struct irq_stat irq_stats[MAX_CPUS][IDT_ENTRIES];
+static uint64_t ipi_sent[MAX_CPUS][IPI_TYPES];
+static uint64_t exception_counts[32];   // Global: may fire before GS is set up
 
 // Exception names for debugging
 static const char* exception_names[32] = {
@@ -85,6 +112,7 @@ extern void irq12(void);
 extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
+extern void* irq_vector_stubs[IDT_ENTRIES - IRQ_VECTOR_STUB_BASE];
 
 static void (*exception_handlers[32])(uint64_t, uint64_t) = {0};
 
@@ -100,6 +128,15 @@ void idt_set_gate(uint8_t num, void* handler, uint8_t type_attr) {
     idt[num].zero = 0;
 }
 
+void idt_set_ist(uint8_t num, uint8_t ist) {
+    idt[num].ist = ist & 0x7;
+}
+
+// APs share the BSP's table
+void idt_load(void) {
+    asm volatile ("lidt %0" : : "m"(idtp));
+}
+
 void idt_init(void) {
     memset(idt, 0, sizeof(idt));
     
@@ -155,6 +192,21 @@ void idt_init(void) {
     idt_set_gate(46, (void*)irq14, 0x8E);
     idt_set_gate(47, (void*)irq15, 0x8E);
     
+    // Vectors 48-255: MSI/MSI-X, LAPIC timer, IPIs, spurious
+    for (uint32_t v = IRQ_VECTOR_STUB_BASE; v < IDT_ENTRIES; v++) {
+        idt_set_gate(v, irq_vector_stubs[v - IRQ_VECTOR_STUB_BASE], 0x8E);
+    }
+    
+    // Vectors the allocator must never hand out
+    spin_init(&vector_lock);
+    LOCK_STAT_NAME(&vector_lock, "irq vectors");
+    memset(vector_used, 0, sizeof(vector_used));
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        bitmap_set(vector_used[cpu], SYSCALL_VECTOR);
+        bitmap_set(vector_used[cpu], LAPIC_TIMER_VECTOR);
+        vector_cursor[cpu] = IRQ_VECTOR_DYN_BASE;
+    }
+    
     // Load IDT
     idtp.limit = sizeof(idt) - 1;
     idtp.base = (uint64_t)idt;
@@ -164,11 +216,212 @@ void idt_init(void) {
     kprintf("IDT: Initialized %d entries\n", IDT_ENTRIES);
 }
 
-void irq_register_handler(uint8_t irq, void (*handler)(void), void* context) {
-    if (irq < 16) {
-        irq_handlers[irq] = handler;
-        irq_contexts[irq] = context;
+// Reserve a free vector in [IRQ_VECTOR_DYN_BASE, IRQ_VECTOR_DYN_END] on cpu.
+// Next-fit from the last allocation, so consecutive devices land in
+// different LAPIC priority classes. Returns -1 when the CPU is full.
+int irq_alloc_vector(uint32_t cpu) {
+    if (cpu >= MAX_CPUS) return -1;
+    
+    uint64_t flags = spin_lock_irqsave(&vector_lock);
+    
+    int vector = -1;
+    uint32_t span = IRQ_VECTOR_DYN_END - IRQ_VECTOR_DYN_BASE + 1;
+    for (uint32_t i = 0; i < span; i++) {
+        uint32_t v = IRQ_VECTOR_DYN_BASE +
+                     (vector_cursor[cpu] - IRQ_VECTOR_DYN_BASE + i) % span;
+        if (!bitmap_test(vector_used[cpu], v)) {
+            bitmap_set(vector_used[cpu], v);
+            vector_count[cpu]++;
+            vector_cursor[cpu] = v + 1;
+            vector = v;
+            break;
+        }
+    }
+    
+    spin_unlock_irqrestore(&vector_lock, flags);
+    return vector;
+}
+
+// Allocate on the online CPU with the fewest dynamic vectors
+int irq_alloc_vector_spread(uint32_t* cpu) {
+    uint32_t best = 0;
+    for (uint32_t i = 1; i < MAX_CPUS; i++) {
+        if (cpu_get(i)->online && vector_count[i] < vector_count[best]) best = i;
+    }
+    int vector = irq_alloc_vector(best);
+    if (vector >= 0 && cpu) *cpu = best;
+    return vector;
+}
+
+void irq_free_vector(uint32_t cpu, uint8_t vector) {
+    if (cpu >= MAX_CPUS || vector < IRQ_VECTOR_DYN_BASE || vector > IRQ_VECTOR_DYN_END) return;
+    
+    uint64_t flags = spin_lock_irqsave(&vector_lock);
+    if (bitmap_test(vector_used[cpu], vector)) {
+        bitmap_clear(vector_used[cpu], vector);
+        vector_count[cpu]--;
+    }
+    spin_unlock_irqrestore(&vector_lock, flags);
+}
+
+// Chain handler(context) onto vector on cpu. A vector may be shared: every
+// handler in the chain runs and reports whether its device was the source.
+int irq_request(uint32_t cpu, uint8_t vector, irq_handler_t handler, void* context) {
+    if (cpu >= MAX_CPUS || !handler) return -1;
+    struct irq_action* action = (struct irq_action*)kmalloc(sizeof(struct irq_action));
+    if (!action) return -1;
+    action->handler = handler;
+    action->context = context;
+    action->next = NULL;
+    
+    uint64_t flags = spin_lock_irqsave(&vector_lock);
+    // Append at the tail; the store that links it is the publication point
+    struct irq_action** pp = &vector_actions[cpu][vector];
+    while (*pp) pp = &(*pp)->next;
+    atomic_store_ptr(pp, action, ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&vector_lock, flags);
+    return 0;
+}
+
+// Unchain a handler. A dispatcher already walking the chain is fine, the
+// action is only freed after a grace period; the device must still be
+// quiet (masked) so that no new work gets queued for the context.
+static void irq_action_free(struct rcu_head* head) {
+    kfree(container_of(head, struct irq_action, rcu));
+}
+
+void irq_release(uint32_t cpu, uint8_t vector, irq_handler_t handler, void* context) {
+    if (cpu >= MAX_CPUS) return;
+    struct irq_action* found = NULL;
+    
+    uint64_t flags = spin_lock_irqsave(&vector_lock);
+    for (struct irq_action** pp = &vector_actions[cpu][vector]; *pp; pp = &(*pp)->next) {
+        if ((*pp)->handler == handler && (*pp)->context == context) {
+            found = *pp;
+            rcu_assign_pointer(*pp, found->next);
+            break;
+        }
     }
+    spin_unlock_irqrestore(&vector_lock, flags);
+    
+    // irq_dispatch() on cpu may still be walking past it
+    if (found) call_rcu(&found->rcu, irq_action_free);
+}
+
+// ISA IRQ 0-15 on its fixed vector 32 + irq; the IOAPIC may send it to
+// any CPU, so the handler is chained on all of them
+void irq_register_handler(uint8_t irq, irq_handler_t handler, void* context) {
+    if (irq >= 16) return;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        irq_request(cpu, IRQ_VECTOR_OFFSET + irq, handler, context);
+    }
+}
+
+static void irq_dispatch(uint8_t vector) {
+    uint32_t cpu = this_cpu_read(id);
+    struct irq_stat* st = &irq_stats[cpu][vector];
+    uint64_t start = rdtsc();
+    bool handled = false;
+    
+    this_cpu_write(irq_vector, vector);
+    struct irq_action* action =
+        atomic_load_ptr(&vector_actions[cpu][vector], ATOMIC_ACQUIRE);
+    for (; action; action = atomic_load_ptr(&action->next, ATOMIC_ACQUIRE)) {
+        handled |= action->handler(action->context);
+    }
+    this_cpu_write(irq_vector, 0);
+    
+    st->count++;
+    st->cycles += rdtsc() - start;
+    if (!handled) st->unhandled++;
+    this_cpu_inc(irq_count);
+}
+
+// Charge softirq time to the vector that raised it (0 = thread context)
+void irq_account_bh(uint8_t vector, uint64_t cycles) {
+    if (vector) irq_stats[this_cpu_read(id)][vector].bh_cycles += cycles;
+}
+
+void irq_count_ipi(uint32_t type) {
+    if (type < IPI_TYPES) ipi_sent[this_cpu_read(id)][type]++;
+}
+
+// Right-aligned decimal column (kprintf has no field width)
+static void print_col(uint64_t val, int width) {
+    char buf[24];
+    int i = sizeof(buf) - 1;
+    buf[i] = 0;
+    do {
+        buf[--i] = '0' + val % 10;
+        val /= 10;
+    } while (val && i > 0);
+    while ((int)sizeof(buf) - 1 - i < width && i > 0) buf[--i] = ' ';
+    kprintf("%s", &buf[i]);
+}
+
+static const char* vector_name(uint32_t vector) {
+    if (vector == LAPIC_TIMER_VECTOR) return "Local timer interrupts";
+    if (vector == IPI_VECTOR_RESCHEDULE) return "Rescheduling interrupts";
+    if (vector == IRQ_SPURIOUS) return "Spurious interrupts";
+    if (vector < IRQ_VECTOR_DYN_BASE) return "IO-APIC ISA";
+    return "Dynamic";
+}
+
+// /proc/interrupts-style table: one row per vector that fired, a count
+// column per online CPU, then total top-half / bottom-half time
+void irq_dump_stats(void) {
+    kprintf("    ");
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!cpu_get(cpu)->online) continue;
+        kprintf("       CPU%u", cpu);
+    }
+    kprintf("    top(us)     bh(us)\n");
+    
+    uint64_t unhandled[MAX_CPUS] = {0};
+    for (uint32_t vector = IRQ_VECTOR_OFFSET; vector < IDT_ENTRIES; vector++) {
+        uint64_t total = 0, top = 0, bh = 0;
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+            struct irq_stat* st = &irq_stats[cpu][vector];
+            total += st->count;
+            top += st->cycles;
+            bh += st->bh_cycles;
+            unhandled[cpu] += st->unhandled;
+        }
+        if (!total) continue;
+        
+        print_col(vector, 3);
+        kprintf(":");
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (cpu_get(cpu)->online) print_col(irq_stats[cpu][vector].count, 11);
+        }
+        print_col(clock_cycles_to_ns(top) / 1000, 11);
+        print_col(clock_cycles_to_ns(bh) / 1000, 11);
+        kprintf("  %s\n", vector_name(vector));
+    }
+    
+    static const char* ipi_names[IPI_TYPES] = {
+        "Rescheduling IPIs sent", "INIT IPIs sent", "Startup IPIs sent", "Other IPIs sent"
+    };
+    for (uint32_t type = 0; type < IPI_TYPES; type++) {
+        kprintf("IPI:");
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (cpu_get(cpu)->online) print_col(ipi_sent[cpu][type], 11);
+        }
+        kprintf("  %s\n", ipi_names[type]);
+    }
+    
+    kprintf("UNH:");
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpu_get(cpu)->online) print_col(unhandled[cpu], 11);
+    }
+    kprintf("  Unhandled (no handler claimed)\n");
+    
+    for (uint32_t num = 0; num < 32; num++) {
+        if (exception_counts[num]) {
+            kprintf("EXC %u: %lu  %s\n", num, exception_counts[num], exception_names[num]);
+        }
+    }
+    softirq_dump_stats();
 }
 
 void interrupt_handler(uint64_t* frame, uint64_t num, uint64_t err) {
@@ -176,20 +429,38 @@ void interrupt_handler(uint64_t* frame, uint64_t num, uint64_t err) {
     
     if (num < 32) {
         // Exception
+        atomic_fetch_add64(&exception_counts[num], 1, ATOMIC_RELAXED);
         kprintf("EXCEPTION %lu: %s\n", num, exception_names[num]);
         kprintf("  Error code: %lu\n", err);
+        if ((num == 14 || num == 8) && kstack_is_guard(read_cr2())) {
+            kprintf("  Kernel stack overflow (guard page hit at %p)\n", (void*)read_cr2());
+        }
         if (num == 14) { // Page fault
             kprintf("  CR2=%p\n", read_cr2());
             kprintf("  Present: %d, Write: %d, User: %d\n",
                 (err & 1) ? 1 : 0, (err & 2) ? 1 : 0, (err & 4) ? 1 : 0);
         }
         kernel_panic("Unhandled exception");
-    } else if (num >= 32 && num < 48) {
-        // IRQ
-        uint8_t irq = num - 32;
-        if (irq_handlers[irq]) {
-            irq_handlers[irq]();
-        }
+    } else if (num == LAPIC_TIMER_VECTOR) {
+        irq_stats[this_cpu_read(id)][num].count++;
+        // EOI first: the tick may switch away from this stack
+        lapic_eoi();
+        lapic_timer_interrupt();
+        irq_exit();
+    } else if (num == IPI_VECTOR_RESCHEDULE) {
+        irq_stats[this_cpu_read(id)][num].count++;
+        // EOI first: sched_ipi() may switch away from this stack
+        lapic_eoi();
+        sched_ipi();
+        irq_exit();
+    } else if (num != IRQ_SPURIOUS) {
+        // ISA IRQs and dynamically allocated device vectors: the top half
+        // only acks and queues, bottom halves run in irq_exit().
+        irq_dispatch(num);
         lapic_eoi();
+        irq_exit();
+    } else {
+        // Spurious interrupts are counted but not acknowledged
+        irq_stats[this_cpu_read(id)][num].count++;
     }
 }
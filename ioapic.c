@@ -1,43 +1,195 @@
-// ioapic.c — IO APIC driver stub
+// ioapic.c — IO APIC driver: redirection table and IRQ affinity
 #include "kernel.h"
 
-static volatile uint32_t ioapic_bases[MAX_IOAPICS];
-static uint32_t gsi_bases[MAX_IOAPICS];
+// Each ISA IRQ maps to a GSI (identity unless the MADT overrides it), and
+// each GSI to a pin on the IOAPIC whose range covers it. Routing state is
+// cached per IRQ so affinity changes rewrite only the destination.
+
+#define IOAPIC_REDTBL(pin)      (0x10 + (pin) * 2)
+
+#define REDIR_DELIVERY_LOWEST   (1 << 8)
+#define REDIR_DEST_LOGICAL      (1 << 11)
+#define REDIR_ACTIVE_LOW        (1 << 13)
+#define REDIR_LEVEL             (1 << 15)
+#define REDIR_MASKED            (1 << 16)
+
+struct ioapic {
+    volatile uint32_t* base;
+    uint32_t gsi_base;
+    uint32_t pins;
+    spinlock_t lock;            // Guards the select/window register pair
+};
+
+struct irq_route {
+    bool valid;
+    uint32_t gsi;
+    uint32_t flags;             // REDIR_ACTIVE_LOW | REDIR_LEVEL
+    uint8_t vector;
+    uint64_t cpu_mask;
+    bool masked;
+};
+
+static struct ioapic ioapics[MAX_IOAPICS];
 static uint8_t num_ioapics = 0;
+static struct irq_route routes[MAX_IRQS];
+
+static uint32_t ioapic_read(struct ioapic* io, uint32_t reg) {
+    io->base[IOAPIC_REG_SELECT / 4] = reg;
+    return io->base[IOAPIC_REG_WINDOW / 4];
+}
+
+static void ioapic_write(struct ioapic* io, uint32_t reg, uint32_t val) {
+    io->base[IOAPIC_REG_SELECT / 4] = reg;
+    io->base[IOAPIC_REG_WINDOW / 4] = val;
+}
+
+static struct ioapic* ioapic_for_gsi(uint32_t gsi, uint32_t* pin) {
+    for (uint8_t i = 0; i < num_ioapics; i++) {
+        struct ioapic* io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->pins) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return NULL;
+}
+
+// ISA IRQs default to edge/active high, everything above to PCI-style
+// level/active low; MADT overrides (MPS INTI flags) win.
+static void ioapic_route_init(uint8_t irq, struct irq_route* r) {
+    uint32_t gsi = irq;
+    uint16_t inti = 0;
+    r->flags = (irq < 16) ? 0 : (REDIR_ACTIVE_LOW | REDIR_LEVEL);
+    
+    if (irq < 16 && acpi_get_irq_override(irq, &gsi, &inti)) {
+        if ((inti & 0x3) == 0x3) r->flags |= REDIR_ACTIVE_LOW;
+        else if ((inti & 0x3) == 0x1) r->flags &= ~REDIR_ACTIVE_LOW;
+        if (((inti >> 2) & 0x3) == 0x3) r->flags |= REDIR_LEVEL;
+        else if (((inti >> 2) & 0x3) == 0x1) r->flags &= ~REDIR_LEVEL;
+    }
+    
+    r->gsi = gsi;
+    r->cpu_mask = 1;            // BSP until told otherwise
+    r->masked = true;
+    r->valid = true;
+}
+
+// Destination field and mode for a CPU mask. Several CPUs use logical
+// flat mode with lowest-priority delivery (xAPIC only: an 8-bit IOAPIC
+// destination cannot name x2APIC logical IDs without interrupt remapping).
+static uint32_t ioapic_dest(uint64_t mask, uint32_t* mode) {
+    mask &= CPU_MASK_ALL;
+    uint32_t first = mask ? __builtin_ctzll(mask) : 0;
+    
+    if ((mask & (mask - 1)) && !lapic_is_x2apic()) {
+        uint32_t logical = 0;
+        for (uint32_t i = 0; i < MAX_CPUS; i++) {
+            if ((mask & (1ULL << i)) && cpu_get(i)->online) logical |= 1u << i;
+        }
+        if (logical) {
+            *mode = REDIR_DEST_LOGICAL | REDIR_DELIVERY_LOWEST;
+            return logical;
+        }
+    }
+    *mode = 0;
+    return cpu_get(first)->apic_id;
+}
+
+static void ioapic_program(struct irq_route* r) {
+    uint32_t pin;
+    struct ioapic* io = ioapic_for_gsi(r->gsi, &pin);
+    if (!io) return;
+    
+    uint32_t mode;
+    uint32_t dest = ioapic_dest(r->cpu_mask, &mode);
+    uint32_t low = r->vector | mode | r->flags | (r->masked ? REDIR_MASKED : 0);
+    
+    uint64_t flags = spin_lock_irqsave(&io->lock);
+    // Mask while the halves disagree, write destination, then the rest
+    ioapic_write(io, IOAPIC_REDTBL(pin), REDIR_MASKED);
+    ioapic_write(io, IOAPIC_REDTBL(pin) + 1, dest << 24);
+    ioapic_write(io, IOAPIC_REDTBL(pin), low);
+    spin_unlock_irqrestore(&io->lock, flags);
+}
 
 void ioapic_init(void) {
     num_ioapics = acpi_get_ioapic_count();
+    if (num_ioapics > MAX_IOAPICS) num_ioapics = MAX_IOAPICS;
     
     if (num_ioapics == 0) {
         // Default IOAPIC
         num_ioapics = 1;
-        ioapic_bases[0] = 0xFEC00000;
-        gsi_bases[0] = 0;
     }
     
     for (uint8_t i = 0; i < num_ioapics; i++) {
+        struct ioapic* io = &ioapics[i];
         uint32_t phys = acpi_get_ioapic_addr(i);
         if (phys == 0) phys = 0xFEC00000;
         
-        gsi_bases[i] = acpi_get_ioapic_gsi_base(i);
+        io->base = (volatile uint32_t*)PHYS_TO_VIRT(phys);
+        io->gsi_base = acpi_get_ioapic_gsi_base(i);
+        io->pins = ((ioapic_read(io, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+        spin_init(&io->lock);
+        
+        // Start with every pin masked
+        for (uint32_t pin = 0; pin < io->pins; pin++) {
+            ioapic_write(io, IOAPIC_REDTBL(pin), REDIR_MASKED);
+            ioapic_write(io, IOAPIC_REDTBL(pin) + 1, 0);
+        }
         
-        kprintf("IOAPIC[%u]: addr=0x%X, gsi=%u\n", i, phys, gsi_bases[i]);
+        kprintf("IOAPIC[%u]: addr=0x%x, gsi=%u-%u\n", i, phys,
+            io->gsi_base, io->gsi_base + io->pins - 1);
     }
     
+    memset(routes, 0, sizeof(routes));
     kprintf("IOAPIC: %u IOAPICs initialized\n", num_ioapics);
 }
 
+// Route IRQ to vector on CPU dest (index into the per-CPU array), masked;
+// ioapic_unmask_irq() enables it once the handler is in place.
 void ioapic_set_irq(uint8_t irq, uint8_t vector, uint32_t dest) {
-    (void)irq;
-    (void)vector;
-    (void)dest;
-    // Would configure IOAPIC redirection entry
+    struct irq_route* r = &routes[irq];
+    if (!r->valid) ioapic_route_init(irq, r);
+    r->vector = vector;
+    r->cpu_mask = (dest < MAX_CPUS) ? (1ULL << dest) : 1;
+    ioapic_program(r);
+}
+
+// Deliver IRQ to the CPUs in cpu_mask: one CPU is physical mode, several
+// are lowest-priority logical mode (or the first of them under x2APIC).
+// Only routes on the ISA vectors (32-47) can move: irq_register_handler()
+// chains those on every CPU, while a vector from irq_alloc_vector() has a
+// handler only on the CPU it was allocated on.
+int ioapic_set_irq_affinity(uint8_t irq, uint64_t cpu_mask) {
+    struct irq_route* r = &routes[irq];
+    cpu_mask &= CPU_MASK_ALL;
+    if (!r->valid || !cpu_mask) return -1;
+    if (r->vector < IRQ_VECTOR_OFFSET || r->vector >= IRQ_VECTOR_OFFSET + 16) return -1;
+    r->cpu_mask = cpu_mask;
+    ioapic_program(r);
+    return 0;
+}
+
+uint64_t ioapic_get_irq_affinity(uint8_t irq) {
+    return routes[irq].valid ? routes[irq].cpu_mask : 0;
+}
+
+uint32_t ioapic_irq_to_gsi(uint8_t irq) {
+    struct irq_route* r = &routes[irq];
+    if (!r->valid) ioapic_route_init(irq, r);
+    return r->gsi;
 }
 
 void ioapic_mask_irq(uint8_t irq) {
-    (void)irq;
+    struct irq_route* r = &routes[irq];
+    if (!r->valid || r->masked) return;
+    r->masked = true;
+    ioapic_program(r);
 }
 
 void ioapic_unmask_irq(uint8_t irq) {
-    (void)irq;
+    struct irq_route* r = &routes[irq];
+    if (!r->valid || !r->masked) return;
+    r->masked = false;
+    ioapic_program(r);
 }
@@ -10,13 +10,13 @@ extern struct net_device* net_get_device(void);
 
 uint16_t ip_checksum(void* data, uint32_t len) {
     uint32_t sum = 0;
-    uint16_t* ptr = (uint16_t*)data;
+    const csum_word_t* ptr = data;
     while (len > 1) {
         sum += *ptr++;
         len -= 2;
     }
     if (len) {
-        sum += *(uint8_t*)ptr;
+        sum += *(const uint8_t*)ptr;
     }
     while (sum >> 16) {
         sum = (sum & 0xFFFF) + (sum >> 16);
@@ -50,8 +50,8 @@ void ip_send(uint32_t dst, uint8_t proto, void* data, uint16_t len) {
     }
     
     // Get MAC address via ARP
-    uint8_t* dst_mac = arp_lookup(dst);
-    if (!dst_mac) {
+    uint8_t dst_mac[ETH_ALEN];
+    if (!arp_lookup(dst, dst_mac)) {
         arp_request(dst);
         kfree(ip);
         return;
@@ -65,6 +65,7 @@ void ip_send(uint32_t dst, uint8_t proto, void* data, uint16_t len) {
     }
     
     memcpy(eth->dst, dst_mac, ETH_ALEN);
+    rcu_read_lock();
     struct net_device* dev = net_get_device();
     if (dev) {
         memcpy(eth->src, dev->mac, ETH_ALEN);
@@ -78,6 +79,7 @@ void ip_send(uint32_t dst, uint8_t proto, void* data, uint16_t len) {
     if (dev && dev->tx) {
         dev->tx(eth, sizeof(struct eth_header) + total_len);
     }
+    rcu_read_unlock();
     
     kfree(eth);
     kfree(ip);
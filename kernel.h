@@ -7,6 +7,8 @@
 #include <stdbool.h>
 #include <stdarg.h>
 
+#include "atomic.h"
+
 // Version
 #define KOS_VERSION             "KOS 1.0.0-Laptop"
 #define KOS_VERSION_MAJOR       1
@@ -16,6 +18,8 @@
 // Hardware limits (твой ноут: 16GB, 8 threads)
 #define MAX_CPUS                8
 #define MAX_IOAPICS             4
+#define MAX_IRQ_OVERRIDES       16
+#define MAX_PCIE_SEGMENTS       4
 #define MAX_PCI_DEVICES         256
 #define MAX_IRQS                256
 #define MAX_MEMORY_GB           16
@@ -26,13 +30,29 @@
 #define KERNEL_TEXT_START       0xFFFF800000000000ULL
 #define USER_SPACE_START        0x0000000000400000ULL
 #define USER_STACK_TOP          0x00007FFFFFFFF000ULL
+#ifdef KOS_HOSTED
+// Host test build (tests/): "physical" memory is a file the shim maps twice
+extern uint64_t hosted_phys_offset;
+#define PHYS_TO_VIRT(p)         ((void*)((uint64_t)(p) + hosted_phys_offset))
+#define VIRT_TO_PHYS(v)         ((uint64_t)(v) - hosted_phys_offset)
+#else
 #define PHYS_TO_VIRT(p)         ((void*)((uint64_t)(p) + KERNEL_HIGHER_HALF))
 #define VIRT_TO_PHYS(v)         ((uint64_t)(v) - KERNEL_HIGHER_HALF)
+#endif
 #define PAGE_SIZE               4096
 #define HUGE_PAGE_SIZE          (2 * 1024 * 1024)
 #define PAGE_MASK               (~(PAGE_SIZE - 1))
 #define KERNEL_STACK_SIZE       (PAGE_SIZE * 16)
 
+// Kernel stack pool: dedicated region, each slot = unmapped guard page + stack
+#define KSTACK_REGION_BASE      0xFFFFFE0000000000ULL
+#define KSTACK_SLOT_SIZE        (KERNEL_STACK_SIZE + PAGE_SIZE)
+#define KSTACK_MAX_SLOTS        512
+#define KSTACK_CACHE_SIZE       8
+#define AP_TRAMPOLINE_PHYS      0x8000      // AP real-mode entry (SIPI vector 0x08)
+#define AP_TRAMPOLINE_PML4      0x9000      // Low PML4 used by the trampoline
+#define KSTACK_IST_DOUBLE_FAULT 1
+
 // Page table flags
 #define PT_PRESENT              0x001
 #define PT_WRITABLE             0x002
@@ -51,9 +71,21 @@
 #define IRQ_KEYBOARD            0x21
 #define IRQ_COM1                0x24
 #define IRQ_ETHERNET            0x25
+#define LAPIC_TIMER_VECTOR      0xEF
+#define IPI_VECTOR_RESCHEDULE   0xF0
 #define IRQ_SPURIOUS            0xFF
+#define IRQ_VECTOR_STUB_BASE    48          // First vector served by irq_vector_stubs
+#define IRQ_VECTOR_DYN_BASE     48          // Per-CPU allocatable device vectors
+#define IRQ_VECTOR_DYN_END      0xEE        // Inclusive; 0xEF and up are system vectors
 #define SYSCALL_VECTOR          0x80
 
+// IPI types for the sent-IPI counters
+#define IPI_TYPE_RESCHEDULE     0
+#define IPI_TYPE_INIT           1
+#define IPI_TYPE_STARTUP        2
+#define IPI_TYPE_OTHER          3
+#define IPI_TYPES               4
+
 // Multiboot2
 #define MULTIBOOT_TAG_TYPE_END          0
 #define MULTIBOOT_TAG_TYPE_MMAP         6
@@ -81,6 +113,8 @@
 #define LAPIC_VERSION           0x030
 #define LAPIC_TPR               0x080
 #define LAPIC_EOI               0x0B0
+#define LAPIC_LDR               0x0D0
+#define LAPIC_DFR               0x0E0
 #define LAPIC_SVR               0x0F0
 #define LAPIC_ICR_LOW           0x300
 #define LAPIC_ICR_HIGH          0x310
@@ -162,16 +196,51 @@ extern char _code[];
 extern char _data[];
 extern char _bss[];
 
-// CPU state
+// 64-bit Task State Segment
+struct tss64 {
+    uint32_t reserved0;
+    uint64_t rsp[3];            // Stack loaded on entry from ring N
+    uint64_t reserved1;
+    uint64_t ist[7];            // Interrupt Stack Table, IST1..IST7
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed));
+
+#define CPU_GDT_ENTRIES         7           // null, kcode, kdata, ucode, udata, TSS (2)
+#define GDT_TSS_SELECTOR        0x28
+
+// Kernel SIMD state per CPU (fpu.c)
+#define FPU_OFF                 0   // SSE not enabled on this CPU yet
+#define FPU_IDLE                1
+#define FPU_BUSY                2   // Inside kernel_fpu_begin/end
+
+// CPU state (per-CPU area, IA32_GS_BASE points here while in kernel mode)
 struct cpu {
+    struct cpu* self;           // Must stay first: cpu_get_current() reads %gs:0
+    uint32_t id;                // Logical index into the per-CPU array
     uint8_t apic_id;
     uint8_t acpi_id;
     uint64_t lapic_base;
-    uint64_t tss_rsp0;
     uint64_t current_thread;
+    void* runqueue;
+    uint64_t kstack_cache[KSTACK_CACHE_SIZE];  // Free stack tops, LIFO
+    uint32_t kstack_count;
+    // Statistics
+    uint64_t irq_count;
+    uint64_t context_switches;
+    uint32_t softirq_pending;   // Bit N = softirq N raised on this CPU
+    uint8_t irq_vector;         // Vector whose top half is running, 0 outside
+    bool softirq_active;        // Running softirqs: no nesting, no preemption
+    uint32_t preempt_count;     // rcu_read_lock() nesting: no preemption while > 0
+    uint8_t fpu_state;          // FPU_OFF / FPU_IDLE / FPU_BUSY (kernel SIMD section)
+    uint64_t boot_tsc;          // Cycles from INIT-SIPI to ap_main, 0 on the BSP
+    int64_t tsc_offset;         // Added to rdtsc() to match the BSP's TSC
     bool online;
     bool bsp;
-};
+    uint64_t gdt[CPU_GDT_ENTRIES] __attribute__((aligned(16)));
+    struct tss64 tss;
+} __attribute__((aligned(64)));
 
 // PCI device
 struct pci_device {
@@ -186,13 +255,58 @@ struct pci_device {
     uint8_t irq_pin, irq_line;
     bool msi_capable;
     uint8_t msi_offset;
+    bool msix_capable;
+    uint8_t msix_offset;
+    uint16_t msix_count;            // Table entries
+    volatile uint32_t* msix_table;  // Mapped on first pci_alloc_irq_vectors()
+};
+
+// One allocated MSI/MSI-X message: entry N of the device fires vector on cpu
+struct pci_irq_vector {
+    uint32_t cpu;
+    uint8_t vector;
+};
+
+// Thread states
+#define TASK_RUNNING            0
+#define TASK_SLEEPING           1
+#define TASK_BLOCKED            2
+#define TASK_DEAD               3
+#define TASK_WAKING             4
+
+// Scheduling classes
+#define SCHED_NORMAL            0   // CFS
+#define SCHED_FIFO              1   // RT, runs until it blocks or yields
+#define SCHED_RR                2   // RT, round-robin within a priority level
+#define SCHED_RT_PRIO_MAX       32  // RT priorities 0..31, higher runs first
+#define SCHED_PRIO_NORMAL       128
+#define SCHED_RR_TIMESLICE      10  // Ticks
+#define SCHED_TICK_MS           10  // Scheduler tick period
+#define CPU_MASK_ALL            ((1ULL << MAX_CPUS) - 1)
+
+// Scheduler accounting (TSC cycles)
+struct sched_entity {
+    uint64_t vruntime;
+    uint64_t exec_start;        // rdtsc() when last switched in
+    uint64_t sum_exec;          // Total cycles spent on a CPU
 };
 
 // Thread/Process
 struct thread {
     uint32_t tid;
     uint32_t state;
-    uint32_t prio;
+    uint32_t prio;              // RT priority for SCHED_FIFO/RR, SCHED_PRIO_NORMAL for CFS
+    uint8_t policy;
+    uint16_t rr_ticks;          // Remaining SCHED_RR timeslice
+    volatile bool on_cpu;       // Currently executing (or still switching out)
+    bool on_rq;                 // Linked into a runqueue
+    uint32_t cpu;               // Runqueue it sits on / last ran on
+    uint64_t cpu_mask;          // Allowed CPUs, bit N = cpu_get(N)
+    uint64_t wake_tsc;          // rdtsc() at wake-up, 0 once it ran
+    struct sched_entity se;
+    uint64_t nvcsw;             // Voluntary switches (blocked, yielded, exited)
+    uint64_t nivcsw;            // Involuntary switches (tick, preemption)
+    struct thread* all_next;    // Global thread list, for statistics
     uint64_t vruntime;
     uint64_t rsp;
     uint64_t kernel_stack;
@@ -208,14 +322,113 @@ struct process {
     struct thread main_thread;
 };
 
-// Spinlock
+// Lock contention statistics (make LOCK_STAT=1), updated under the lock
+struct lock_stat {
+    const char* name;
+    struct lock_stat* next;     // Registered locks, see lock_stat_register()
+    uint64_t acquisitions;
+    uint64_t contended;         // Acquisitions that had to wait
+    uint64_t wait_cycles;
+    uint64_t max_wait;
+    uint64_t hold_cycles;
+    uint64_t max_hold;
+    uint64_t acquired_tsc;
+};
+
+// Spinlock: FIFO ticket lock for short critical sections. Zero-filled
+// memory is an unlocked lock.
 typedef struct {
-    volatile uint32_t lock;
+    union {
+        volatile uint32_t val;
+        struct {
+            volatile uint16_t owner;    // Ticket being served
+            volatile uint16_t next;     // Next ticket to hand out
+        };
+    };
+#ifdef LOCK_STAT
+    struct lock_stat stat;
+#endif
 } spinlock_t;
 
+// MCS queued lock for contended locks: each waiter spins on its own node
+// (usually on its stack), so a release touches one remote cache line
+struct mcs_node {
+    struct mcs_node* volatile next;
+    volatile uint32_t locked;
+} __attribute__((aligned(64)));
+
+typedef struct {
+    struct mcs_node* volatile tail;
+#ifdef LOCK_STAT
+    struct lock_stat stat;
+#endif
+} mcs_lock_t;
+
+// Seqlock for small multi-field snapshots that are read far more often
+// than written. seq is odd while a writer is inside; readers never block
+// the writer and retry if seq moved.
+typedef struct {
+    volatile uint32_t seq;
+    spinlock_t lock;            // Serializes writers only
+} seqlock_t;
+
+// Per-CPU counter for hot-path statistics. Each CPU adds into its own
+// cache line and folds into count once its delta reaches batch, so
+// percpu_counter_read() is off by less than batch * MAX_CPUS and
+// percpu_counter_sum() is exact.
+#define PERCPU_COUNTER_BATCH    32
+
+struct percpu_counter_slot {
+    volatile int64_t delta;
+} __attribute__((aligned(64)));
+
+struct percpu_counter {
+    volatile uint64_t count;    // Folded deltas (two's complement)
+    int64_t batch;
+    struct percpu_counter_slot cpu[MAX_CPUS];
+};
+
+// Sleeping locks (mutex.c), all built on wait_on_address()
+struct mutex {
+    volatile uint32_t state;
+    struct thread* volatile owner;
+};
+
+struct semaphore {
+    volatile uint32_t count;
+    volatile uint32_t waiters;
+};
+
+struct condvar {
+    volatile uint32_t seq;
+};
+
+// wait_on_address() results
+#define FUTEX_OK                0
+#define FUTEX_AGAIN             -1  // *addr no longer held the expected value
+#define FUTEX_TIMEDOUT          -2
+
 // Inline utilities
+#ifdef KOS_HOSTED
+// Ring 3 may not touch IF; the host tests are single threaded
+static inline void cli(void) { barrier(); }
+static inline void sti(void) { barrier(); }
+static inline uint64_t local_irq_save(void) { barrier(); return 0; }
+static inline void local_irq_restore(uint64_t flags) { (void)flags; barrier(); }
+#else
 static inline void cli(void) { asm volatile ("cli"); }
 static inline void sti(void) { asm volatile ("sti"); }
+
+static inline uint64_t local_irq_save(void) {
+    uint64_t flags;
+    asm volatile ("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void local_irq_restore(uint64_t flags) {
+    if (flags & 0x200) sti();
+}
+#endif
 static inline void hlt(void) { asm volatile ("hlt"); }
 static inline void pause(void) { asm volatile ("pause"); }
 
@@ -261,6 +474,40 @@ static inline void wrmsr(uint32_t msr, uint64_t val) {
     asm volatile ("wrmsr" : : "a"(low), "d"(high), "c"(msr));
 }
 
+#ifdef KOS_HOSTED
+// Host test build: one CPU, a plain struct in place of %gs
+extern struct cpu hosted_cpu;
+#define this_cpu_read(field) (hosted_cpu.field)
+#define this_cpu_write(field, val) do { hosted_cpu.field = (val); } while (0)
+#define this_cpu_add(field, val) do { hosted_cpu.field += (val); } while (0)
+#else
+// Per-CPU accessors: a single %gs-relative mov, no APIC ID lookup
+#define this_cpu_read(field) ({ \
+    __typeof__(((struct cpu*)0)->field) __val; \
+    asm volatile ("mov %%gs:%c1, %0" \
+        : "=r"(__val) : "i"(offsetof(struct cpu, field))); \
+    __val; })
+
+#define this_cpu_write(field, val) do { \
+    __typeof__(((struct cpu*)0)->field) __val = (val); \
+    asm volatile ("mov %0, %%gs:%c1" \
+        : : "r"(__val), "i"(offsetof(struct cpu, field)) : "memory"); \
+} while (0)
+
+#define this_cpu_add(field, val) do { \
+    __typeof__(((struct cpu*)0)->field) __val = (val); \
+    asm volatile ("add %0, %%gs:%c1" \
+        : : "r"(__val), "i"(offsetof(struct cpu, field)) : "memory", "cc"); \
+} while (0)
+#endif
+
+#define this_cpu_inc(field) this_cpu_add(field, 1)
+#define this_cpu_dec(field) this_cpu_add(field, -1)
+
+static inline struct cpu* cpu_get_current(void) {
+    return this_cpu_read(self);
+}
+
 static inline uint64_t read_cr0(void) {
     uint64_t val;
     asm volatile ("mov %%cr0, %0" : "=r"(val));
@@ -301,10 +548,21 @@ static inline void cpuid(uint32_t code, uint32_t* a, uint32_t* b, uint32_t* c, u
     asm volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(code));
 }
 
+static inline void cpuid_count(uint32_t code, uint32_t sub, uint32_t* a, uint32_t* b,
+                               uint32_t* c, uint32_t* d) {
+    asm volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(code), "c"(sub));
+}
+
 static inline void invlpg(uint64_t addr) {
     asm volatile ("invlpg (%0)" : : "r"(addr) : "memory");
 }
 
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
 static inline void mfence(void) {
     asm volatile ("mfence" ::: "memory");
 }
@@ -340,19 +598,212 @@ static inline bool bitmap_test(uint64_t* bm, uint64_t bit) {
     return (bm[bit / 64] >> (bit % 64)) & 1;
 }
 
+// Lock statistics hooks: no code at all without LOCK_STAT
+#ifdef LOCK_STAT
+#define LOCK_STAT_NAME(lock, n) lock_stat_register(&(lock)->stat, (n))
+
+static inline void lock_stat_acquired(struct lock_stat* s, uint64_t wait_start) {
+    uint64_t now = rdtsc();
+    s->acquisitions++;
+    if (wait_start) {
+        uint64_t wait = now - wait_start;
+        s->contended++;
+        s->wait_cycles += wait;
+        if (wait > s->max_wait) s->max_wait = wait;
+    }
+    s->acquired_tsc = now;
+}
+
+static inline void lock_stat_released(struct lock_stat* s) {
+    uint64_t hold = rdtsc() - s->acquired_tsc;
+    s->hold_cycles += hold;
+    if (hold > s->max_hold) s->max_hold = hold;
+}
+#else
+#define LOCK_STAT_NAME(lock, n) ((void)0)
+#endif
+
 // Spinlock operations
 static inline void spin_init(spinlock_t* lock) {
-    lock->lock = 0;
+    lock->val = 0;
 }
 
 static inline void spin_lock(spinlock_t* lock) {
-    while (__sync_lock_test_and_set(&lock->lock, 1)) {
-        while (lock->lock) pause();
-    }
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+#ifdef LOCK_STAT
+    uint64_t wait_start = 0;
+    if (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) wait_start = rdtsc();
+#endif
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) pause();
+#ifdef LOCK_STAT
+    lock_stat_acquired(&lock->stat, wait_start);
+#endif
+}
+
+// Take a ticket only if it would be served immediately
+static inline bool spin_trylock(spinlock_t* lock) {
+    uint32_t old = lock->val;
+    if ((uint16_t)old != (uint16_t)(old >> 16)) return false;
+    if (!__atomic_compare_exchange_n(&lock->val, &old, old + 0x10000, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return false;
+#ifdef LOCK_STAT
+    lock_stat_acquired(&lock->stat, 0);
+#endif
+    return true;
 }
 
 static inline void spin_unlock(spinlock_t* lock) {
-    __sync_lock_release(&lock->lock);
+#ifdef LOCK_STAT
+    lock_stat_released(&lock->stat);
+#endif
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline bool spin_is_locked(spinlock_t* lock) {
+    uint32_t val = lock->val;
+    return (uint16_t)val != (uint16_t)(val >> 16);
+}
+
+// For locks also taken from interrupt handlers
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock) {
+    uint64_t flags = local_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
+
+// MCS lock operations: node must stay live until mcs_unlock()
+static inline void mcs_init(mcs_lock_t* lock) {
+    lock->tail = NULL;
+}
+
+static inline void mcs_lock(mcs_lock_t* lock, struct mcs_node* node) {
+    node->next = NULL;
+    node->locked = 1;
+    struct mcs_node* prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+#ifdef LOCK_STAT
+    uint64_t wait_start = prev ? rdtsc() : 0;
+#endif
+    if (prev) {
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) pause();
+    }
+#ifdef LOCK_STAT
+    lock_stat_acquired(&lock->stat, wait_start);
+#endif
+}
+
+static inline void mcs_unlock(mcs_lock_t* lock, struct mcs_node* node) {
+#ifdef LOCK_STAT
+    lock_stat_released(&lock->stat);
+#endif
+    struct mcs_node* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        // No successor visible: try to swing tail back to empty
+        struct mcs_node* expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) return;
+        // A waiter swapped itself in but has not linked yet
+        while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))) pause();
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t mcs_lock_irqsave(mcs_lock_t* lock, struct mcs_node* node) {
+    uint64_t flags = local_irq_save();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t* lock, struct mcs_node* node,
+                                         uint64_t flags) {
+    mcs_unlock(lock, node);
+    local_irq_restore(flags);
+}
+
+// Seqlock operations. Typical reader:
+//     do { seq = read_seqbegin(&sl); copy fields; } while (read_seqretry(&sl, seq));
+static inline void seqlock_init(seqlock_t* sl) {
+    sl->seq = 0;
+    spin_init(&sl->lock);
+}
+
+static inline uint32_t read_seqbegin(const seqlock_t* sl) {
+    uint32_t seq;
+    while ((seq = atomic_load32(&sl->seq, ATOMIC_ACQUIRE)) & 1) pause();
+    return seq;
+}
+
+static inline bool read_seqretry(const seqlock_t* sl, uint32_t seq) {
+    smp_rmb();
+    return atomic_load32(&sl->seq, ATOMIC_RELAXED) != seq;
+}
+
+static inline void write_seqlock(seqlock_t* sl) {
+    spin_lock(&sl->lock);
+    atomic_store32(&sl->seq, sl->seq + 1, ATOMIC_RELAXED);
+    smp_wmb();
+}
+
+static inline void write_sequnlock(seqlock_t* sl) {
+    atomic_store32(&sl->seq, sl->seq + 1, ATOMIC_RELEASE);
+    spin_unlock(&sl->lock);
+}
+
+// A reader interrupted by a writer on its own CPU would spin forever
+static inline uint64_t write_seqlock_irqsave(seqlock_t* sl) {
+    uint64_t flags = local_irq_save();
+    write_seqlock(sl);
+    return flags;
+}
+
+static inline void write_sequnlock_irqrestore(seqlock_t* sl, uint64_t flags) {
+    write_sequnlock(sl);
+    local_irq_restore(flags);
+}
+
+// Per-CPU counter operations. Adds run with IF=0 so an interrupt handler
+// counting on the same CPU cannot lose an update.
+static inline void percpu_counter_init(struct percpu_counter* c, int64_t batch) {
+    c->count = 0;
+    c->batch = batch;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) c->cpu[i].delta = 0;
+}
+
+static inline void percpu_counter_add(struct percpu_counter* c, int64_t v) {
+    uint64_t flags = local_irq_save();
+    struct percpu_counter_slot* slot = &c->cpu[this_cpu_read(id)];
+    int64_t delta = slot->delta + v;
+    if (delta >= c->batch || delta <= -c->batch) {
+        atomic_fetch_add64(&c->count, (uint64_t)delta, ATOMIC_RELAXED);
+        delta = 0;
+    }
+    slot->delta = delta;
+    local_irq_restore(flags);
+}
+
+static inline void percpu_counter_inc(struct percpu_counter* c) {
+    percpu_counter_add(c, 1);
+}
+
+static inline void percpu_counter_dec(struct percpu_counter* c) {
+    percpu_counter_add(c, -1);
+}
+
+// Approximate: one shared load, may lag by the unfolded per-CPU deltas
+static inline int64_t percpu_counter_read(const struct percpu_counter* c) {
+    return (int64_t)atomic_load64(&c->count, ATOMIC_RELAXED);
+}
+
+// Exact while no add is in flight: walks every CPU's slot
+static inline int64_t percpu_counter_sum(const struct percpu_counter* c) {
+    int64_t sum = percpu_counter_read(c);
+    for (uint32_t i = 0; i < MAX_CPUS; i++) sum += c->cpu[i].delta;
+    return sum;
 }
 
 // Console
@@ -361,6 +812,32 @@ void kvprintf(const char* fmt, va_list args);
 void kernel_panic(const char* msg) __attribute__((noreturn));
 void console_early_init(void);
 void console_set_framebuffer(void* fb, uint32_t w, uint32_t h, uint32_t pitch, uint32_t bpp);
+void console_input_init(void);
+
+// Console backends: write() gets each formatted chunk of kprintf() output,
+// from any context, and must not wait for the device. flush() and
+// panic_write() are for the panic path only: they take no locks (the
+// holder may be the panicking CPU or a dead one) and may spin on the
+// device. A backend without panic_write() gets write() then too.
+struct console_backend {
+    const char* name;
+    void (*write)(const char* s, size_t n);
+    void (*flush)(void);
+    void (*panic_write)(const char* s, size_t n);
+    struct console_backend* next;
+};
+
+void console_register(struct console_backend* con);
+void console_flush(void);
+
+// Serial (COM1)
+void serial_init(void);
+void serial_irq_init(void);
+void serial_dump_stats(void);
+
+// Boot milestones
+void boot_mark(const char* stage);
+void boot_report(void);
 
 // Memory
 void pmm_init(uint64_t mb_info);
@@ -379,16 +856,37 @@ void vmm_unmap_page(uint64_t* pml4, uint64_t virt);
 uint64_t vmm_create_address_space(void);
 void vmm_switch_pml4(uint64_t pml4_phys);
 void* vmm_get_phys(uint64_t* pml4, uint64_t virt);
+uint64_t* vmm_get_kernel_pml4(void);
+
+// Kernel stacks
+void kstack_init(void);
+void kstack_init_cpu(void);
+uint64_t kstack_alloc(void);
+void kstack_free(uint64_t top);
+bool kstack_is_guard(uint64_t addr);
 
 // GDT/TSS
 void gdt64_init(void);
 void init_tss(void);
 void tss_set_rsp0(uint64_t rsp);
+void tss_set_ist(uint8_t ist, uint64_t rsp);
 
 // IDT
 void idt_init(void);
 void idt_set_gate(uint8_t vector, void* handler, uint8_t type);
-void irq_register_handler(uint8_t irq, void (*handler)(void), void* context);
+void idt_set_ist(uint8_t vector, uint8_t ist);
+void idt_load(void);
+// Returns true if its device raised the interrupt (shared vectors run every handler)
+typedef bool (*irq_handler_t)(void* context);
+void irq_register_handler(uint8_t irq, irq_handler_t handler, void* context);
+int irq_alloc_vector(uint32_t cpu);
+int irq_alloc_vector_spread(uint32_t* cpu);
+void irq_free_vector(uint32_t cpu, uint8_t vector);
+int irq_request(uint32_t cpu, uint8_t vector, irq_handler_t handler, void* context);
+void irq_release(uint32_t cpu, uint8_t vector, irq_handler_t handler, void* context);
+void irq_account_bh(uint8_t vector, uint64_t cycles);
+void irq_count_ipi(uint32_t type);
+void irq_dump_stats(void);
 void interrupt_handler(uint64_t* frame, uint64_t num, uint64_t err);
 
 // ACPI
@@ -397,6 +895,13 @@ void acpi_shutdown(void);
 void acpi_reboot(void);
 uint32_t acpi_get_cpu_count(void);
 uint8_t acpi_get_cpu_apic_id(uint32_t idx);
+uint8_t acpi_get_cpu_acpi_id(uint32_t idx);
+uint64_t acpi_get_lapic_addr(void);
+bool acpi_get_irq_override(uint8_t irq, uint32_t* gsi, uint16_t* flags);
+uint16_t acpi_get_sci_irq(void);
+uint64_t acpi_get_hpet_base(void);
+uint16_t acpi_get_hpet_min_tick(void);
+uint64_t acpi_get_pcie_ecam(uint16_t segment, uint8_t bus);
 uint32_t acpi_get_ioapic_count(void);
 uint32_t acpi_get_ioapic_addr(uint32_t idx);
 uint32_t acpi_get_ioapic_gsi_base(uint32_t idx);
@@ -407,24 +912,47 @@ uint8_t acpi_get_version_minor(void);
 // LAPIC
 void lapic_init(void);
 void lapic_init_ap(void);
+bool lapic_is_x2apic(void);
 uint32_t lapic_get_id(void);
 void lapic_eoi(void);
 void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+void lapic_send_self_ipi(uint8_t vector);
+void lapic_broadcast_init(void);
+void lapic_broadcast_sipi(uint8_t page);
 void lapic_timer_calibrate(void);
 uint64_t lapic_get_timer_ticks(void);
 uint64_t lapic_get_timer_freq(void);
 void lapic_timer_set_handler(void (*handler)(void));
 void lapic_timer_start_periodic(uint64_t ms);
+void lapic_timer_interrupt(void);
+
+// Clock (TSC clocksource)
+void clock_init(void);
+uint64_t clock_tsc_khz(void);
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+uint64_t clock_ns_to_cycles(uint64_t ns);
+uint64_t ktime_ns(void);
+void ndelay(uint64_t ns);
+void udelay(uint64_t us);
+void mdelay(uint64_t ms);
+void clock_sync_ap(struct cpu* c);
+void clock_sync_service(void);
 
 // IOAPIC
 void ioapic_init(void);
 void ioapic_set_irq(uint8_t irq, uint8_t vector, uint32_t dest);
+int ioapic_set_irq_affinity(uint8_t irq, uint64_t cpu_mask);
+uint64_t ioapic_get_irq_affinity(uint8_t irq);
+uint32_t ioapic_irq_to_gsi(uint8_t irq);
 void ioapic_mask_irq(uint8_t irq);
 void ioapic_unmask_irq(uint8_t irq);
 
 // SMP
+void cpu_init_boot(void);
 void cpu_init_early(void);
-struct cpu* cpu_get_current(void);
+void cpu_init_percpu(struct cpu* c);
+void cpu_init_gdt(struct cpu* c);
+struct cpu* cpu_get(uint32_t idx);
 void smp_init(void);
 uint32_t smp_get_cpu_count(void);
 void ap_main(void);
@@ -432,12 +960,154 @@ void scheduler_ap_entry(void);
 
 // Scheduler
 void scheduler_init(void);
+void sched_boot_done(void);
 void schedule(void);
+void schedule_tail(void);
+void scheduler_tick(void);
+void sched_ipi(void);
+void sched_preempt(void);
+void sched_wake(struct thread* t);
+int sched_set_affinity(struct thread* t, uint64_t mask);
+int sched_setscheduler(struct thread* t, uint8_t policy, uint32_t prio);
+void sched_dump_rt_latency(void);
+void sched_dump_stats(void);
+void sched_trace_dump(uint32_t cpu);
+uint64_t sched_get_ticks(void);
 void yield(void);
 void sleep(uint64_t ms);
 struct process* process_create(const char* name, void* entry);
+struct thread* kthread_create(void (*fn)(void*), void* arg);
+void kthread_exit(void) __attribute__((noreturn));
 void context_switch(uint64_t* old_rsp, uint64_t new_rsp, uint64_t new_cr3);
 
+// Softirqs / tasklets: bottom halves run at interrupt exit with IF=1,
+// overflow goes to a per-CPU ksoftirqd thread
+#define SOFTIRQ_HI              0   // High-priority tasklets
+#define SOFTIRQ_NET_TX          1
+#define SOFTIRQ_NET_RX          2
+#define SOFTIRQ_BLOCK           3
+#define SOFTIRQ_TASKLET         4
+#define SOFTIRQ_RCU             5   // Callbacks whose grace period ended
+#define NR_SOFTIRQS             6
+
+#define TASKLET_SCHED           0x1 // Queued, will run
+#define TASKLET_RUN             0x2 // Running on some CPU
+
+struct tasklet {
+    struct tasklet* next;
+    void (*func)(void* data);
+    void* data;
+    volatile uint32_t state;
+};
+
+void softirq_init(void);
+void open_softirq(uint32_t nr, void (*action)(void));
+void raise_softirq(uint32_t nr);
+void irq_exit(void);
+void tasklet_init(struct tasklet* t, void (*func)(void*), void* data);
+void tasklet_schedule(struct tasklet* t);
+void tasklet_hi_schedule(struct tasklet* t);
+void tasklet_kill(struct tasklet* t);
+void softirq_dump_stats(void);
+
+// RCU (rcu.c). Readers only disable preemption: a CPU that context
+// switches, or takes a tick outside a read section, has passed a
+// quiescent state. Interrupt handlers and softirqs are implicit readers.
+// Readers must not sleep.
+#define container_of(ptr, type, member) \
+    ((type*)((char*)(ptr) - offsetof(type, member)))
+
+struct rcu_head {
+    struct rcu_head* next;
+    void (*func)(struct rcu_head* head);
+    uint64_t gp_seq;            // Grace period that must complete first
+};
+
+static inline void rcu_read_lock(void) {
+    this_cpu_inc(preempt_count);
+}
+
+static inline void rcu_read_unlock(void) {
+    this_cpu_dec(preempt_count);
+}
+
+// Load a pointer published with rcu_assign_pointer(); on x86 an acquire
+// load is a plain mov
+#define rcu_dereference(p)          atomic_load_ptr(&(p), ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v)    atomic_store_ptr(&(p), (v), ATOMIC_RELEASE)
+
+void rcu_init(void);
+void rcu_tick(void);
+void rcu_note_context_switch(void);
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head));
+void synchronize_rcu(void);
+void rcu_dump_stats(void);
+
+// Ring buffers (ring.c): bounded lock-free pointer queues with one
+// consumer and one (RING_SP) or many producers. Size is a power of two;
+// the producer and consumer indices live on separate cache lines.
+#define RING_SP             0x01    // Single producer: no reservation CAS
+#define RING_BLOCKING       0x02    // Allow ring_*_wait(): one fence per batch
+
+struct ring {
+    void** slots;
+    uint32_t mask;
+    uint32_t flags;
+    volatile uint32_t prod_head __attribute__((aligned(64)));  // Reserved
+    volatile uint32_t prod_tail;                                // Published
+    volatile uint32_t cons_tail __attribute__((aligned(64)));  // Consumed
+    volatile uint32_t cons_waiting __attribute__((aligned(64)));
+    volatile uint32_t prod_waiting;
+};
+
+bool ring_init(struct ring* r, void** slots, uint32_t size, uint32_t flags);
+uint32_t ring_count(const struct ring* r);
+uint32_t ring_enqueue_burst(struct ring* r, void* const* objs, uint32_t n);
+uint32_t ring_dequeue_burst(struct ring* r, void** objs, uint32_t n);
+void ring_enqueue_wait(struct ring* r, void* const* objs, uint32_t n);
+uint32_t ring_dequeue_wait(struct ring* r, void** objs, uint32_t n);
+void ring_bench(void);
+
+static inline bool ring_enqueue(struct ring* r, void* obj) {
+    return ring_enqueue_burst(r, &obj, 1) == 1;
+}
+
+static inline bool ring_dequeue(struct ring* r, void** obj) {
+    return ring_dequeue_burst(r, obj, 1) == 1;
+}
+
+// Kernel SIMD sections (fpu.c): check kernel_fpu_usable() first, never
+// sleep inside
+void fpu_init(void);
+bool fpu_has_avx2(void);
+bool kernel_fpu_usable(void);
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+// Lock statistics (lockstat.c)
+void lock_stat_register(struct lock_stat* stat, const char* name);
+void lock_stat_dump(void);
+
+// Futex / sleeping locks
+void futex_init(void);
+void futex_tick(void);
+int wait_on_address(volatile uint32_t* addr, uint32_t expected, uint64_t timeout_ms);
+uint32_t wake_address(volatile uint32_t* addr, uint32_t n);
+void mutex_init(struct mutex* m);
+void mutex_lock(struct mutex* m);
+bool mutex_trylock(struct mutex* m);
+void mutex_unlock(struct mutex* m);
+void sem_init(struct semaphore* s, uint32_t count);
+void sem_down(struct semaphore* s);
+int sem_down_timeout(struct semaphore* s, uint64_t timeout_ms);
+bool sem_trydown(struct semaphore* s);
+void sem_up(struct semaphore* s);
+void cond_init(struct condvar* cv);
+void cond_wait(struct condvar* cv, struct mutex* m);
+int cond_wait_timeout(struct condvar* cv, struct mutex* m, uint64_t timeout_ms);
+void cond_signal(struct condvar* cv);
+void cond_broadcast(struct condvar* cv);
+
 // PCI
 void pci_init(void);
 struct pci_device* pci_find_class(uint32_t class_code);
@@ -447,9 +1117,16 @@ size_t pci_get_device_count(void);
 uint32_t pci_read_dword(struct pci_device* dev, uint8_t offset);
 uint16_t pci_read_word(struct pci_device* dev, uint8_t offset);
 void pci_write_word(struct pci_device* dev, uint8_t offset, uint16_t val);
+void pci_write_dword(struct pci_device* dev, uint8_t offset, uint32_t val);
 uint64_t pci_read_bar(struct pci_device* dev, uint8_t bar);
 void pci_enable_bus_mastering(struct pci_device* dev);
-bool pci_enable_msi(struct pci_device* dev, uint8_t vector);
+bool pci_enable_msi(struct pci_device* dev, uint32_t cpu, uint8_t vector);
+int pci_alloc_irq_vectors(struct pci_device* dev, int count, irq_handler_t handler,
+                          void* const* contexts, struct pci_irq_vector* out);
+void pci_free_irq_vectors(struct pci_device* dev, int count, irq_handler_t handler,
+                          void* const* contexts, const struct pci_irq_vector* out);
+void pci_msix_mask(struct pci_device* dev, uint16_t entry);
+void pci_msix_unmask(struct pci_device* dev, uint16_t entry);
 
 // Storage
 bool ahci_init(void);
@@ -474,6 +1151,7 @@ void hda_send_verb(uint8_t codec, uint8_t nid, uint32_t verb, uint8_t payload);
 bool e1000e_init(void);
 bool r8168_init(void);
 void network_poll(void);
+void network_tick(void);
 void r8168_poll(void);
 
 // Laptop
@@ -497,6 +1175,8 @@ void amdgpu_clear(uint32_t color);
 
 // PIT
 void pit_wait(uint32_t ms);
+void pit_delay(uint32_t us);
+uint64_t pit_measure_tsc(uint32_t ms);
 
 // Ext2 filesystem
 bool ext2_mount(bool (*read_fn)(uint64_t, uint32_t, void*), bool (*write_fn)(uint64_t, uint32_t, const void*), uint64_t start_lba);
@@ -557,12 +1237,24 @@ char* strchr(const char* s, int c);
 char* strstr(const char* haystack, const char* needle);
 size_t strspn(const char* s, const char* accept);
 size_t strcspn(const char* s, const char* reject);
+void mem_init(void);
+// Streaming stores that bypass the cache, for buffers nobody reads soon
+void* memcpy_nt(void* d, const void* s, size_t n);
+void* memset_nt(void* s, int c, size_t n);
+void mem_bench(void);
+
+// Constant sizes expand inline (register moves); everything else calls
+// the CPUID-dispatched routines in string.c
+#define memcpy(d, s, n)     __builtin_memcpy((d), (s), (n))
+#define memset(s, c, n)     __builtin_memset((s), (c), (n))
+#define memmove(d, s, n)    __builtin_memmove((d), (s), (n))
 
 // kmalloc
 void kmalloc_init(void);
 void* kmalloc(size_t size);
 void* kzalloc(size_t size);
 void kfree(void* ptr);
+void kmalloc_dump_stats(void);
 
 // Realtek ALC audio
 bool realtek_alc_init(uint8_t codec_addr, uint16_t vendor_id, uint16_t device_id);
@@ -707,6 +1399,11 @@ uint16_t udp_checksum(struct ipv4_header* ip, struct udp_header* udp, void* payl
 #define EFER_LMA       (1ULL << 10)
 #define EFER_SCE       (1ULL << 0)
 
+// Segment base MSRs (per-CPU area via swapgs)
+#define MSR_FS_BASE         0xC0000100
+#define MSR_GS_BASE         0xC0000101
+#define MSR_KERNEL_GS_BASE  0xC0000102
+
 // ============================================================================
 // Additional Critical Structures
 // ============================================================================
@@ -724,6 +1421,19 @@ struct rsdp_descriptor {
     char     reserved[3];
 } __attribute__((packed));
 
+// ACPI System Description Table header (RSDT, XSDT, MADT, ...)
+struct acpi_sdt_header {
+    char     signature[4];
+    uint32_t length;
+    uint8_t  revision;
+    uint8_t  checksum;
+    char     oem_id[6];
+    char     oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
 // ACPI MADT Structure
 struct madt_header {
     char     signature[4];
@@ -758,6 +1468,109 @@ struct madt_ioapic {
     uint32_t gsi_base;
 } __attribute__((packed));
 
+// MADT Interrupt Source Override (ISA IRQ -> GSI)
+struct madt_iso {
+    uint8_t  type;
+    uint8_t  length;
+    uint8_t  bus;
+    uint8_t  source;
+    uint32_t gsi;
+    uint16_t flags;             // Polarity bits 1:0, trigger mode bits 3:2
+} __attribute__((packed));
+
+// MADT Local APIC Address Override
+struct madt_lapic_override {
+    uint8_t  type;
+    uint8_t  length;
+    uint16_t reserved;
+    uint64_t addr;
+} __attribute__((packed));
+
+// MADT Processor Local x2APIC
+struct madt_x2apic {
+    uint8_t  type;
+    uint8_t  length;
+    uint16_t reserved;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t acpi_uid;
+} __attribute__((packed));
+
+// ACPI Generic Address Structure
+struct acpi_gas {
+    uint8_t  space_id;          // 0 = memory, 1 = I/O port
+    uint8_t  bit_width;
+    uint8_t  bit_offset;
+    uint8_t  access_size;
+    uint64_t address;
+} __attribute__((packed));
+
+// FADT, up to the fields we use
+struct acpi_fadt {
+    struct acpi_sdt_header header;
+    uint32_t firmware_ctrl;
+    uint32_t dsdt;
+    uint8_t  reserved0;
+    uint8_t  preferred_pm_profile;
+    uint16_t sci_int;
+    uint32_t smi_cmd;
+    uint8_t  acpi_enable;
+    uint8_t  acpi_disable;
+    uint8_t  s4bios_req;
+    uint8_t  pstate_cnt;
+    uint32_t pm1a_evt_blk;
+    uint32_t pm1b_evt_blk;
+    uint32_t pm1a_cnt_blk;
+    uint32_t pm1b_cnt_blk;
+    uint32_t pm2_cnt_blk;
+    uint32_t pm_tmr_blk;
+    uint32_t gpe0_blk;
+    uint32_t gpe1_blk;
+    uint8_t  pm1_evt_len;
+    uint8_t  pm1_cnt_len;
+    uint8_t  pm2_cnt_len;
+    uint8_t  pm_tmr_len;
+    uint8_t  gpe0_blk_len;
+    uint8_t  gpe1_blk_len;
+    uint8_t  gpe1_base;
+    uint8_t  cst_cnt;
+    uint16_t p_lvl2_lat;
+    uint16_t p_lvl3_lat;
+    uint16_t flush_size;
+    uint16_t flush_stride;
+    uint8_t  duty_offset;
+    uint8_t  duty_width;
+    uint8_t  day_alrm;
+    uint8_t  mon_alrm;
+    uint8_t  century;
+    uint16_t iapc_boot_arch;
+    uint8_t  reserved1;
+    uint32_t flags;
+    struct acpi_gas reset_reg;
+    uint8_t  reset_value;
+    uint16_t arm_boot_arch;
+    uint8_t  minor_version;
+} __attribute__((packed));
+
+// HPET description table
+struct acpi_hpet {
+    struct acpi_sdt_header header;
+    uint32_t event_timer_block_id;
+    struct acpi_gas base;
+    uint8_t  hpet_number;
+    uint16_t min_tick;
+    uint8_t  page_protection;
+} __attribute__((packed));
+
+// MCFG allocation: one PCIe ECAM window
+struct acpi_mcfg_alloc {
+    uint64_t base;
+    uint16_t segment;
+    uint8_t  start_bus;
+    uint8_t  end_bus;
+    uint32_t reserved;
+} __attribute__((packed));
+
 // MSI Address Format
 #define MSI_ADDRESS_BASE       0xFEE00000
 #define MSI_ADDRESS(cfg)       (MSI_ADDRESS_BASE | ((cfg) << 12))
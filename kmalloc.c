@@ -14,8 +14,9 @@ struct slab_header {
 struct slab_cache {
     uint32_t size;
     struct slab_header* free_list;
-    uint64_t allocations;
-    uint64_t frees;
+    // Kept per CPU and bumped outside kmalloc_lock
+    struct percpu_counter allocations;
+    struct percpu_counter frees;
 };
 
 static struct slab_cache slabs[KMALLOC_NUM_SIZES];
@@ -28,11 +29,12 @@ void kmalloc_init(void) {
     for (int i = 0; i < KMALLOC_NUM_SIZES; i++) {
         slabs[i].size = sizes[i];
         slabs[i].free_list = NULL;
-        slabs[i].allocations = 0;
-        slabs[i].frees = 0;
+        percpu_counter_init(&slabs[i].allocations, PERCPU_COUNTER_BATCH);
+        percpu_counter_init(&slabs[i].frees, PERCPU_COUNTER_BATCH);
     }
     
     spin_init(&kmalloc_lock);
+    LOCK_STAT_NAME(&kmalloc_lock, "kmalloc");
     kmalloc_initialized = true;
     kprintf("kmalloc: Initialized\n");
 }
@@ -48,28 +50,35 @@ void* kmalloc(size_t size) {
     if (!kmalloc_initialized) kmalloc_init();
     if (size == 0) return NULL;
     
-    if (size > KMALLOC_MAX_SIZE) {
-        // Large allocation: use direct page allocation
-        size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-        void* addr = pmm_alloc_pages(pages);
-        if (addr) {
-            memset(addr, 0, pages * PAGE_SIZE);
-        }
-        return addr;
+    // The header lives inside the object, so a class holds size - 16 bytes
+    size_t need = size + sizeof(struct slab_header);
+    if (need > KMALLOC_MAX_SIZE) {
+        // Large allocation: whole pages behind a leading page whose last
+        // 16 bytes are the header, so the caller still gets a page-aligned
+        // pointer and kfree() finds the span
+        size_t pages = 1 + (size + PAGE_SIZE - 1) / PAGE_SIZE;
+        uint8_t* addr = pmm_alloc_pages(pages);
+        if (!addr) return NULL;
+        memset(addr + PAGE_SIZE, 0, (pages - 1) * PAGE_SIZE);
+        struct slab_header* obj = (struct slab_header*)(addr + PAGE_SIZE) - 1;
+        obj->next = NULL;
+        obj->magic = 0xDEADBEEF;
+        obj->size = pages * PAGE_SIZE;
+        return addr + PAGE_SIZE;
     }
     
-    int idx = size_to_index(size);
+    int idx = size_to_index(need);
     if (idx < 0) return NULL;
     
-    spin_lock(&kmalloc_lock);
+    uint64_t flags = spin_lock_irqsave(&kmalloc_lock);
     
     struct slab_cache* slab = &slabs[idx];
     
     if (slab->free_list) {
         struct slab_header* obj = slab->free_list;
         slab->free_list = obj->next;
-        slab->allocations++;
-        spin_unlock(&kmalloc_lock);
+        spin_unlock_irqrestore(&kmalloc_lock, flags);
+        percpu_counter_inc(&slab->allocations);
         
         obj->magic = 0xDEADBEEF;
         obj->size = slab->size;
@@ -80,7 +89,7 @@ void* kmalloc(size_t size) {
     // Allocate new page and split into objects
     void* page = pmm_alloc_page();
     if (!page) {
-        spin_unlock(&kmalloc_lock);
+        spin_unlock_irqrestore(&kmalloc_lock, flags);
         return NULL;
     }
     
@@ -106,9 +115,9 @@ void* kmalloc(size_t size) {
     // Return first object
     struct slab_header* obj = slab->free_list;
     slab->free_list = obj->next;
-    slab->allocations++;
     
-    spin_unlock(&kmalloc_lock);
+    spin_unlock_irqrestore(&kmalloc_lock, flags);
+    percpu_counter_inc(&slab->allocations);
     
     obj->magic = 0xDEADBEEF;
     obj->size = slab->size;
@@ -130,19 +139,16 @@ void kfree(void* ptr) {
     struct slab_header* obj = (struct slab_header*)ptr - 1;
     
     if (obj->magic != 0xDEADBEEF) {
-        // Might be a large allocation
-        // Try to free as pages
-        uint64_t pfn = (uint64_t)ptr / PAGE_SIZE;
-        // Just return for now (large allocations need tracking)
+        // Not from kmalloc()
         return;
     }
     
     uint32_t size = obj->size;
     
     if (size > KMALLOC_MAX_SIZE) {
-        // Large allocation: free pages
-        size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-        pmm_free_pages(ptr, pages);
+        // Large allocation: size spans the leading header page too
+        obj->magic = 0;
+        pmm_free_pages((uint8_t*)ptr - PAGE_SIZE, size / PAGE_SIZE);
         return;
     }
     
@@ -151,12 +157,24 @@ void kfree(void* ptr) {
         return;
     }
     
-    spin_lock(&kmalloc_lock);
+    uint64_t flags = spin_lock_irqsave(&kmalloc_lock);
     
     struct slab_cache* slab = &slabs[idx];
     obj->next = slab->free_list;
     slab->free_list = obj;
-    slab->frees++;
     
-    spin_unlock(&kmalloc_lock);
+    spin_unlock_irqrestore(&kmalloc_lock, flags);
+    percpu_counter_inc(&slab->frees);
+}
+
+// Exact per-size totals (walks every CPU's counters)
+void kmalloc_dump_stats(void) {
+    kprintf("kmalloc: size / allocations / frees / in use\n");
+    for (int i = 0; i < KMALLOC_NUM_SIZES; i++) {
+        int64_t allocs = percpu_counter_sum(&slabs[i].allocations);
+        int64_t frees = percpu_counter_sum(&slabs[i].frees);
+        if (!allocs) continue;
+        kprintf("  %u: %lu / %lu / %lu\n", slabs[i].size,
+            (uint64_t)allocs, (uint64_t)frees, (uint64_t)(allocs - frees));
+    }
 }
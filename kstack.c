@@ -0,0 +1,130 @@
+// kstack.c — Kernel stack pool with guard pages
+#include "kernel.h"
+
+// Slot N occupies [BASE + N * SLOT_SIZE, BASE + (N + 1) * SLOT_SIZE):
+// the lowest page is never mapped, so running off the bottom of a stack
+// faults instead of silently corrupting the neighbouring stack.
+
+static uint64_t slot_used[KSTACK_MAX_SLOTS / 64];   // Slot has backing pages
+static uint64_t free_pool[KSTACK_MAX_SLOTS];        // Mapped, not cached by any CPU
+static uint32_t free_pool_count = 0;
+static spinlock_t kstack_lock;
+
+static uint64_t slot_top(uint32_t slot) {
+    return KSTACK_REGION_BASE + (uint64_t)(slot + 1) * KSTACK_SLOT_SIZE;
+}
+
+// Back a fresh slot with individual 4K pages (no contiguous PMM search).
+// Called with kstack_lock held.
+static uint64_t kstack_map_slot(void) {
+    uint64_t* pml4 = vmm_get_kernel_pml4();
+
+    for (uint32_t slot = 0; slot < KSTACK_MAX_SLOTS; slot++) {
+        if (bitmap_test(slot_used, slot)) continue;
+
+        uint64_t top = slot_top(slot);
+        uint64_t bottom = top - KERNEL_STACK_SIZE;   // Guard page sits below
+
+        for (uint64_t va = bottom; va < top; va += PAGE_SIZE) {
+            void* page = pmm_alloc_page();
+            if (!page || !vmm_map_page(pml4, va, VIRT_TO_PHYS(page),
+                                       PT_PRESENT | PT_WRITABLE | PT_GLOBAL | PT_NX)) {
+                for (uint64_t v = bottom; v < va; v += PAGE_SIZE) {
+                    pmm_free_page(PHYS_TO_VIRT(vmm_get_phys(pml4, v)));
+                    vmm_unmap_page(pml4, v);
+                }
+                if (page) pmm_free_page(page);
+                return 0;
+            }
+        }
+
+        bitmap_set(slot_used, slot);
+        return top;
+    }
+    return 0;
+}
+
+// Top up the current CPU's cache to half capacity from the shared pool,
+// mapping new slots only when the pool is empty.
+static void kstack_refill(struct cpu* c) {
+    spin_lock(&kstack_lock);
+    while (c->kstack_count < KSTACK_CACHE_SIZE / 2) {
+        uint64_t top;
+        if (free_pool_count) {
+            top = free_pool[--free_pool_count];
+        } else {
+            top = kstack_map_slot();
+            if (!top) break;
+        }
+        c->kstack_cache[c->kstack_count++] = top;
+    }
+    spin_unlock(&kstack_lock);
+}
+
+void kstack_init(void) {
+    spin_init(&kstack_lock);
+    memset(slot_used, 0, sizeof(slot_used));
+    free_pool_count = 0;
+
+    kstack_init_cpu();
+    idt_set_ist(8, KSTACK_IST_DOUBLE_FAULT);
+
+    kprintf("kstack: %u KB stacks + guard page at %p, %u slots\n",
+        KERNEL_STACK_SIZE / 1024, (void*)KSTACK_REGION_BASE, KSTACK_MAX_SLOTS);
+}
+
+// Pre-map the calling CPU's cache so thread spawn never touches the PMM,
+// and give its TSS a double fault stack so a guard page hit can be reported
+void kstack_init_cpu(void) {
+    uint64_t flags = local_irq_save();
+    struct cpu* c = cpu_get_current();
+    kstack_refill(c);
+    local_irq_restore(flags);
+    
+    if (!c->tss.ist[KSTACK_IST_DOUBLE_FAULT - 1]) {
+        uint64_t df_stack = kstack_alloc();
+        if (!df_stack) kernel_panic("kstack: Failed to map double fault stack");
+        c->tss.ist[KSTACK_IST_DOUBLE_FAULT - 1] = df_stack;
+    }
+}
+
+uint64_t kstack_alloc(void) {
+    uint64_t flags = local_irq_save();
+    struct cpu* c = cpu_get_current();
+
+    if (c->kstack_count == 0) {
+        kstack_refill(c);
+    }
+
+    uint64_t top = 0;
+    if (c->kstack_count) {
+        top = c->kstack_cache[--c->kstack_count];
+    }
+
+    local_irq_restore(flags);
+    return top;
+}
+
+void kstack_free(uint64_t top) {
+    if (!top) return;
+
+    uint64_t flags = local_irq_save();
+    struct cpu* c = cpu_get_current();
+
+    if (c->kstack_count < KSTACK_CACHE_SIZE) {
+        c->kstack_cache[c->kstack_count++] = top;
+    } else {
+        spin_lock(&kstack_lock);
+        free_pool[free_pool_count++] = top;
+        spin_unlock(&kstack_lock);
+    }
+
+    local_irq_restore(flags);
+}
+
+bool kstack_is_guard(uint64_t addr) {
+    if (addr < KSTACK_REGION_BASE) return false;
+    uint64_t off = addr - KSTACK_REGION_BASE;
+    if (off >= (uint64_t)KSTACK_MAX_SLOTS * KSTACK_SLOT_SIZE) return false;
+    return (off % KSTACK_SLOT_SIZE) < PAGE_SIZE;
+}
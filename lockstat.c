@@ -0,0 +1,40 @@
+// lockstat.c — Lock contention statistics (make LOCK_STAT=1)
+#include "kernel.h"
+
+// Locks named with LOCK_STAT_NAME() are linked here for lock_stat_dump().
+// Counters live in the lock itself and are only written by the holder.
+
+#ifdef LOCK_STAT
+static struct lock_stat* registered = NULL;
+static spinlock_t registry_lock;
+
+void lock_stat_register(struct lock_stat* stat, const char* name) {
+    uint64_t flags = spin_lock_irqsave(&registry_lock);
+    if (!stat->name) {
+        stat->next = registered;
+        registered = stat;
+    }
+    stat->name = name;
+    spin_unlock_irqrestore(&registry_lock, flags);
+}
+
+void lock_stat_dump(void) {
+    kprintf("Locks: acquisitions, contended, wait avg/max (ns), hold avg/max (ns)\n");
+    for (struct lock_stat* s = registered; s; s = s->next) {
+        uint64_t acq = s->acquisitions ? s->acquisitions : 1;
+        uint64_t cont = s->contended ? s->contended : 1;
+        kprintf("  %s: %lu, %lu, %lu/%lu, %lu/%lu\n", s->name,
+            s->acquisitions, s->contended,
+            clock_cycles_to_ns(s->wait_cycles / cont), clock_cycles_to_ns(s->max_wait),
+            clock_cycles_to_ns(s->hold_cycles / acq), clock_cycles_to_ns(s->max_hold));
+    }
+}
+#else
+void lock_stat_register(struct lock_stat* stat, const char* name) {
+    stat->name = name;
+}
+
+void lock_stat_dump(void) {
+    kprintf("Locks: statistics disabled (build with LOCK_STAT=1)\n");
+}
+#endif
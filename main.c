@@ -3,7 +3,6 @@
 
 // Forward declarations for external functions
 extern void gdt64_init(void);
-extern void init_tss(void);
 extern void idt_init(void);
 extern void lapic_init(void);
 extern void lapic_timer_calibrate(void);
@@ -29,7 +28,9 @@ static uint8_t* find_rsdp(uint64_t mb_info_phys) {
 }
 
 void kernel_main(uint64_t mb_info_phys) {
+    boot_mark("firmware");
     console_early_init();
+    serial_init();
     
     kprintf("\n");
     kprintf("========================================================\n");
@@ -38,13 +39,18 @@ void kernel_main(uint64_t mb_info_phys) {
     kprintf("========================================================\n\n");
     
     // Core initialization
+    cpu_init_boot();
     pmm_init(mb_info_phys);
     vmm_init();
     kmalloc_init();
     gdt64_init();
-    init_tss();
     idt_init();
+    cpu_init_early();
+    fpu_init();
+    mem_init();
+    kstack_init();
     kprintf("[OK] Core initialized\n");
+    boot_mark("core");
     
     // ACPI
     uint8_t* rsdp = find_rsdp(mb_info_phys);
@@ -56,19 +62,34 @@ void kernel_main(uint64_t mb_info_phys) {
         kprintf("[WARN] ACPI not found, using defaults\n");
     }
     
+    boot_mark("acpi");
+    
+    // Clock: HPET base comes from ACPI
+    clock_init();
+    boot_mark("clock");
+    
     // APIC
     lapic_init();
     lapic_timer_calibrate();
     ioapic_init();
     sti();
+    boot_mark("apic");
     
-    // SMP
-    cpu_init_early();
-    smp_init();
+    futex_init();
+    rcu_init();
     scheduler_init();
+    boot_mark("sched");
+    
+    // SMP: APs enter the scheduler as soon as they are up
+    smp_init();
+    softirq_init();
+    console_input_init();
+    serial_irq_init();
+    boot_mark("smp");
     
     // PCI scan
     pci_init();
+    boot_mark("pci");
     
     // Storage: NVMe (твой 500GB SSD)
     kprintf("\n[STORAGE] NVMe boot drive...\n");
@@ -94,8 +115,11 @@ void kernel_main(uint64_t mb_info_phys) {
         }
     }
     
+    boot_mark("storage");
+    
     // Network: Realtek r8168 (preferred) or Intel e1000e
     kprintf("\n[NETWORK] Ethernet controllers...\n");
+    network_init();
     if (r8168_init()) {
         kprintf("[OK] r8168: Gigabit link ready\n");
     } else if (e1000e_init()) {
@@ -103,6 +127,7 @@ void kernel_main(uint64_t mb_info_phys) {
     } else {
         kprintf("[WARN] No Ethernet controller found\n");
     }
+    boot_mark("network");
     
     // Audio: HDA with Realtek ALC
     kprintf("\n[AUDIO] HD Audio...\n");
@@ -111,12 +136,14 @@ void kernel_main(uint64_t mb_info_phys) {
     } else {
         kprintf("[WARN] HDA not initialized\n");
     }
+    boot_mark("audio");
     
     // USB: XHCI
     kprintf("\n[USB] XHCI controller...\n");
     if (xhci_init()) {
         kprintf("[OK] XHCI initialized\n");
     }
+    boot_mark("usb");
     
     // GPU: Vega 8
     kprintf("\n[GPU] AMD Radeon Vega 8...\n");
@@ -127,6 +154,7 @@ void kernel_main(uint64_t mb_info_phys) {
     } else {
         kprintf("[INFO] Using VGA text mode\n");
     }
+    boot_mark("gpu");
     
     // Laptop specific
     kprintf("\n[LAPTOP] Hardware monitoring...\n");
@@ -140,12 +168,18 @@ void kernel_main(uint64_t mb_info_phys) {
     kprintf("[OK] KOS ready on %u CPUs\n", smp_get_cpu_count());
     kprintf("     Memory: %lu MB free\n", pmm_get_free() / (1024 * 1024));
     kprintf("========================================================\n\n");
+    boot_mark("laptop");
+    boot_report();
+    
+#ifdef KOS_BENCH
+    mem_bench();
+    ring_bench();
+#endif
     
-    // Idle loop with polling
+    sched_boot_done();
+    
+    // Idle loop with polling (network RX is polled from the NET_RX softirq)
     while (1) {
-        // Poll network
-        network_poll();
-        
         // Poll laptop thermal
         laptop_thermal_poll();
         
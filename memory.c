@@ -26,11 +26,26 @@ struct memory_zone {
     uint64_t free_pages;
     uint64_t* bitmap;
     struct buddy_block* free_list[MAX_ORDER + 1];
-    spinlock_t lock;
+    mcs_lock_t lock;
 };
 
 static struct memory_zone zones[ZONE_COUNT];
 static uint64_t total_system_pages = 0;
+
+// zones[].free_pages is the allocator's own count, exact under the zone
+// lock. pmm_free mirrors the sum for readers so pmm_get_free() never
+// touches a zone's cache line; pmm_get_stats() takes the zone locks and
+// sums the real counts instead.
+static struct percpu_counter pmm_free;
+
+// Zeroing a multi-page block through the cache evicts the caller's working
+// set for data nobody reads yet; from here on it uses streaming stores
+#define PMM_ZERO_NT_MIN     (16 * PAGE_SIZE)
+
+static void pmm_zero(void* addr, size_t bytes) {
+    if (bytes >= PMM_ZERO_NT_MIN) memset_nt(addr, 0, bytes);
+    else memset(addr, 0, bytes);
+}
 static uint64_t early_alloc_pages = 0;
 static uint8_t* early_bitmap = NULL;
 
@@ -86,7 +101,9 @@ void pmm_init(uint64_t mb_info_phys) {
         zones[z].total_pages = 0;
         zones[z].free_pages = 0;
         zones[z].bitmap = NULL;
-        spin_init(&zones[z].lock);
+        mcs_init(&zones[z].lock);
+        LOCK_STAT_NAME(&zones[z].lock, z == ZONE_DMA ? "zone DMA" :
+                       z == ZONE_DMA32 ? "zone DMA32" : "zone NORMAL");
         for (int o = 0; o <= MAX_ORDER; o++) {
             zones[z].free_list[o] = NULL;
         }
@@ -173,19 +190,25 @@ void pmm_init(uint64_t mb_info_phys) {
         }
     }
     
+    percpu_counter_init(&pmm_free, PERCPU_COUNTER_BATCH);
+    for (int z = 0; z < ZONE_COUNT; z++) {
+        percpu_counter_add(&pmm_free, (int64_t)zones[z].free_pages);
+    }
+    
     kprintf("PMM: Total %lu MB, Free %lu MB\n",
         total_system_pages * PAGE_SIZE / (1024 * 1024),
         (total_system_pages - early_alloc_pages) * PAGE_SIZE / (1024 * 1024));
 }
 
 void* pmm_alloc_page(void) {
+    struct mcs_node node;
     // Try zones: NORMAL, DMA32, DMA
     int order[] = {ZONE_NORMAL, ZONE_DMA32, ZONE_DMA};
     for (int i = 0; i < 3; i++) {
         int z = order[i];
         if (zones[z].free_pages == 0) continue;
         
-        spin_lock(&zones[z].lock);
+        uint64_t flags = mcs_lock_irqsave(&zones[z].lock, &node);
         
         // Find a free page
         for (uint64_t pfn = zones[z].base_pfn; pfn < zones[z].end_pfn; pfn++) {
@@ -194,19 +217,21 @@ void* pmm_alloc_page(void) {
                 // Found free page
                 bitmap_set(zones[z].bitmap, idx);
                 zones[z].free_pages--;
-                spin_unlock(&zones[z].lock);
+                mcs_unlock_irqrestore(&zones[z].lock, &node, flags);
+                percpu_counter_dec(&pmm_free);
                 
                 void* addr = (void*)(pfn * PAGE_SIZE);
                 memset(PHYS_TO_VIRT(addr), 0, PAGE_SIZE);
                 return PHYS_TO_VIRT(addr);
             }
         }
-        spin_unlock(&zones[z].lock);
+        mcs_unlock_irqrestore(&zones[z].lock, &node, flags);
     }
     return NULL; // Out of memory
 }
 
 void* pmm_alloc_pages(size_t count) {
+    struct mcs_node node;
     if (count == 0) return NULL;
     if (count == 1) return pmm_alloc_page();
     
@@ -214,7 +239,7 @@ void* pmm_alloc_pages(size_t count) {
     for (int z = ZONE_NORMAL; z >= 0; z--) {
         if (zones[z].free_pages < count) continue;
         
-        spin_lock(&zones[z].lock);
+        uint64_t flags = mcs_lock_irqsave(&zones[z].lock, &node);
         
         uint64_t consecutive = 0;
         uint64_t start_pfn = 0;
@@ -230,27 +255,29 @@ void* pmm_alloc_pages(size_t count) {
                         bitmap_set(zones[z].bitmap, start_pfn + j - zones[z].base_pfn);
                     }
                     zones[z].free_pages -= count;
-                    spin_unlock(&zones[z].lock);
+                    mcs_unlock_irqrestore(&zones[z].lock, &node, flags);
+                    percpu_counter_add(&pmm_free, -(int64_t)count);
                     
                     void* addr = (void*)((start_pfn) * PAGE_SIZE);
-                    memset(PHYS_TO_VIRT(addr), 0, count * PAGE_SIZE);
+                    pmm_zero(PHYS_TO_VIRT(addr), count * PAGE_SIZE);
                     return PHYS_TO_VIRT(addr);
                 }
             } else {
                 consecutive = 0;
             }
         }
-        spin_unlock(&zones[z].lock);
+        mcs_unlock_irqrestore(&zones[z].lock, &node, flags);
     }
     return NULL;
 }
 
 void* pmm_alloc_huge_page(void) {
+    struct mcs_node node;
     // 2MB aligned
     for (int z = ZONE_NORMAL; z >= 0; z--) {
         if (zones[z].free_pages < 512) continue;
         
-        spin_lock(&zones[z].lock);
+        uint64_t flags = mcs_lock_irqsave(&zones[z].lock, &node);
         
         for (uint64_t pfn = zones[z].base_pfn;
              pfn + 512 <= zones[z].end_pfn;
@@ -274,44 +301,48 @@ void* pmm_alloc_huge_page(void) {
                     bitmap_set(zones[z].bitmap, pfn + i - zones[z].base_pfn);
                 }
                 zones[z].free_pages -= 512;
-                spin_unlock(&zones[z].lock);
+                mcs_unlock_irqrestore(&zones[z].lock, &node, flags);
+                percpu_counter_add(&pmm_free, -512);
                 
                 void* addr = (void*)(pfn * PAGE_SIZE);
-                memset(PHYS_TO_VIRT(addr), 0, HUGE_PAGE_SIZE);
+                pmm_zero(PHYS_TO_VIRT(addr), HUGE_PAGE_SIZE);
                 return PHYS_TO_VIRT(addr);
             }
         }
-        spin_unlock(&zones[z].lock);
+        mcs_unlock_irqrestore(&zones[z].lock, &node, flags);
     }
     return NULL;
 }
 
 void pmm_free_page(void* addr) {
+    struct mcs_node node;
     if (!addr) return;
     
-    uint64_t virt = (uint64_t)addr;
-    uint64_t pfn = virt / PAGE_SIZE;
+    // Callers hand back what pmm_alloc_*() returned: a direct-map address
+    uint64_t pfn = VIRT_TO_PHYS(addr) / PAGE_SIZE;
     
     for (int z = 0; z < ZONE_COUNT; z++) {
         if (pfn >= zones[z].base_pfn && pfn < zones[z].end_pfn) {
-            spin_lock(&zones[z].lock);
+            uint64_t flags = mcs_lock_irqsave(&zones[z].lock, &node);
             
             uint64_t idx = pfn - zones[z].base_pfn;
             if (idx >= (zones[z].end_pfn - zones[z].base_pfn)) {
-                spin_unlock(&zones[z].lock);
+                mcs_unlock_irqrestore(&zones[z].lock, &node, flags);
                 continue;
             }
             
-            if (bitmap_test(zones[z].bitmap, idx)) {
-                spin_unlock(&zones[z].lock);
+            // Set bits are allocated pages
+            if (!bitmap_test(zones[z].bitmap, idx)) {
+                mcs_unlock_irqrestore(&zones[z].lock, &node, flags);
                 kprintf("PMM: Double free at %p\n", addr);
-                continue;
+                return;
             }
             
             bitmap_clear(zones[z].bitmap, idx);
             zones[z].free_pages++;
             
-            spin_unlock(&zones[z].lock);
+            mcs_unlock_irqrestore(&zones[z].lock, &node, flags);
+            percpu_counter_inc(&pmm_free);
             return;
         }
     }
@@ -325,16 +356,25 @@ void pmm_free_pages(void* addr, size_t count) {
     }
 }
 
+// Approximate: off by at most PERCPU_COUNTER_BATCH pages per CPU
 uint64_t pmm_get_free(void) {
-    uint64_t free = 0;
-    for (int z = 0; z < ZONE_COUNT; z++) {
-        free += zones[z].free_pages * PAGE_SIZE;
-    }
-    return free;
+    int64_t free = percpu_counter_read(&pmm_free);
+    return free > 0 ? (uint64_t)free * PAGE_SIZE : 0;
 }
 
+// Exact, and used + free == total. Every allocator path holds one zone
+// lock at a time, so taking all of them in zone order cannot deadlock.
 void pmm_get_stats(uint64_t* total, uint64_t* used, uint64_t* free) {
+    struct mcs_node nodes[ZONE_COUNT];
+    uint64_t free_pages = 0;
+    
+    uint64_t flags = local_irq_save();
+    for (int z = 0; z < ZONE_COUNT; z++) mcs_lock(&zones[z].lock, &nodes[z]);
+    for (int z = 0; z < ZONE_COUNT; z++) free_pages += zones[z].free_pages;
+    for (int z = ZONE_COUNT - 1; z >= 0; z--) mcs_unlock(&zones[z].lock, &nodes[z]);
+    local_irq_restore(flags);
+    
     *total = total_system_pages * PAGE_SIZE;
-    *free = pmm_get_free();
+    *free = free_pages * PAGE_SIZE;
     *used = *total - *free;
 }
@@ -0,0 +1,140 @@
+// mutex.c — Sleeping mutex, semaphore and condition variable
+#include "kernel.h"
+
+// All three sleep through wait_on_address(). Before blocking, a contended
+// locker spins for a short while: lock hold times are usually shorter than
+// a trip through the scheduler.
+
+#define MUTEX_UNLOCKED      0
+#define MUTEX_LOCKED        1
+#define MUTEX_CONTENDED     2   // Locked, and somebody may be sleeping
+#define MUTEX_SPIN_LIMIT    1000
+#define SEM_SPIN_LIMIT      100
+
+static struct thread* self(void) {
+    return (struct thread*)this_cpu_read(current_thread);
+}
+
+void mutex_init(struct mutex* m) {
+    m->state = MUTEX_UNLOCKED;
+    m->owner = NULL;
+}
+
+bool mutex_trylock(struct mutex* m) {
+    uint32_t unlocked = MUTEX_UNLOCKED;
+    if (atomic_cmpxchg32(&m->state, &unlocked, MUTEX_LOCKED, ATOMIC_ACQUIRE)) {
+        m->owner = self();
+        return true;
+    }
+    return false;
+}
+
+// Take the lock marking it contended; used by mutex_lock() after spinning
+// and by cond_wait(), whose wake-up may have raced with other waiters.
+static void mutex_lock_slow(struct mutex* m) {
+    while (atomic_xchg32(&m->state, MUTEX_CONTENDED, ATOMIC_ACQUIRE) != MUTEX_UNLOCKED) {
+        wait_on_address(&m->state, MUTEX_CONTENDED, 0);
+    }
+    m->owner = self();
+}
+
+void mutex_lock(struct mutex* m) {
+    if (mutex_trylock(m)) return;
+    
+    // Adaptive spin: only worth it while the owner is running on a CPU
+    for (uint32_t i = 0; i < MUTEX_SPIN_LIMIT; i++) {
+        struct thread* owner = m->owner;
+        if (m->state == MUTEX_UNLOCKED) {
+            if (mutex_trylock(m)) return;
+        } else if (m->state == MUTEX_CONTENDED || (owner && !owner->on_cpu)) {
+            break;
+        }
+        pause();
+    }
+    
+    mutex_lock_slow(m);
+}
+
+void mutex_unlock(struct mutex* m) {
+    m->owner = NULL;
+    if (atomic_xchg32(&m->state, MUTEX_UNLOCKED, ATOMIC_RELEASE) == MUTEX_CONTENDED) {
+        wake_address(&m->state, 1);
+    }
+}
+
+void sem_init(struct semaphore* s, uint32_t count) {
+    s->count = count;
+    s->waiters = 0;
+}
+
+bool sem_trydown(struct semaphore* s) {
+    uint32_t c = atomic_load32(&s->count, ATOMIC_RELAXED);
+    while (c) {
+        // On failure c is reloaded with the current count
+        if (atomic_cmpxchg32(&s->count, &c, c - 1, ATOMIC_ACQUIRE)) return true;
+    }
+    return false;
+}
+
+// Returns FUTEX_OK, or FUTEX_TIMEDOUT if timeout_ms (0 = forever) expired
+int sem_down_timeout(struct semaphore* s, uint64_t timeout_ms) {
+    for (uint32_t i = 0; i < SEM_SPIN_LIMIT; i++) {
+        if (sem_trydown(s)) return FUTEX_OK;
+        pause();
+    }
+    
+    uint64_t deadline = timeout_ms ? sched_get_ticks() + (timeout_ms + SCHED_TICK_MS - 1) / SCHED_TICK_MS : 0;
+    int ret = FUTEX_OK;
+    atomic_fetch_add32(&s->waiters, 1, ATOMIC_SEQ_CST);
+    while (!sem_trydown(s)) {
+        uint64_t left = 0;
+        if (deadline) {
+            uint64_t now = sched_get_ticks();
+            if (now >= deadline) {
+                ret = FUTEX_TIMEDOUT;
+                break;
+            }
+            left = (deadline - now) * SCHED_TICK_MS;
+        }
+        wait_on_address(&s->count, 0, left);
+    }
+    atomic_fetch_sub32(&s->waiters, 1, ATOMIC_RELAXED);
+    return ret;
+}
+
+void sem_down(struct semaphore* s) {
+    sem_down_timeout(s, 0);
+}
+
+void sem_up(struct semaphore* s) {
+    atomic_fetch_add32(&s->count, 1, ATOMIC_SEQ_CST);
+    if (s->waiters) wake_address(&s->count, 1);
+}
+
+void cond_init(struct condvar* cv) {
+    cv->seq = 0;
+}
+
+// Atomically release m and sleep until signalled; m is held again on return.
+// Like any condition variable, callers must re-check their predicate.
+int cond_wait_timeout(struct condvar* cv, struct mutex* m, uint64_t timeout_ms) {
+    uint32_t seq = cv->seq;
+    mutex_unlock(m);
+    int ret = wait_on_address(&cv->seq, seq, timeout_ms);
+    mutex_lock_slow(m);
+    return ret == FUTEX_TIMEDOUT ? FUTEX_TIMEDOUT : FUTEX_OK;
+}
+
+void cond_wait(struct condvar* cv, struct mutex* m) {
+    cond_wait_timeout(cv, m, 0);
+}
+
+void cond_signal(struct condvar* cv) {
+    atomic_fetch_add32(&cv->seq, 1, ATOMIC_RELEASE);
+    wake_address(&cv->seq, 1);
+}
+
+void cond_broadcast(struct condvar* cv) {
+    atomic_fetch_add32(&cv->seq, 1, ATOMIC_RELEASE);
+    wake_address(&cv->seq, UINT32_MAX);
+}
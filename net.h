@@ -103,6 +103,7 @@ struct socket {
     uint32_t tx_head;
     uint32_t tx_tail;
     struct socket* next;
+    struct rcu_head rcu;            // Deferred free after unlink
     int error;
     uint32_t unacked_len;
     uint32_t last_ack;
@@ -146,6 +147,10 @@ struct net_device {
     struct net_device* next;
 };
 
+// Checksum loops read headers that were written field by field: the word
+// type may alias anything and sit at any address (packed structs)
+typedef uint16_t __attribute__((may_alias, aligned(1))) csum_word_t;
+
 // Network functions
 void network_init(void);
 void network_poll(void);
@@ -184,7 +189,7 @@ void icmp_echo_reply(uint32_t dst, uint16_t id, uint16_t seq, void* data, uint16
 void arp_init(void);
 void arp_request(uint32_t ip);
 void arp_rx(struct arp_packet* arp);
-uint8_t* arp_lookup(uint32_t ip);
+bool arp_lookup(uint32_t ip, uint8_t* mac);
 void arp_add(uint32_t ip, uint8_t* mac);
 
 // Network device management
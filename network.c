@@ -1,20 +1,43 @@
 // network.c — Network stack initialization FIXED
 #include "net.h"
 
+#define ARP_CACHE_SIZE  256
+
+// ARP cache: entries are immutable once published, an update swaps in a
+// new entry and frees the old one after a grace period. Lookups on the
+// TX path take no lock; arp_lock only serializes writers.
+struct arp_entry {
+    uint32_t ip;
+    uint8_t mac[ETH_ALEN];
+    struct rcu_head rcu;
+};
+
 static struct net_device* devices = NULL;
-static uint8_t arp_cache[256][6]; // Simple ARP cache
-static uint32_t arp_cache_ip[256];
-static int arp_cache_count = 0;
+static struct arp_entry* arp_cache[ARP_CACHE_SIZE];
+static volatile uint32_t arp_cache_count = 0;
+static spinlock_t arp_lock;
+static spinlock_t devices_lock;
+static bool net_rx_ready = false;
 
 void network_init(void) {
+    spin_init(&devices_lock);
     tcp_init();
     arp_init();
+    open_softirq(SOFTIRQ_NET_RX, network_poll);
+    net_rx_ready = true;
     kprintf("Network: Initialized\n");
 }
 
+// NET_RX softirq: received packets are drained here with interrupts
+// enabled. No NIC driver has an interrupt top half yet, so the BSP tick
+// raises NET_RX through network_tick(); a driver that acks its IRQ and
+// raises NET_RX itself takes over from that.
 void network_poll(void) {
-    // Poll network devices for received packets
-    // In real implementation, this would be called from interrupt or timer
+    r8168_poll();
+}
+
+void network_tick(void) {
+    if (net_rx_ready) raise_softirq(SOFTIRQ_NET_RX);
 }
 
 void network_rx(void* packet, uint16_t len) {
@@ -35,9 +58,9 @@ void network_rx(void* packet, uint16_t len) {
 }
 
 void arp_init(void) {
-    memset(arp_cache_ip, 0, sizeof(arp_cache_ip));
     memset(arp_cache, 0, sizeof(arp_cache));
     arp_cache_count = 0;
+    spin_init(&arp_lock);
     kprintf("ARP: Initialized\n");
 }
 
@@ -53,53 +76,81 @@ void arp_rx(struct arp_packet* arp) {
     if (ntohs(arp->opcode) == ARP_OP_REQUEST) { // ARP Request
         // Check if request is for our IP
         uint32_t target_ip = ntohl(arp->target_ip);
+        rcu_read_lock();
         struct net_device* dev = net_get_device();
         if (dev && target_ip == dev->ip) {
             // Send ARP reply
             // Simplified
         }
+        rcu_read_unlock();
     } else if (ntohs(arp->opcode) == ARP_OP_REPLY) { // ARP Reply
         // Add to cache
         arp_add(ntohl(arp->sender_ip), arp->sender_mac);
     }
 }
 
-uint8_t* arp_lookup(uint32_t ip) {
-    for (int i = 0; i < arp_cache_count; i++) {
-        if (arp_cache_ip[i] == ip) {
-            return arp_cache[i];
+// Copy the MAC for ip into mac; the entry itself may be replaced at any time
+bool arp_lookup(uint32_t ip, uint8_t* mac) {
+    bool found = false;
+    rcu_read_lock();
+    uint32_t count = atomic_load32(&arp_cache_count, ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++) {
+        struct arp_entry* e = rcu_dereference(arp_cache[i]);
+        if (e->ip == ip) {
+            memcpy(mac, e->mac, ETH_ALEN);
+            found = true;
+            break;
         }
     }
-    return NULL;
+    rcu_read_unlock();
+    return found;
+}
+
+static void arp_entry_free(struct rcu_head* head) {
+    kfree(container_of(head, struct arp_entry, rcu));
 }
 
 void arp_add(uint32_t ip, uint8_t* mac) {
-    // Check if already exists
-    for (int i = 0; i < arp_cache_count; i++) {
-        if (arp_cache_ip[i] == ip) {
-            memcpy(arp_cache[i], mac, ETH_ALEN);
+    struct arp_entry* e = (struct arp_entry*)kmalloc(sizeof(struct arp_entry));
+    if (!e) return;
+    e->ip = ip;
+    memcpy(e->mac, mac, ETH_ALEN);
+    
+    uint64_t flags = spin_lock_irqsave(&arp_lock);
+    // Replace an existing entry
+    for (uint32_t i = 0; i < arp_cache_count; i++) {
+        struct arp_entry* old = arp_cache[i];
+        if (old->ip == ip) {
+            rcu_assign_pointer(arp_cache[i], e);
+            spin_unlock_irqrestore(&arp_lock, flags);
+            call_rcu(&old->rcu, arp_entry_free);
             return;
         }
     }
     
-    // Add new entry
-    if (arp_cache_count < 256) {
-        arp_cache_ip[arp_cache_count] = ip;
-        memcpy(arp_cache[arp_cache_count], mac, ETH_ALEN);
-        arp_cache_count++;
+    // Add new entry: slot first, then the count that makes it visible
+    if (arp_cache_count < ARP_CACHE_SIZE) {
+        rcu_assign_pointer(arp_cache[arp_cache_count], e);
+        atomic_store32(&arp_cache_count, arp_cache_count + 1, ATOMIC_RELEASE);
+        e = NULL;
     }
+    spin_unlock_irqrestore(&arp_lock, flags);
+    if (e) kfree(e);
 }
 
 void net_register_device(struct net_device* dev) {
+    uint64_t flags = spin_lock_irqsave(&devices_lock);
     dev->next = devices;
-    devices = dev;
+    rcu_assign_pointer(devices, dev);
+    spin_unlock_irqrestore(&devices_lock, flags);
     kprintf("Network: Registered %02X:%02X:%02X:%02X:%02X:%02X\n",
         dev->mac[0], dev->mac[1], dev->mac[2],
         dev->mac[3], dev->mac[4], dev->mac[5]);
 }
 
+// Caller holds rcu_read_lock() while it uses the device
 struct net_device* net_get_device(void) {
-    return devices;
+    return rcu_dereference(devices);
 }
 
 // ICMP implementation
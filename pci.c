@@ -4,8 +4,31 @@
 #define CONFIG_ADDR         0xCF8
 #define CONFIG_DATA         0xCFC
 
+#define PCI_CAP_MSI         0x05
+#define PCI_CAP_MSIX        0x11
+#define PCI_CMD_INTX_DISABLE 0x0400
+
+#define MSI_CTRL_ENABLE     0x0001
+#define MSI_CTRL_64BIT      0x0080
+
+// MSI-X: Message Control at cap + 2, Table offset/BIR at cap + 4
+#define MSIX_CTRL_SIZE_MASK 0x07FF      // Table size - 1
+#define MSIX_CTRL_FUNC_MASK 0x4000
+#define MSIX_CTRL_ENABLE    0x8000
+#define MSIX_BIR_MASK       0x7
+
+// Table entry: addr low, addr high, data, vector control (dwords)
+#define MSIX_ENTRY_DWORDS   4
+#define MSIX_ENTRY_MASKED   0x1
+
+// Message address: fixed delivery, physical destination APIC ID
+#define MSI_ADDR_BASE       0xFEE00000
+#define MSI_ADDR_DEST(id)   ((uint32_t)(id) << 12)
+
 static struct pci_device devices[MAX_PCI_DEVICES];
-static size_t device_count = 0;
+// Append-only: an entry is filled in before the count that covers it is
+// published, so lookups need no lock
+static volatile uint64_t device_count = 0;
 
 static uint32_t pci_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
     uint32_t addr = (uint32_t)((bus << 16) | (slot << 11) | (func << 8) |
@@ -39,7 +62,7 @@ void pci_init(void) {
                 
                 if (device_count >= MAX_PCI_DEVICES) break;
                 
-                struct pci_device* dev = &devices[device_count++];
+                struct pci_device* dev = &devices[device_count];
                 dev->bus = bus;
                 dev->slot = slot;
                 dev->func = func;
@@ -86,19 +109,29 @@ void pci_init(void) {
                     }
                 }
                 
-                // Check MSI capability
+                // Check MSI / MSI-X capabilities
                 dev->msi_capable = false;
+                dev->msix_capable = false;
+                dev->msix_table = NULL;
                 uint8_t cap_ptr = pci_read(bus, slot, func, 0x34) & 0xFF;
                 while (cap_ptr) {
-                    uint8_t cap_id = pci_read(bus, slot, func, cap_ptr) & 0xFF;
-                    if (cap_id == 0x05) { // MSI
+                    uint32_t cap = pci_read(bus, slot, func, cap_ptr);
+                    uint8_t cap_id = cap & 0xFF;
+                    if (cap_id == PCI_CAP_MSI) {
                         dev->msi_capable = true;
                         dev->msi_offset = cap_ptr;
+                    } else if (cap_id == PCI_CAP_MSIX) {
+                        dev->msix_capable = true;
+                        dev->msix_offset = cap_ptr;
+                        dev->msix_count = ((cap >> 16) & MSIX_CTRL_SIZE_MASK) + 1;
                     }
                     cap_ptr = (pci_read(bus, slot, func, cap_ptr) >> 8) & 0xFF;
                     if (cap_ptr == 0) break;
                 }
                 
+                // Publish the filled-in entry
+                atomic_store64(&device_count, device_count + 1, ATOMIC_RELEASE);
+                
                 kprintf("PCI %02x:%02x.%x: %04X:%04X class %02X%02X%02X\n",
                     bus, slot, func, dev->vendor_id, dev->device_id,
                     dev->class_code, dev->subclass, dev->prog_if);
@@ -106,11 +139,12 @@ void pci_init(void) {
         }
     }
     
-    kprintf("PCI: %zu devices found\n", device_count);
+    kprintf("PCI: %lu devices found\n", device_count);
 }
 
 struct pci_device* pci_find_class(uint32_t class_code) {
-    for (size_t i = 0; i < device_count; i++) {
+    size_t count = atomic_load64(&device_count, ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < count; i++) {
         uint32_t cc = ((uint32_t)devices[i].class_code << 16) |
                       ((uint32_t)devices[i].subclass << 8) |
                       devices[i].prog_if;
@@ -120,7 +154,8 @@ struct pci_device* pci_find_class(uint32_t class_code) {
 }
 
 struct pci_device* pci_find_device(uint16_t vendor, uint16_t device) {
-    for (size_t i = 0; i < device_count; i++) {
+    size_t count = atomic_load64(&device_count, ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < count; i++) {
         if (devices[i].vendor_id == vendor && devices[i].device_id == device) {
             return &devices[i];
         }
@@ -129,12 +164,12 @@ struct pci_device* pci_find_device(uint16_t vendor, uint16_t device) {
 }
 
 struct pci_device* pci_get_device(size_t idx) {
-    if (idx < device_count) return &devices[idx];
+    if (idx < atomic_load64(&device_count, ATOMIC_ACQUIRE)) return &devices[idx];
     return NULL;
 }
 
 size_t pci_get_device_count(void) {
-    return device_count;
+    return atomic_load64(&device_count, ATOMIC_ACQUIRE);
 }
 
 uint32_t pci_read_dword(struct pci_device* dev, uint8_t offset) {
@@ -159,6 +194,10 @@ void pci_write_word(struct pci_device* dev, uint8_t offset, uint16_t val) {
     outl(CONFIG_DATA, dw);
 }
 
+void pci_write_dword(struct pci_device* dev, uint8_t offset, uint32_t val) {
+    pci_write(dev->bus, dev->slot, dev->func, offset, val);
+}
+
 uint64_t pci_read_bar(struct pci_device* dev, uint8_t bar) {
     if (bar >= 6) return 0;
     return dev->bar_phys[bar];
@@ -169,31 +208,154 @@ void pci_enable_bus_mastering(struct pci_device* dev) {
     pci_write_word(dev, 0x04, cmd | PCI_CMD_BUS_MASTER | PCI_CMD_MEM_SPACE);
 }
 
-bool pci_enable_msi(struct pci_device* dev, uint8_t vector) {
-    if (!dev->msi_capable) return false;
-    
-    uint16_t msg_ctrl = pci_read_word(dev, dev->msi_offset + 0x02);
-    bool is_64bit = msg_ctrl & 0x80;
+static uint32_t msi_address(uint32_t cpu) {
+    return MSI_ADDR_BASE | MSI_ADDR_DEST(cpu_get(cpu)->apic_id);
+}
+
+static void pci_disable_intx(struct pci_device* dev) {
+    uint16_t cmd = pci_read_word(dev, 0x04);
+    pci_write_word(dev, 0x04, cmd | PCI_CMD_INTX_DISABLE);
+}
+
+// Single-message MSI to vector on cpu
+bool pci_enable_msi(struct pci_device* dev, uint32_t cpu, uint8_t vector) {
+    if (!dev->msi_capable || cpu >= MAX_CPUS) return false;
     
-    // Write message address (APIC ID 0, vector)
-    uint64_t msg_addr = 0xFEE00000 | (0 << 12);
-    pci_write_word(dev, dev->msi_offset + 0x04, msg_addr & 0xFFFF);
-    pci_write_word(dev, dev->msi_offset + 0x06, msg_addr >> 16);
+    uint8_t cap = dev->msi_offset;
+    uint16_t msg_ctrl = pci_read_word(dev, cap + 0x02);
     
-    if (is_64bit) {
-        pci_write_word(dev, dev->msi_offset + 0x08, msg_addr >> 32);
-        pci_write_word(dev, dev->msi_offset + 0x0C, vector);
+    pci_write_dword(dev, cap + 0x04, msi_address(cpu));
+    if (msg_ctrl & MSI_CTRL_64BIT) {
+        pci_write_dword(dev, cap + 0x08, 0);
+        pci_write_word(dev, cap + 0x0C, vector);
     } else {
-        pci_write_word(dev, dev->msi_offset + 0x08, vector);
+        pci_write_word(dev, cap + 0x08, vector);
     }
     
-    // Enable MSI
-    msg_ctrl |= 0x01;
-    pci_write_word(dev, dev->msi_offset + 0x02, msg_ctrl);
+    // One message (MME = 0), enable
+    msg_ctrl &= ~0x0070;
+    pci_write_word(dev, cap + 0x02, msg_ctrl | MSI_CTRL_ENABLE);
+    pci_disable_intx(dev);
+    return true;
+}
+
+// Table lives in a memory BAR at the offset named by the BIR field
+static bool msix_map_table(struct pci_device* dev) {
+    if (dev->msix_table) return true;
     
-    // Disable INTx
-    uint16_t cmd = pci_read_word(dev, 0x04);
-    pci_write_word(dev, 0x04, cmd | 0x0400);
+    uint32_t tbl = pci_read_dword(dev, dev->msix_offset + 0x04);
+    uint8_t bir = tbl & MSIX_BIR_MASK;
+    if (bir >= 6 || !dev->bar_is_mmio[bir] || !dev->bar_phys[bir]) return false;
     
+    uint64_t phys = dev->bar_phys[bir] + (tbl & ~MSIX_BIR_MASK);
+    dev->msix_table = (volatile uint32_t*)PHYS_TO_VIRT(phys);
     return true;
 }
+
+static inline volatile uint32_t* msix_entry(struct pci_device* dev, uint16_t entry) {
+    return dev->msix_table + entry * MSIX_ENTRY_DWORDS;
+}
+
+void pci_msix_mask(struct pci_device* dev, uint16_t entry) {
+    if (!dev->msix_table || entry >= dev->msix_count) return;
+    volatile uint32_t* e = msix_entry(dev, entry);
+    e[3] |= MSIX_ENTRY_MASKED;
+    (void)e[3];     // Flush the posted write
+}
+
+void pci_msix_unmask(struct pci_device* dev, uint16_t entry) {
+    if (!dev->msix_table || entry >= dev->msix_count) return;
+    volatile uint32_t* e = msix_entry(dev, entry);
+    e[3] &= ~MSIX_ENTRY_MASKED;
+}
+
+// Vector for queue i on the i-th online CPU (round robin), so a queue's
+// completions arrive on the core that submits to it; falls back to the
+// least loaded CPU when that one has no free vectors.
+static int msix_alloc_vector(int idx, uint32_t* cpu) {
+    uint32_t online[MAX_CPUS];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (cpu_get(i)->online) online[n++] = i;
+    }
+    if (n) {
+        *cpu = online[idx % n];
+        int vector = irq_alloc_vector(*cpu);
+        if (vector >= 0) return vector;
+    }
+    return irq_alloc_vector_spread(cpu);
+}
+
+// Allocate up to count messages spread across online CPUs, chain
+// handler(contexts[i]) on each and program entry i. MSI-X when present,
+// otherwise a single MSI message. Returns the number allocated, or -1.
+int pci_alloc_irq_vectors(struct pci_device* dev, int count, irq_handler_t handler,
+                          void* const* contexts, struct pci_irq_vector* out) {
+    if (count <= 0 || !handler) return -1;
+    
+    bool msix = dev->msix_capable && msix_map_table(dev);
+    if (!msix) {
+        if (!dev->msi_capable) return -1;
+        count = 1;
+    } else if (count > dev->msix_count) {
+        count = dev->msix_count;
+    }
+    
+    int n;
+    for (n = 0; n < count; n++) {
+        void* ctx = contexts ? contexts[n] : NULL;
+        int vector = msix_alloc_vector(n, &out[n].cpu);
+        if (vector < 0) break;
+        out[n].vector = (uint8_t)vector;
+        if (irq_request(out[n].cpu, out[n].vector, handler, ctx) < 0) {
+            irq_free_vector(out[n].cpu, out[n].vector);
+            break;
+        }
+    }
+    if (n == 0) return -1;
+    
+    if (!msix) {
+        pci_enable_msi(dev, out[0].cpu, out[0].vector);
+        return 1;
+    }
+    
+    // Enable with the whole function masked while entries are written
+    uint8_t cap = dev->msix_offset;
+    uint16_t msg_ctrl = pci_read_word(dev, cap + 0x02);
+    pci_write_word(dev, cap + 0x02, msg_ctrl | MSIX_CTRL_ENABLE | MSIX_CTRL_FUNC_MASK);
+    
+    for (uint16_t i = 0; i < dev->msix_count; i++) {
+        volatile uint32_t* e = msix_entry(dev, i);
+        e[3] |= MSIX_ENTRY_MASKED;
+        if (i >= n) continue;
+        e[0] = msi_address(out[i].cpu);
+        e[1] = 0;
+        e[2] = out[i].vector;
+        e[3] &= ~MSIX_ENTRY_MASKED;
+    }
+    
+    pci_disable_intx(dev);
+    pci_write_word(dev, cap + 0x02, (msg_ctrl | MSIX_CTRL_ENABLE) & ~MSIX_CTRL_FUNC_MASK);
+    
+    kprintf("PCI %02x:%02x.%x: MSI-X %d/%u vectors\n",
+        dev->bus, dev->slot, dev->func, n, dev->msix_count);
+    return n;
+}
+
+// Undo pci_alloc_irq_vectors(): mask and disable, then release the vectors
+void pci_free_irq_vectors(struct pci_device* dev, int count, irq_handler_t handler,
+                          void* const* contexts, const struct pci_irq_vector* out) {
+    if (dev->msix_capable && dev->msix_table) {
+        for (int i = 0; i < count && i < dev->msix_count; i++) pci_msix_mask(dev, i);
+        uint16_t msg_ctrl = pci_read_word(dev, dev->msix_offset + 0x02);
+        pci_write_word(dev, dev->msix_offset + 0x02, msg_ctrl & ~MSIX_CTRL_ENABLE);
+    } else if (dev->msi_capable) {
+        uint16_t msg_ctrl = pci_read_word(dev, dev->msi_offset + 0x02);
+        pci_write_word(dev, dev->msi_offset + 0x02, msg_ctrl & ~MSI_CTRL_ENABLE);
+    }
+    
+    for (int i = 0; i < count; i++) {
+        irq_release(out[i].cpu, out[i].vector, handler, contexts ? contexts[i] : NULL);
+        irq_free_vector(out[i].cpu, out[i].vector);
+    }
+}
@@ -1,39 +1,47 @@
-// pit.c — Programmable Interval Timer FIXED
+// pit.c — Programmable Interval Timer (channel 2 one-shot, polled)
 #include "kernel.h"
 
 #define PIT_FREQ        1193182
 #define PIT_CMD         0x43
-#define PIT_CH0         0x40
+#define PIT_CH2         0x42
+#define PIT_GATE        0x61    // Bit 0: channel 2 gate, bit 1: speaker, bit 5: OUT2
 
+// Channel 2 is gated by port 0x61 and its output can be polled there, so
+// it measures time without interrupts and without touching channel 0.
+// Longest one-shot is 65535 ticks (~54.9 ms).
+static void pit_oneshot_start(uint16_t count) {
+    uint8_t gate = inb(PIT_GATE);
+    outb(PIT_GATE, (gate & ~0x02) & ~0x01);     // Speaker off, gate low
+    outb(PIT_CMD, 0xB0);                        // Channel 2, lobyte/hibyte, mode 0
+    outb(PIT_CH2, count & 0xFF);
+    outb(PIT_CH2, count >> 8);
+    outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);  // Gate high: start counting
+}
+
+static bool pit_oneshot_done(void) {
+    return inb(PIT_GATE) & 0x20;
+}
+
+// Busy-wait without disabling interrupts
 void pit_wait(uint32_t ms) {
-    // Disable interrupts during wait
-    cli();
-    
-    uint16_t count = (PIT_FREQ * ms) / 1000;
-    if (count == 0) count = 1;
-    
-    // Channel 0, lobyte/hibyte, mode 0 (interrupt on terminal count)
-    outb(PIT_CMD, 0x30);
-    
-    outb(PIT_CH0, count & 0xFF);
-    outb(PIT_CH0, (count >> 8) & 0xFF);
-    
-    // Wait for counter to reach zero
-    while (count > 0) {
-        // Read current count (latch)
-        outb(PIT_CMD, 0x00);
-        uint16_t current = inb(PIT_CH0) | (inb(PIT_CH0) << 8);
-        if (current == 0) current = 0x10000;
-        if (current > count) break;
+    while (ms) {
+        uint32_t chunk = ms > 50 ? 50 : ms;
+        pit_oneshot_start((uint16_t)(PIT_FREQ * chunk / 1000));
+        while (!pit_oneshot_done()) pause();
+        ms -= chunk;
     }
-    
-    sti();
 }
 
-// Simple busy wait for small delays
+// TSC cycles elapsed over a PIT-timed window of ms (at most 50)
+uint64_t pit_measure_tsc(uint32_t ms) {
+    if (ms > 50) ms = 50;
+    pit_oneshot_start((uint16_t)(PIT_FREQ * ms / 1000));
+    uint64_t start = rdtsc();
+    while (!pit_oneshot_done()) pause();
+    return rdtsc() - start;
+}
+
+// Kept for older callers; the TSC is the accurate source once calibrated
 void pit_delay(uint32_t us) {
-    // Approximate - not accurate but sufficient for small delays
-    for (uint32_t i = 0; i < us * 3; i++) {
-        asm volatile ("nop");
-    }
+    udelay(us);
 }
@@ -0,0 +1,164 @@
+// rcu.c — Read-copy-update: grace periods and deferred callbacks
+#include "kernel.h"
+
+// gp_seq is even while idle and odd while a grace period runs. Starting
+// one snapshots the online CPUs into qs_mask; each CPU clears its bit at
+// its next quiescent state and the last one ends the period. A callback
+// queued at gp_seq s waits for the first period that starts after s,
+// i.e. until gp_seq reaches (s + 3) & ~1.
+//
+// Callbacks queue on the CPU that called call_rcu(), in order, and run
+// from SOFTIRQ_RCU on that CPU.
+
+struct rcu_cblist {
+    struct rcu_head* head;
+    struct rcu_head* tail;
+    uint64_t queued;
+    uint64_t invoked;
+};
+
+static volatile uint64_t gp_seq = 0;
+static volatile uint64_t qs_mask = 0;
+static spinlock_t gp_lock;
+static struct rcu_cblist cblists[MAX_CPUS];
+static uint64_t gp_completed = 0;
+
+static inline uint64_t gp_snap(uint64_t s) {
+    return (s + 3) & ~1ULL;
+}
+
+static inline bool gp_done(uint64_t target) {
+    return atomic_load64(&gp_seq, ATOMIC_ACQUIRE) >= target;
+}
+
+static uint64_t online_mask(void) {
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (cpu_get(i)->online) mask |= 1ULL << i;
+    }
+    return mask;
+}
+
+static void rcu_start_gp(void) {
+    uint64_t flags = spin_lock_irqsave(&gp_lock);
+    if (!(gp_seq & 1)) {
+        atomic_store64(&qs_mask, online_mask(), ATOMIC_RELAXED);
+        atomic_store64(&gp_seq, gp_seq + 1, ATOMIC_RELEASE);
+    }
+    spin_unlock_irqrestore(&gp_lock, flags);
+}
+
+// The calling CPU is outside any read section
+static void rcu_report_qs(void) {
+    uint64_t s = atomic_load64(&gp_seq, ATOMIC_ACQUIRE);
+    uint64_t bit = 1ULL << this_cpu_read(id);
+    if (!(s & 1) || !(atomic_load64(&qs_mask, ATOMIC_RELAXED) & bit)) return;
+
+    // Order this CPU's earlier read sections before the report
+    smp_mb();
+    uint64_t flags = spin_lock_irqsave(&gp_lock);
+    if (gp_seq == s && (qs_mask & bit)) {
+        atomic_store64(&qs_mask, qs_mask & ~bit, ATOMIC_RELAXED);
+        if (!qs_mask) {
+            gp_completed++;
+            atomic_store64(&gp_seq, s + 1, ATOMIC_RELEASE);
+        }
+    }
+    spin_unlock_irqrestore(&gp_lock, flags);
+}
+
+void rcu_note_context_switch(void) {
+    rcu_report_qs();
+}
+
+// Scheduler tick on every CPU: the interrupted context is quiescent if
+// it was neither in a read section nor running softirqs
+void rcu_tick(void) {
+    if (this_cpu_read(preempt_count) == 0 && !this_cpu_read(softirq_active)) {
+        rcu_report_qs();
+    }
+
+    struct rcu_head* head = cblists[this_cpu_read(id)].head;
+    if (!head) return;
+    if (gp_done(head->gp_seq)) raise_softirq(SOFTIRQ_RCU);
+    else if (!(atomic_load64(&gp_seq, ATOMIC_RELAXED) & 1)) rcu_start_gp();
+}
+
+// Run func(head) once every reader that might still see the object has
+// finished. Safe from interrupt context.
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head)) {
+    head->func = func;
+    head->next = NULL;
+
+    uint64_t flags = local_irq_save();
+    struct rcu_cblist* l = &cblists[this_cpu_read(id)];
+    head->gp_seq = gp_snap(atomic_load64(&gp_seq, ATOMIC_ACQUIRE));
+    if (l->tail) l->tail->next = head;
+    else l->head = head;
+    l->tail = head;
+    l->queued++;
+    local_irq_restore(flags);
+}
+
+// SOFTIRQ_RCU: invoke this CPU's callbacks whose grace period is over
+static void rcu_process_callbacks(void) {
+    struct rcu_cblist* l;
+    struct rcu_head* done = NULL;
+    struct rcu_head** done_tail = &done;
+
+    cli();
+    l = &cblists[this_cpu_read(id)];
+    while (l->head && gp_done(l->head->gp_seq)) {
+        struct rcu_head* h = l->head;
+        l->head = h->next;
+        *done_tail = h;
+        done_tail = &h->next;
+        l->invoked++;
+    }
+    if (!l->head) l->tail = NULL;
+    *done_tail = NULL;
+    sti();
+
+    while (done) {
+        struct rcu_head* h = done;
+        done = h->next;
+        h->func(h);
+    }
+}
+
+struct rcu_sync {
+    struct rcu_head head;
+    volatile uint32_t done;
+};
+
+static void rcu_sync_wake(struct rcu_head* head) {
+    struct rcu_sync* s = container_of(head, struct rcu_sync, head);
+    atomic_store32(&s->done, 1, ATOMIC_RELEASE);
+    wake_address(&s->done, 1);
+}
+
+// Block until a full grace period has elapsed (thread context only)
+void synchronize_rcu(void) {
+    struct rcu_sync s = { .done = 0 };
+    call_rcu(&s.head, rcu_sync_wake);
+    while (!atomic_load32(&s.done, ATOMIC_ACQUIRE)) {
+        wait_on_address(&s.done, 0, 0);
+    }
+}
+
+void rcu_init(void) {
+    spin_init(&gp_lock);
+    LOCK_STAT_NAME(&gp_lock, "rcu gp");
+    open_softirq(SOFTIRQ_RCU, rcu_process_callbacks);
+    kprintf("RCU: Initialized\n");
+}
+
+void rcu_dump_stats(void) {
+    kprintf("RCU: gp_seq %lu, %lu grace periods, waiting mask %lx\n",
+        gp_seq, gp_completed, qs_mask);
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!cpu_get(cpu)->online) continue;
+        kprintf("  CPU%u: %lu queued, %lu invoked\n",
+            cpu, cblists[cpu].queued, cblists[cpu].invoked);
+    }
+}
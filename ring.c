@@ -0,0 +1,261 @@
+// ring.c — Bounded lock-free rings (single or multi producer, one consumer)
+#include "kernel.h"
+
+// Slots hold pointers. Indices run freely and wrap at 2^32; index i lives
+// in slots[i & mask]. Producers reserve [prod_head, prod_head + n), fill
+// the slots, then publish by advancing prod_tail. With several producers
+// each one waits for those that reserved before it, so the consumer only
+// ever sees a contiguous run. The consumer hands slots back by advancing
+// cons_tail.
+//
+// Blocking rings keep a waiter word per side; the side that moves an index
+// fences, checks the word and wakes the other side through the futex on
+// that index.
+
+bool ring_init(struct ring* r, void** slots, uint32_t size, uint32_t flags) {
+    if (!slots || size < 2 || (size & (size - 1))) return false;
+    r->slots = slots;
+    r->mask = size - 1;
+    r->flags = flags;
+    r->prod_head = 0;
+    r->prod_tail = 0;
+    r->cons_tail = 0;
+    r->cons_waiting = 0;
+    r->prod_waiting = 0;
+    return true;
+}
+
+// Snapshot only: both sides may move right after. cons_tail is read
+// first so the difference can never go negative.
+uint32_t ring_count(const struct ring* r) {
+    uint32_t tail = atomic_load32(&r->cons_tail, ATOMIC_ACQUIRE);
+    return atomic_load32(&r->prod_tail, ATOMIC_ACQUIRE) - tail;
+}
+
+// Enqueue up to n objects, returns how many went in. Multi-producer rings
+// run reserve-to-publish with IF=0: an interrupt handler producing on the
+// same CPU would otherwise spin on a reservation that cannot complete.
+uint32_t ring_enqueue_burst(struct ring* r, void* const* objs, uint32_t n) {
+    bool sp = r->flags & RING_SP;
+    uint64_t flags = sp ? 0 : local_irq_save();
+    uint32_t head = atomic_load32(&r->prod_head, ATOMIC_RELAXED);
+    uint32_t next, count;
+
+    do {
+        // Acquire: the consumer is done reading the slots we may reuse
+        uint32_t room = r->mask + 1 - (head - atomic_load32(&r->cons_tail, ATOMIC_ACQUIRE));
+        count = n < room ? n : room;
+        if (count == 0) {
+            if (!sp) local_irq_restore(flags);
+            return 0;
+        }
+        next = head + count;
+        if (sp) {
+            r->prod_head = next;
+            break;
+        }
+    } while (!atomic_cmpxchg32(&r->prod_head, &head, next, ATOMIC_RELAXED));
+
+    for (uint32_t i = 0; i < count; i++) {
+        r->slots[(head + i) & r->mask] = objs[i];
+    }
+
+    if (!sp) {
+        while (atomic_load32(&r->prod_tail, ATOMIC_RELAXED) != head) pause();
+    }
+    atomic_store32(&r->prod_tail, next, ATOMIC_RELEASE);
+    if (!sp) local_irq_restore(flags);
+
+    if (r->flags & RING_BLOCKING) {
+        smp_mb();
+        if (atomic_load32(&r->cons_waiting, ATOMIC_RELAXED)) wake_address(&r->prod_tail, 1);
+    }
+    return count;
+}
+
+// Dequeue up to n objects, returns how many came out. Consumer only.
+uint32_t ring_dequeue_burst(struct ring* r, void** objs, uint32_t n) {
+    uint32_t tail = r->cons_tail;
+    uint32_t avail = atomic_load32(&r->prod_tail, ATOMIC_ACQUIRE) - tail;
+    uint32_t count = n < avail ? n : avail;
+    if (count == 0) return 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        objs[i] = r->slots[(tail + i) & r->mask];
+    }
+    atomic_store32(&r->cons_tail, tail + count, ATOMIC_RELEASE);
+
+    if (r->flags & RING_BLOCKING) {
+        smp_mb();
+        if (atomic_load32(&r->prod_waiting, ATOMIC_RELAXED)) {
+            wake_address(&r->cons_tail, ~0u);
+        }
+    }
+    return count;
+}
+
+// Enqueue all n objects, sleeping while the ring is full (thread context,
+// RING_BLOCKING rings only)
+void ring_enqueue_wait(struct ring* r, void* const* objs, uint32_t n) {
+    while (n) {
+        uint32_t done = ring_enqueue_burst(r, objs, n);
+        objs += done;
+        n -= done;
+        if (!n || done) continue;
+
+        // Announce ourselves before the final check (locked add = full fence)
+        atomic_fetch_add32(&r->prod_waiting, 1, ATOMIC_SEQ_CST);
+        uint32_t seen = atomic_load32(&r->cons_tail, ATOMIC_ACQUIRE);
+        if (atomic_load32(&r->prod_head, ATOMIC_RELAXED) - seen > r->mask) {
+            wait_on_address(&r->cons_tail, seen, 0);
+        }
+        atomic_fetch_sub32(&r->prod_waiting, 1, ATOMIC_RELAXED);
+    }
+}
+
+// Dequeue at least one and at most n objects, sleeping while the ring is
+// empty (thread context, RING_BLOCKING rings only)
+uint32_t ring_dequeue_wait(struct ring* r, void** objs, uint32_t n) {
+    uint32_t count;
+    while (!(count = ring_dequeue_burst(r, objs, n))) {
+        atomic_xchg32(&r->cons_waiting, 1, ATOMIC_SEQ_CST);
+        uint32_t seen = atomic_load32(&r->prod_tail, ATOMIC_ACQUIRE);
+        if (seen == r->cons_tail) wait_on_address(&r->prod_tail, seen, 0);
+        atomic_store32(&r->cons_waiting, 0, ATOMIC_RELAXED);
+    }
+    return count;
+}
+
+#ifdef KOS_BENCH
+// make BENCH=1: N producers on their own CPUs feed one consumer on CPU 0.
+// Each object encodes (producer, sequence) so the consumer also checks
+// per-producer FIFO order.
+#define RING_BENCH_SIZE     1024
+#define RING_BENCH_ITEMS    (1u << 20)  // Per producer
+#define RING_BENCH_BATCH    32
+
+static struct ring bench_ring;
+static void* bench_slots[RING_BENCH_SIZE];
+static volatile uint32_t bench_start = 0;
+static volatile uint32_t bench_done = 0;
+static volatile uint32_t bench_abort = 0;     // Set with bench_start when a spawn failed
+static uint32_t bench_producers = 0;
+static uint64_t bench_errors = 0;
+
+static void __attribute__((noreturn)) bench_exit(void) {
+    atomic_fetch_add32(&bench_done, 1, ATOMIC_RELEASE);
+    wake_address(&bench_done, 1);
+    kthread_exit();
+}
+
+// Spin until released; false when the run was called off
+static bool bench_wait_start(void) {
+    while (!atomic_load32(&bench_start, ATOMIC_ACQUIRE)) pause();
+    return !bench_abort;
+}
+
+static void bench_producer(void* arg) {
+    uint64_t id = (uint64_t)arg;
+    void* batch[RING_BENCH_BATCH];
+    if (!bench_wait_start()) bench_exit();
+
+    for (uint32_t seq = 0; seq < RING_BENCH_ITEMS; ) {
+        uint32_t n = 0;
+        while (n < RING_BENCH_BATCH && seq + n < RING_BENCH_ITEMS) {
+            batch[n] = (void*)((id << 32) | (seq + n + 1));
+            n++;
+        }
+        for (uint32_t i = 0; i < n; ) {
+            uint32_t done = ring_enqueue_burst(&bench_ring, batch + i, n - i);
+            if (!done) pause();
+            i += done;
+        }
+        seq += n;
+    }
+    bench_exit();
+}
+
+static void bench_consumer(void* arg) {
+    (void)arg;
+    uint32_t last[MAX_CPUS] = { 0 };
+    void* batch[RING_BENCH_BATCH];
+    uint64_t left = (uint64_t)bench_producers * RING_BENCH_ITEMS;
+    if (!bench_wait_start()) bench_exit();
+
+    while (left) {
+        uint32_t n = ring_dequeue_burst(&bench_ring, batch, RING_BENCH_BATCH);
+        if (!n) {
+            pause();
+            continue;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t v = (uint64_t)batch[i];
+            uint32_t id = v >> 32;
+            if (id >= MAX_CPUS || (uint32_t)v != last[id] + 1) bench_errors++;
+            else last[id] = (uint32_t)v;
+        }
+        left -= n;
+    }
+    bench_exit();
+}
+
+static struct thread* bench_spawn(void (*fn)(void*), uint64_t arg, uint32_t cpu) {
+    struct thread* t = kthread_create(fn, (void*)arg);
+    if (t) sched_set_affinity(t, 1ULL << cpu);
+    return t;
+}
+
+static void ring_bench_run(uint32_t producers, uint32_t flags) {
+    uint32_t cpus = smp_get_cpu_count();
+    ring_init(&bench_ring, bench_slots, RING_BENCH_SIZE, flags);
+    bench_start = 0;
+    bench_done = 0;
+    bench_abort = 0;
+    bench_errors = 0;
+    bench_producers = producers;
+
+    uint32_t threads = 0;
+    if (bench_spawn(bench_consumer, 0, 0)) threads++;
+    for (uint32_t i = 0; i < producers; i++) {
+        if (bench_spawn(bench_producer, i, (i + 1) % cpus)) threads++;
+    }
+    // Threads that did start are spinning on pinned CPUs: release them
+    // either way, and wait for all of them before the globals are reused
+    bool failed = threads != producers + 1;
+    bench_abort = failed;
+
+    uint64_t t0 = ktime_ns();
+    atomic_store32(&bench_start, 1, ATOMIC_RELEASE);
+    uint32_t done;
+    while ((done = atomic_load32(&bench_done, ATOMIC_ACQUIRE)) < threads) {
+        wait_on_address(&bench_done, done, 0);
+    }
+    uint64_t ns = ktime_ns() - t0;
+    if (failed) {
+        kprintf("Ring bench: could not start %u threads\n", producers + 1);
+        return;
+    }
+
+    uint64_t ops = (uint64_t)producers * RING_BENCH_ITEMS;
+    kprintf("Ring bench: %s %u -> 1: %lu Kops/s, %lu ns/op, %lu order errors\n",
+        (flags & RING_SP) ? "SPSC" : "MPSC", producers,
+        ns ? ops * 1000000 / ns : 0, ns / ops, bench_errors);
+}
+
+static void ring_bench_main(void* arg) {
+    (void)arg;
+    uint32_t cpus = smp_get_cpu_count();
+    kprintf("Ring bench: %u slots, batch %u, %u items per producer\n",
+        RING_BENCH_SIZE, RING_BENCH_BATCH, RING_BENCH_ITEMS);
+    ring_bench_run(1, RING_SP);
+    for (uint32_t p = 1; p < (cpus > 1 ? cpus : 2); p++) {
+        ring_bench_run(p, 0);
+    }
+    kthread_exit();
+}
+
+// Runs in its own thread; the caller does not wait
+void ring_bench(void) {
+    kthread_create(ring_bench_main, NULL);
+}
+#endif
@@ -5,130 +5,600 @@
 #define MIN_GRANULARITY     2
 #define NICE_0_LOAD         1024
 
-#define TASK_RUNNING        0
-#define TASK_SLEEPING       1
-#define TASK_BLOCKED        2
-
-struct sched_entity {
-    uint64_t vruntime;
-    uint64_t exec_start;
-    uint64_t sum_exec;
+// Wake-up latency histogram: bucket N counts delays of [2^N, 2^(N+1)) cycles
+#define SCHED_LAT_BUCKETS   40
+#define SCHED_TRACE_SIZE    256     // Per-CPU switch trace ring, power of two
+
+// Note: struct thread, struct process and struct sched_entity defined in kernel.h
+
+struct sched_event {
+    uint64_t tsc;
+    uint32_t prev_tid;
+    uint32_t next_tid;
+    uint32_t prev_state;
+    bool preempted;
+    uint64_t wait;              // Wake-up to run delay of next, cycles
 };
 
-// Note: struct thread and struct process defined in kernel.h
+struct sched_stats {
+    uint64_t switches;
+    uint64_t voluntary;
+    uint64_t involuntary;
+    uint64_t busy_tsc;
+    uint64_t idle_tsc;
+    uint64_t clock;             // rdtsc() of the last busy/idle accounting
+    uint64_t lat_hist[SCHED_LAT_BUCKETS];
+    uint64_t lat_max;
+    uint64_t lat_count;
+    struct sched_event trace[SCHED_TRACE_SIZE];
+    uint32_t trace_head;
+};
 
-struct runqueue {
+struct thread_list {
     struct thread* head;
     struct thread* tail;
-    uint32_t nr_running;
+};
+
+struct runqueue {
+    struct thread_list cfs;
+    uint32_t nr_running;        // Queued threads, CFS + RT
     uint64_t min_vruntime;
+    struct thread_list rt[SCHED_RT_PRIO_MAX];
+    uint32_t rt_bitmap;         // Bit p set: rt[p] is non-empty
+    uint32_t rt_nr_running;
+    struct thread* idle;
+    bool booting;               // idle is still kernel_main(): charge it as busy
+    struct thread* last;        // Thread we just switched away from
+    struct thread* zombie;      // Exited thread whose stack we are off of now
+    struct thread* migrating;   // Was running here when its mask dropped this CPU
+    volatile bool need_resched;
+    // RT wake-up to run latency, TSC cycles
+    uint64_t rt_lat_max;
+    uint64_t rt_lat_sum;
+    uint64_t rt_lat_count;
+    struct sched_stats stats;
     spinlock_t lock;
 };
 
 static struct runqueue runqueues[MAX_CPUS];
+static volatile uint64_t sched_ticks = 0;     // Advanced by the BSP tick
+static struct thread* all_threads = NULL;
+static spinlock_t all_threads_lock;
 static uint32_t next_tid = 1;
 static uint32_t next_pid = 1;
 
+extern void kthread_start(void);
+
+static inline uint32_t rq_cpu(struct runqueue* rq) {
+    return (uint32_t)(rq - runqueues);
+}
+
+static inline struct thread* current_thread(void) {
+    return (struct thread*)this_cpu_read(current_thread);
+}
+
+static void list_push(struct thread_list* l, struct thread* t) {
+    t->next = NULL;
+    t->prev = l->tail;
+    if (l->tail) l->tail->next = t;
+    else l->head = t;
+    l->tail = t;
+}
+
+static void list_remove(struct thread_list* l, struct thread* t) {
+    if (t->prev) t->prev->next = t->next;
+    else l->head = t->next;
+    if (t->next) t->next->prev = t->prev;
+    else l->tail = t->prev;
+    t->next = t->prev = NULL;
+}
+
+static void thread_track(struct thread* t) {
+    uint64_t flags = spin_lock_irqsave(&all_threads_lock);
+    t->all_next = all_threads;
+    all_threads = t;
+    spin_unlock_irqrestore(&all_threads_lock, flags);
+}
+
+static void thread_untrack(struct thread* t) {
+    spin_lock(&all_threads_lock);
+    for (struct thread** pp = &all_threads; *pp; pp = &(*pp)->all_next) {
+        if (*pp == t) {
+            *pp = t->all_next;
+            break;
+        }
+    }
+    spin_unlock(&all_threads_lock);
+}
+
+// Charge prev for its time on the CPU, record the switch in the trace ring.
+// Called with rq->lock held and interrupts off.
+static void sched_account(struct runqueue* rq, struct thread* prev,
+                          struct thread* next, bool preempted, uint64_t now) {
+    struct sched_stats* st = &rq->stats;
+    uint64_t delta = st->clock ? now - st->clock : 0;
+    
+    if (prev == rq->idle && !rq->booting) {
+        st->idle_tsc += delta;
+    } else {
+        st->busy_tsc += delta;
+    }
+    st->clock = now;
+    
+    if (prev->se.exec_start) {
+        uint64_t ran = now - prev->se.exec_start;
+        prev->se.sum_exec += ran;
+        prev->se.vruntime += ran;
+        prev->vruntime = prev->se.vruntime;
+    }
+    next->se.exec_start = now;
+    
+    st->switches++;
+    if (preempted && prev->state == TASK_RUNNING) {
+        st->involuntary++;
+        prev->nivcsw++;
+    } else {
+        st->voluntary++;
+        prev->nvcsw++;
+    }
+    
+    uint64_t wait = 0;
+    if (next->wake_tsc) {
+        wait = now - next->wake_tsc;
+        uint32_t bucket = wait ? 63 - __builtin_clzll(wait) : 0;
+        if (bucket >= SCHED_LAT_BUCKETS) bucket = SCHED_LAT_BUCKETS - 1;
+        st->lat_hist[bucket]++;
+        st->lat_count++;
+        if (wait > st->lat_max) st->lat_max = wait;
+    }
+    
+    struct sched_event* ev = &st->trace[st->trace_head++ & (SCHED_TRACE_SIZE - 1)];
+    ev->tsc = now;
+    ev->prev_tid = prev->tid;
+    ev->next_tid = next->tid;
+    ev->prev_state = prev->state;
+    ev->preempted = preempted;
+    ev->wait = wait;
+}
+
+// The calling context becomes this CPU's idle thread. It keeps the stack
+// it is running on, so it needs no kstack. On the BSP that context is
+// still kernel_main(): the rest of boot only runs when nothing else on
+// CPU0 is runnable, and is charged as busy until sched_boot_done().
+static void sched_init_idle(void) {
+    struct runqueue* rq = this_cpu_read(runqueue);
+    struct thread* idle = (struct thread*)kzalloc(sizeof(struct thread));
+    if (!idle) kernel_panic("Scheduler: Failed to allocate idle thread");
+    
+    idle->tid = 0;
+    idle->state = TASK_RUNNING;
+    idle->prio = SCHED_PRIO_NORMAL;
+    idle->policy = SCHED_NORMAL;
+    idle->cpu = this_cpu_read(id);
+    idle->cpu_mask = 1ULL << idle->cpu;
+    idle->on_cpu = true;
+    idle->se.exec_start = rdtsc();
+    
+    rq->idle = idle;
+    rq->stats.clock = idle->se.exec_start;
+    thread_track(idle);
+    this_cpu_write(current_thread, (uint64_t)idle);
+}
+
 void scheduler_init(void) {
     for (int i = 0; i < MAX_CPUS; i++) {
+        memset(&runqueues[i], 0, sizeof(struct runqueue));
         spin_init(&runqueues[i].lock);
-        runqueues[i].head = NULL;
-        runqueues[i].tail = NULL;
-        runqueues[i].nr_running = 0;
-        runqueues[i].min_vruntime = 0;
+        LOCK_STAT_NAME(&runqueues[i].lock, "runqueue");
+        cpu_get(i)->runqueue = &runqueues[i];
     }
-    kprintf("Scheduler: CFS initialized\n");
+    spin_init(&all_threads_lock);
+    runqueues[this_cpu_read(id)].booting = true;
+    sched_init_idle();
+    lapic_timer_set_handler(scheduler_tick);
+    lapic_timer_start_periodic(SCHED_TICK_MS);
+    kprintf("Scheduler: CFS + FIFO/RR (%u RT levels) initialized\n", SCHED_RT_PRIO_MAX);
 }
 
 static void enqueue(struct runqueue* rq, struct thread* t) {
     t->state = TASK_RUNNING;
-    if (!rq->head) {
-        rq->head = rq->tail = t;
-        t->next = NULL;
+    t->on_rq = true;
+    t->cpu = rq_cpu(rq);
+    if (t->policy != SCHED_NORMAL) {
+        list_push(&rq->rt[t->prio], t);
+        rq->rt_bitmap |= 1U << t->prio;
+        rq->rt_nr_running++;
     } else {
         // Simple: add to tail (real CFS uses rbtree)
-        rq->tail->next = t;
-        rq->tail = t;
-        t->next = NULL;
+        list_push(&rq->cfs, t);
     }
     rq->nr_running++;
 }
 
-static struct thread* dequeue(struct runqueue* rq) {
-    if (!rq->head) return NULL;
+static void dequeue(struct runqueue* rq, struct thread* t) {
+    if (t->policy != SCHED_NORMAL) {
+        list_remove(&rq->rt[t->prio], t);
+        if (!rq->rt[t->prio].head) rq->rt_bitmap &= ~(1U << t->prio);
+        rq->rt_nr_running--;
+    } else {
+        list_remove(&rq->cfs, t);
+    }
+    rq->nr_running--;
+    t->on_rq = false;
+}
+
+// RT classes first (highest priority level wins), then CFS
+static struct thread* pick_next(struct runqueue* rq) {
+    struct thread* t;
+    if (rq->rt_bitmap) {
+        t = rq->rt[31 - __builtin_clz(rq->rt_bitmap)].head;
+    } else {
+        t = rq->cfs.head;
+    }
+    if (t) dequeue(rq, t);
+    return t;
+}
+
+// Would t take the CPU away from whatever rq is running right now?
+static bool should_preempt(struct runqueue* rq, struct thread* t) {
+    struct thread* curr = (struct thread*)cpu_get(rq_cpu(rq))->current_thread;
+    if (!curr || curr == rq->idle) return true;
+    if (t->policy == SCHED_NORMAL) return false;
+    if (curr->policy == SCHED_NORMAL) return true;
+    return t->prio > curr->prio;
+}
+
+static void resched_cpu(uint32_t cpu) {
+    runqueues[cpu].need_resched = true;
+    if (cpu == this_cpu_read(id)) {
+        lapic_send_self_ipi(IPI_VECTOR_RESCHEDULE);
+    } else {
+        lapic_send_ipi(cpu_get(cpu)->apic_id, IPI_VECTOR_RESCHEDULE);
+    }
+}
+
+// Prefer the CPU the thread last ran on while it is idle (cache-hot),
+// otherwise the least loaded CPU allowed by the affinity mask.
+static uint32_t select_cpu(struct thread* t) {
+    uint32_t best = MAX_CPUS;
+    uint32_t best_load = 0xFFFFFFFF;
     
-    struct thread* t = rq->head;
-    rq->head = t->next;
+    if ((t->cpu_mask & (1ULL << t->cpu)) && cpu_get(t->cpu)->online &&
+        runqueues[t->cpu].nr_running == 0) {
+        return t->cpu;
+    }
     
-    if (!rq->head) rq->tail = NULL;
-    rq->nr_running--;
-    t->next = NULL;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (!(t->cpu_mask & (1ULL << i)) || !cpu_get(i)->online) continue;
+        uint32_t load = runqueues[i].nr_running;
+        if (t->policy != SCHED_NORMAL) load = runqueues[i].rt_nr_running;
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+        }
+    }
+    
+    // Mask names no online CPU: keep it runnable on the boot CPU
+    return (best < MAX_CPUS) ? best : 0;
+}
+
+// Idle balancing: pull one CFS thread that may run here from the busiest CPU.
+// RT threads are placed at wake-up and are not pulled.
+static struct thread* pull_thread(uint32_t this_cpu) {
+    struct runqueue* busiest = NULL;
+    uint32_t max_load = 0;
+    
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (i == this_cpu || !cpu_get(i)->online) continue;
+        uint32_t load = runqueues[i].nr_running - runqueues[i].rt_nr_running;
+        if (load > max_load) {
+            busiest = &runqueues[i];
+            max_load = load;
+        }
+    }
+    
+    if (!busiest || !spin_trylock(&busiest->lock)) return NULL;
     
+    struct thread* t;
+    for (t = busiest->cfs.head; t; t = t->next) {
+        if (t->cpu_mask & (1ULL << this_cpu)) {
+            dequeue(busiest, t);
+            break;
+        }
+    }
+    
+    spin_unlock(&busiest->lock);
     return t;
 }
 
-void schedule(void) {
-    struct cpu* c = cpu_get_current();
-    struct runqueue* rq = &runqueues[c->acpi_id];
-    struct thread* prev = (struct thread*)c->current_thread;
+// Runs on the new thread right after context_switch, off the old stack
+static void finish_switch(void) {
+    struct runqueue* rq = this_cpu_read(runqueue);
+    struct thread* prev = rq->last;
+    struct thread* dead = NULL;
+    struct thread* migrating = rq->migrating;
+    
+    rq->last = NULL;
+    rq->migrating = NULL;
+    if (prev) prev->on_cpu = false;
+    if (rq->zombie && rq->zombie == prev) {
+        dead = rq->zombie;
+        rq->zombie = NULL;
+    }
+    
+    spin_unlock(&rq->lock);
+    
+    if (dead) {
+        thread_untrack(dead);
+        kstack_free(dead->kernel_stack);
+        kfree(dead);
+    }
+    if (migrating) {
+        migrating->state = TASK_SLEEPING;
+        sched_wake(migrating);
+    }
+}
+
+// First code a new thread runs (called from kthread_start)
+void schedule_tail(void) {
+    finish_switch();
+    sti();
+}
+
+static void __schedule(bool preempted) {
+    struct runqueue* rq = this_cpu_read(runqueue);
+    if (!rq) return;
     
+    uint64_t flags = local_irq_save();
+    uint32_t cpu = this_cpu_read(id);
+    struct thread* prev = current_thread();
+    
+    rcu_note_context_switch();
     spin_lock(&rq->lock);
+    rq->need_resched = false;
     
-    if (prev && prev->state == TASK_RUNNING) {
-        enqueue(rq, prev);
+    if (prev && prev != rq->idle) {
+        if (prev->state == TASK_RUNNING) {
+            if (prev->cpu_mask & (1ULL << cpu)) {
+                enqueue(rq, prev);
+            } else {
+                rq->migrating = prev;
+            }
+        } else if (prev->state == TASK_DEAD) {
+            rq->zombie = prev;
+        }
     }
     
-    struct thread* next = dequeue(rq);
+    struct thread* next = pick_next(rq);
+    if (!next) next = pull_thread(cpu);
+    if (!next) next = rq->idle;
     
-    if (!next) {
-        // Idle - no runnable threads
+    if (!next || next == prev) {
+        if (next) next->on_rq = false;
         spin_unlock(&rq->lock);
+        local_irq_restore(flags);
         return;
     }
     
-    c->current_thread = (uint64_t)next;
+    uint64_t now = rdtsc();
+    sched_account(rq, prev, next, preempted, now);
+    
+    next->cpu = cpu;
+    if (next->wake_tsc) {
+        if (next->policy != SCHED_NORMAL) {
+            uint64_t lat = now - next->wake_tsc;
+            if (lat > rq->rt_lat_max) rq->rt_lat_max = lat;
+            rq->rt_lat_sum += lat;
+            rq->rt_lat_count++;
+        }
+        next->wake_tsc = 0;
+    }
+    if (next->policy == SCHED_RR && next->rr_ticks == 0) {
+        next->rr_ticks = SCHED_RR_TIMESLICE;
+    }
+    
+    this_cpu_write(current_thread, (uint64_t)next);
+    this_cpu_inc(context_switches);
+    if (next->kernel_stack) this_cpu_write(tss.rsp[0], next->kernel_stack);
+    
+    next->on_cpu = true;
+    rq->last = prev;
+    context_switch(&prev->rsp, next->rsp,
+                  next->parent ? next->parent->cr3 : read_cr3());
+    
+    finish_switch();
+    local_irq_restore(flags);
+}
+
+void schedule(void) {
+    __schedule(false);
+}
+
+// kernel_main() is done: from here on the BSP's idle thread is idle
+void sched_boot_done(void) {
+    struct runqueue* rq = this_cpu_read(runqueue);
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    uint64_t now = rdtsc();
+    rq->stats.busy_tsc += now - rq->stats.clock;
+    rq->stats.clock = now;
+    rq->booting = false;
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+// Timer tick: RR timeslice accounting and CFS round-robin
+void scheduler_tick(void) {
+    struct runqueue* rq = this_cpu_read(runqueue);
+    struct thread* curr = current_thread();
+    if (!rq || !curr) return;
+    
+    if (this_cpu_read(bsp)) {
+        sched_ticks++;
+        futex_tick();
+        network_tick();
+    }
+    rcu_tick();
+    
+    if (curr->policy == SCHED_RR) {
+        if (curr->rr_ticks) curr->rr_ticks--;
+        if (curr->rr_ticks == 0 && rq->rt[curr->prio].head) {
+            rq->need_resched = true;
+        }
+    } else if (curr->policy == SCHED_NORMAL && rq->nr_running) {
+        rq->need_resched = true;
+    }
+    // SCHED_FIFO runs until it blocks, yields or is preempted by higher RT
     
-    if (prev && prev != next) {
-        tss_set_rsp0(next->kernel_stack);
-        context_switch(prev ? &prev->rsp : NULL, next->rsp,
-                      next->parent ? next->parent->cr3 : read_cr3());
+    sched_preempt();
+}
+
+// Reschedule IPI: a wake-up on another CPU decided we must preempt
+void sched_ipi(void) {
+    sched_preempt();
+}
+
+// Preempt from interrupt context if a reschedule is pending. Softirqs and
+// RCU read sections are non-preemptible: need_resched stays set and the
+// next tick or irq_exit() retries.
+void sched_preempt(void) {
+    struct runqueue* rq = this_cpu_read(runqueue);
+    if (!rq || !rq->need_resched) return;
+    if (this_cpu_read(softirq_active) || this_cpu_read(preempt_count)) return;
+    __schedule(true);
+}
+
+// Make a blocked/sleeping/new thread runnable on a CPU its mask allows
+void sched_wake(struct thread* t) {
+    uint32_t old = t->state;
+    if (old != TASK_BLOCKED && old != TASK_SLEEPING) return;
+    if (!atomic_cmpxchg32(&t->state, &old, TASK_WAKING, ATOMIC_ACQ_REL)) return;
+    
+    uint64_t flags = local_irq_save();
+    if (t->on_cpu) {
+        if (t == current_thread()) {
+            // Interrupt woke the thread before it reached schedule()
+            t->state = TASK_RUNNING;
+            local_irq_restore(flags);
+            return;
+        }
+        while (t->on_cpu) pause();
     }
     
+    // Stamp only threads that get queued: __schedule() clears it when it
+    // picks them, which never happens for the early return above
+    t->wake_tsc = rdtsc();
+    uint32_t cpu = select_cpu(t);
+    struct runqueue* rq = &runqueues[cpu];
+    
+    spin_lock(&rq->lock);
+    enqueue(rq, t);
+    bool preempt = should_preempt(rq, t);
     spin_unlock(&rq->lock);
+    
+    if (preempt) resched_cpu(cpu);
+    local_irq_restore(flags);
+}
+
+int sched_set_affinity(struct thread* t, uint64_t mask) {
+    mask &= CPU_MASK_ALL;
+    if (!t || !mask) return -1;
+    
+    uint64_t flags = local_irq_save();
+    struct runqueue* rq;
+    while (1) {
+        rq = &runqueues[t->cpu];
+        spin_lock(&rq->lock);
+        if (rq == &runqueues[t->cpu]) break;
+        spin_unlock(&rq->lock);
+    }
+    
+    t->cpu_mask = mask;
+    bool requeue = false;
+    bool kick = false;
+    if (!(mask & (1ULL << t->cpu))) {
+        if (t->on_rq) {
+            dequeue(rq, t);
+            t->state = TASK_SLEEPING;
+            requeue = true;
+        } else if (t->on_cpu) {
+            kick = true;    // schedule() hands it to finish_switch for migration
+        }
+    }
+    
+    spin_unlock(&rq->lock);
+    
+    if (requeue) sched_wake(t);
+    if (kick) resched_cpu(rq_cpu(rq));
+    local_irq_restore(flags);
+    return 0;
+}
+
+int sched_setscheduler(struct thread* t, uint8_t policy, uint32_t prio) {
+    if (!t) return -1;
+    if (policy == SCHED_NORMAL) {
+        prio = SCHED_PRIO_NORMAL;
+    } else if ((policy != SCHED_FIFO && policy != SCHED_RR) || prio >= SCHED_RT_PRIO_MAX) {
+        return -1;
+    }
+    
+    uint64_t flags = local_irq_save();
+    struct runqueue* rq;
+    while (1) {
+        rq = &runqueues[t->cpu];
+        spin_lock(&rq->lock);
+        if (rq == &runqueues[t->cpu]) break;
+        spin_unlock(&rq->lock);
+    }
+    
+    bool queued = t->on_rq;
+    if (queued) dequeue(rq, t);
+    t->policy = policy;
+    t->prio = prio;
+    t->rr_ticks = SCHED_RR_TIMESLICE;
+    bool preempt = false;
+    if (queued) {
+        enqueue(rq, t);
+        preempt = should_preempt(rq, t);
+    }
+    
+    spin_unlock(&rq->lock);
+    
+    if (preempt) resched_cpu(rq_cpu(rq));
+    local_irq_restore(flags);
+    return 0;
+}
+
+// Wake-up to run latency of SCHED_FIFO/RR threads, per CPU
+void sched_dump_rt_latency(void) {
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        struct runqueue* rq = &runqueues[i];
+        if (!cpu_get(i)->online || rq->rt_lat_count == 0) continue;
+        kprintf("Scheduler: CPU%u RT wakeups %lu, latency avg %lu max %lu cycles\n",
+            i, rq->rt_lat_count, rq->rt_lat_sum / rq->rt_lat_count, rq->rt_lat_max);
+    }
 }
 
 void yield(void) {
     schedule();
 }
 
+uint64_t sched_get_ticks(void) {
+    return sched_ticks;
+}
+
 void sleep(uint64_t ms) {
-    // Simple sleep - just yield for now
-    // Real implementation would use timer interrupts
-    (void)ms;
-    yield();
+    // Nobody ever wakes this address: the futex timeout does
+    uint32_t never = 0;
+    if (ms) wait_on_address(&never, 0, ms);
+    else yield();
 }
 
 void scheduler_ap_entry(void) {
-    struct cpu* c = cpu_get_current();
-    
-    // Create idle thread
-    struct thread* idle = (struct thread*)kmalloc(sizeof(struct thread));
-    if (!idle) {
-        while (1) hlt();
-    }
-    
-    memset(idle, 0, sizeof(struct thread));
-    idle->tid = 0;
-    idle->state = TASK_RUNNING;
-    idle->kernel_stack = (uint64_t)pmm_alloc_pages(4) + 0x10000;
-    idle->rsp = idle->kernel_stack;
-    idle->parent = NULL;
-    
-    c->current_thread = (uint64_t)idle;
+    sched_init_idle();
     
     // Setup timer
-    lapic_timer_set_handler(schedule);
-    lapic_timer_start_periodic(10); // 10ms ticks
+    lapic_timer_set_handler(scheduler_tick);
+    lapic_timer_start_periodic(SCHED_TICK_MS);
+    sti();      // APs arrive from the trampoline with interrupts off
     
     while (1) {
         schedule();
@@ -136,6 +606,41 @@ void scheduler_ap_entry(void) {
     }
 }
 
+static struct thread* thread_alloc(void (*fn)(void*), void* arg) {
+    struct thread* t = (struct thread*)kzalloc(sizeof(struct thread));
+    if (!t) return NULL;
+    
+    // Stack is a pointer pop from the per-CPU pool
+    t->kernel_stack = kstack_alloc();
+    if (!t->kernel_stack) {
+        kfree(t);
+        return NULL;
+    }
+    
+    t->tid = atomic_fetch_add32(&next_tid, 1, ATOMIC_RELAXED);
+    t->state = TASK_SLEEPING;   // Not runnable until sched_wake()
+    t->prio = SCHED_PRIO_NORMAL;
+    t->policy = SCHED_NORMAL;
+    t->cpu = this_cpu_read(id);
+    t->cpu_mask = CPU_MASK_ALL;
+    thread_track(t);
+    
+    // fn/arg ride in callee-saved registers; kthread_start
+    // (context_switch.asm) finishes the switch and calls fn(arg)
+    uint64_t* sp = (uint64_t*)t->kernel_stack;
+    *(--sp) = 0;                    // Alignment / fake return address
+    *(--sp) = (uint64_t)kthread_start;
+    *(--sp) = 0;                    // RBX
+    *(--sp) = 0;                    // RBP
+    *(--sp) = (uint64_t)fn;         // R12
+    *(--sp) = (uint64_t)arg;        // R13
+    *(--sp) = 0;                    // R14
+    *(--sp) = 0;                    // R15
+    t->rsp = (uint64_t)sp;
+    
+    return t;
+}
+
 struct process* process_create(const char* name, void* entry) {
     struct process* p = (struct process*)kzalloc(sizeof(struct process));
     if (!p) return NULL;
@@ -146,41 +651,87 @@ struct process* process_create(const char* name, void* entry) {
     
     p->cr3 = vmm_create_address_space();
     
-    struct thread* t = (struct thread*)kzalloc(sizeof(struct thread));
+    struct thread* t = thread_alloc((void (*)(void*))entry, NULL);
     if (!t) {
         kfree(p);
         return NULL;
     }
-    
-    t->tid = next_tid++;
-    t->state = TASK_RUNNING;
-    t->prio = 128;
     t->parent = p;
-    t->kernel_stack = (uint64_t)pmm_alloc_pages(4) + 0x10000;
-    t->rsp = t->kernel_stack - 8;
-    
-    // Setup initial stack frame for return to entry point
-    uint64_t* sp = (uint64_t*)t->rsp;
-    *(--sp) = 0;           // Return address (will halt)
-    *(--sp) = (uint64_t)entry;  // Entry point
-    *(--sp) = 0;           // RBP
-    *(--sp) = 0;           // RBX
-    *(--sp) = 0;           // R12
-    *(--sp) = 0;           // R13
-    *(--sp) = 0;           // R14
-    *(--sp) = 0;           // R15
-    t->rsp = (uint64_t)sp;
     
     p->main_thread = *t;
     
-    // Enqueue on BSP (CPU 0)
-    enqueue(&runqueues[0], t);
+    sched_wake(t);
     
     kprintf("Process: %s (PID %u)\n", name, p->pid);
     
     return p;
 }
 
+// Per-CPU switch rates, utilization and wake-up latency histogram,
+// then CPU time of every thread
+void sched_dump_stats(void) {
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        struct sched_stats* st = &runqueues[i].stats;
+        if (!cpu_get(i)->online) continue;
+        
+        uint64_t total = st->busy_tsc + st->idle_tsc;
+        kprintf("Scheduler: CPU%u switches %lu (vol %lu, invol %lu), busy %lu%%, queued %u\n",
+            i, st->switches, st->voluntary, st->involuntary,
+            total ? st->busy_tsc * 100 / total : 0, runqueues[i].nr_running);
+        if (st->lat_count == 0) continue;
+        
+        kprintf("  wakeup latency: %lu samples, max %lu cycles\n", st->lat_count, st->lat_max);
+        for (uint32_t b = 0; b < SCHED_LAT_BUCKETS; b++) {
+            if (st->lat_hist[b]) {
+                kprintf("    < 2^%u cycles: %lu\n", b + 1, st->lat_hist[b]);
+            }
+        }
+    }
+    
+    uint64_t flags = local_irq_save();
+    spin_lock(&all_threads_lock);
+    for (struct thread* t = all_threads; t; t = t->all_next) {
+        kprintf("  tid %u cpu %u policy %u prio %u: %lu cycles, vol %lu invol %lu\n",
+            t->tid, t->cpu, t->policy, t->prio, t->se.sum_exec, t->nvcsw, t->nivcsw);
+    }
+    spin_unlock(&all_threads_lock);
+    local_irq_restore(flags);
+    
+    sched_dump_rt_latency();
+}
+
+// Most recent context switches on one CPU, oldest first
+void sched_trace_dump(uint32_t cpu) {
+    if (cpu >= MAX_CPUS) return;
+    struct sched_stats* st = &runqueues[cpu].stats;
+    uint32_t head = st->trace_head;
+    uint32_t n = head < SCHED_TRACE_SIZE ? head : SCHED_TRACE_SIZE;
+    
+    kprintf("Scheduler: CPU%u last %u switches\n", cpu, n);
+    for (uint32_t i = head - n; i != head; i++) {
+        struct sched_event* ev = &st->trace[i & (SCHED_TRACE_SIZE - 1)];
+        kprintf("  %lu: %u -> %u%s state %u wait %lu\n",
+            ev->tsc, ev->prev_tid, ev->next_tid,
+            ev->preempted ? " (preempt)" : "", ev->prev_state, ev->wait);
+    }
+}
+
+struct thread* kthread_create(void (*fn)(void*), void* arg) {
+    struct thread* t = thread_alloc(fn, arg);
+    if (t) sched_wake(t);
+    return t;
+}
+
+void kthread_exit(void) {
+    struct thread* self = current_thread();
+    if (self) self->state = TASK_DEAD;
+    
+    while (1) {
+        schedule();
+        hlt();
+    }
+}
+
 void context_switch(uint64_t* old_rsp, uint64_t new_rsp, uint64_t new_cr3) {
     if (old_rsp) {
         asm volatile ("mov %%rsp, %0" : "=r"(*old_rsp));
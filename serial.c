@@ -0,0 +1,173 @@
+// serial.c — COM1 16550 UART console backend, interrupt-driven output
+#include "kernel.h"
+
+// kprintf() mirrors everything to COM1 at 115200 8N1 so a headless run
+// (QEMU -serial, a null-modem cable) gets the full log. A port that does
+// not keep its scratch register is treated as absent.
+//
+// Writers never wait for the line: text goes into a TX ring and the
+// writer only tops up the 16-byte FIFO if it is already empty. Once
+// serial_irq_init() has routed IRQ 4, the THRE interrupt refills the FIFO
+// until the ring drains. Before that (early boot) the ring is drained
+// opportunistically by each write and holds whatever the line has not
+// caught up with yet. A full ring drops bytes and counts them.
+
+#define COM1                0x3F8
+#define COM1_IRQ            4
+#define UART_THR            0       // Transmit holding (DLAB=0)
+#define UART_DLL            0       // Divisor low (DLAB=1)
+#define UART_IER            1
+#define UART_DLM            1       // Divisor high (DLAB=1)
+#define UART_IIR            2       // Interrupt identification (read)
+#define UART_FCR            2       // FIFO control (write)
+#define UART_LCR            3
+#define UART_MCR            4
+#define UART_LSR            5
+#define UART_SCR            7
+
+#define LCR_8N1             0x03
+#define LCR_DLAB            0x80
+#define FCR_ENABLE_CLEAR    0x07    // Enable FIFOs, clear RX and TX
+#define MCR_DTR_RTS_OUT2    0x0B    // OUT2 gates the IRQ line on PCs
+#define LSR_THRE            0x20    // TX FIFO empty
+#define IER_THRI            0x02    // Interrupt when TX FIFO empties
+#define IIR_NO_INT          0x01
+
+#define UART_BAUD_DIVISOR   1       // 115200 / 1
+#define UART_FIFO_SIZE      16
+#define UART_TX_SPIN        100000  // A stuck port must not hang the kernel
+
+#define TX_RING_SIZE        16384   // Power of two; ~1.4 s of line time
+#define TX_RING_MASK        (TX_RING_SIZE - 1)
+
+static bool serial_present = false;
+static bool serial_irq_ready = false;
+
+// head and tail are free-running; the lock covers them, the UART and IER
+static spinlock_t tx_lock;
+static char tx_ring[TX_RING_SIZE];
+static uint32_t tx_head = 0;
+static uint32_t tx_tail = 0;
+static uint8_t ier_shadow = 0;
+static uint64_t tx_bytes = 0;
+static uint64_t tx_dropped = 0;
+
+// Move up to a FIFO's worth from the ring if the FIFO is empty. Caller
+// holds tx_lock.
+static void serial_fill_fifo(void) {
+    if (tx_tail == tx_head) return;
+    if (!(inb(COM1 + UART_LSR) & LSR_THRE)) return;
+    for (int i = 0; i < UART_FIFO_SIZE && tx_tail != tx_head; i++) {
+        outb(COM1 + UART_THR, (uint8_t)tx_ring[tx_tail++ & TX_RING_MASK]);
+        tx_bytes++;
+    }
+}
+
+// THRE interrupt only while there is something left to send: an enabled
+// THRE with an empty FIFO would fire continuously. Caller holds tx_lock.
+static void serial_update_ier(void) {
+    uint8_t ier = (serial_irq_ready && tx_tail != tx_head) ? IER_THRI : 0;
+    if (ier != ier_shadow) {
+        ier_shadow = ier;
+        outb(COM1 + UART_IER, ier);
+    }
+}
+
+static void serial_queue(char c) {
+    if (tx_head - tx_tail >= TX_RING_SIZE) {
+        tx_dropped++;
+        return;
+    }
+    tx_ring[tx_head++ & TX_RING_MASK] = c;
+}
+
+static void serial_write(const char* s, size_t n) {
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\n') serial_queue('\r');
+        serial_queue(s[i]);
+    }
+    serial_fill_fifo();
+    serial_update_ier();
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+// Panic path: interrupts are off and tx_lock may be held by this CPU or a
+// dead one, so everything below polls the UART without it
+static void serial_tx_polled(char c) {
+    for (uint32_t spin = 0; spin < UART_TX_SPIN; spin++) {
+        if (inb(COM1 + UART_LSR) & LSR_THRE) break;
+        pause();
+    }
+    outb(COM1 + UART_THR, (uint8_t)c);
+    tx_bytes++;
+}
+
+static void serial_flush(void) {
+    while (tx_tail != tx_head) serial_tx_polled(tx_ring[tx_tail++ & TX_RING_MASK]);
+}
+
+static void serial_panic_write(const char* s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\n') serial_tx_polled('\r');
+        serial_tx_polled(s[i]);
+    }
+}
+
+static struct console_backend serial_console = {
+    .name = "serial",
+    .write = serial_write,
+    .flush = serial_flush,
+    .panic_write = serial_panic_write,
+};
+
+static bool serial_irq(void* context) {
+    (void)context;
+    // Reading IIR also acknowledges a pending THRE interrupt
+    if (inb(COM1 + UART_IIR) & IIR_NO_INT) return false;
+    spin_lock(&tx_lock);
+    serial_fill_fifo();
+    serial_update_ier();
+    spin_unlock(&tx_lock);
+    return true;
+}
+
+void serial_init(void) {
+    outb(COM1 + UART_SCR, 0xA5);
+    if (inb(COM1 + UART_SCR) != 0xA5) return;
+
+    outb(COM1 + UART_IER, 0);
+    outb(COM1 + UART_LCR, LCR_DLAB);
+    outb(COM1 + UART_DLL, UART_BAUD_DIVISOR & 0xFF);
+    outb(COM1 + UART_DLM, UART_BAUD_DIVISOR >> 8);
+    outb(COM1 + UART_LCR, LCR_8N1);
+    outb(COM1 + UART_FCR, FCR_ENABLE_CLEAR);
+    outb(COM1 + UART_MCR, MCR_DTR_RTS_OUT2);
+    serial_present = true;
+    console_register(&serial_console);
+}
+
+// After the I/O APIC is up: hand the rest of the ring to the THRE interrupt
+void serial_irq_init(void) {
+    if (!serial_present) return;
+    LOCK_STAT_NAME(&tx_lock, "serial tx");
+    irq_register_handler(COM1_IRQ, serial_irq, NULL);
+    ioapic_set_irq(COM1_IRQ, IRQ_COM1, 0);
+    ioapic_unmask_irq(COM1_IRQ);
+
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    serial_irq_ready = true;
+    serial_fill_fifo();
+    serial_update_ier();
+    spin_unlock_irqrestore(&tx_lock, flags);
+    kprintf("Serial: COM1 output on IRQ %d, %d byte ring\n", COM1_IRQ, TX_RING_SIZE);
+}
+
+void serial_dump_stats(void) {
+    if (!serial_present) return;
+    uint64_t flags = spin_lock_irqsave(&tx_lock);
+    uint64_t sent = tx_bytes, dropped = tx_dropped;
+    uint32_t queued = tx_head - tx_tail;
+    spin_unlock_irqrestore(&tx_lock, flags);
+    kprintf("Serial: %lu bytes sent, %u queued, %lu dropped\n", sent, queued, dropped);
+}
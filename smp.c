@@ -0,0 +1,223 @@
+// smp.c — Per-CPU areas, AP bring-up and SMP bookkeeping
+#include "kernel.h"
+
+// smp_trampoline.asm, copied to AP_TRAMPOLINE_PHYS before the SIPI
+extern char ap_trampoline_start[];
+extern char ap_trampoline_end[];
+extern char ap_tr_cr3[];
+extern char ap_tr_entry[];
+extern char ap_tr_count[];
+extern char ap_tr_stacks[];
+
+static struct cpu cpus[MAX_CPUS];
+static volatile uint32_t num_cpus_online = 0;
+static uint32_t num_cpus_expected = 1;
+static uint64_t smp_start_tsc = 0;
+
+// Point IA32_GS_BASE at the per-CPU area. KERNEL_GS_BASE holds the user
+// GS base and is swapped in by swapgs on every ring 3 <-> ring 0 crossing.
+// Must run after cpu_init_gdt(): reloading GS clears the base.
+void cpu_init_percpu(struct cpu* c) {
+    c->self = c;
+    c->lapic_base = rdmsr(0x1B) & 0xFFFFF000;
+    wrmsr(MSR_GS_BASE, (uint64_t)c);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+// Each CPU gets its own GDT so it can hold a TSS of its own: ltr marks the
+// descriptor busy, and RSP0/IST differ per CPU anyway.
+void cpu_init_gdt(struct cpu* c) {
+    uint64_t base = (uint64_t)&c->tss;
+    uint64_t limit = sizeof(struct tss64) - 1;
+    
+    memset(&c->tss, 0, sizeof(c->tss));
+    c->tss.iomap_base = sizeof(struct tss64);   // No I/O permission bitmap
+    
+    c->gdt[0] = 0;
+    c->gdt[1] = 0x00AF9A000000FFFFULL;          // 0x08: Kernel code, 64-bit
+    c->gdt[2] = 0x00CF92000000FFFFULL;          // 0x10: Kernel data
+    c->gdt[3] = 0x00AFFA000000FFFFULL;          // 0x18: User code, 64-bit
+    c->gdt[4] = 0x00CFF2000000FFFFULL;          // 0x20: User data
+    c->gdt[5] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) |
+                (0x89ULL << 40) | (((limit >> 16) & 0xF) << 48) |
+                (((base >> 24) & 0xFF) << 56);  // 0x28: Available 64-bit TSS
+    c->gdt[6] = base >> 32;
+    
+    struct {
+        uint16_t limit;
+        uint64_t base;
+    } __attribute__((packed)) gdtr = { sizeof(c->gdt) - 1, (uint64_t)c->gdt };
+    
+    asm volatile (
+        "lgdt %0\n"
+        "pushq $0x08\n"
+        "leaq 1f(%%rip), %%rax\n"
+        "pushq %%rax\n"
+        "lretq\n"
+        "1:\n"
+        "movw $0x10, %%ax\n"
+        "movw %%ax, %%ds\n"
+        "movw %%ax, %%es\n"
+        "movw %%ax, %%ss\n"
+        "movw %1, %%ax\n"
+        "ltr %%ax\n"
+        : : "m"(gdtr), "i"(GDT_TSS_SELECTOR) : "rax", "memory");
+}
+
+// Point GS at the BSP's slot before the allocators' per-CPU counters are
+// touched; cpu_init_early() fills the slot in properly
+void cpu_init_boot(void) {
+    cpus[0].self = &cpus[0];
+    wrmsr(MSR_GS_BASE, (uint64_t)&cpus[0]);
+}
+
+void cpu_init_early(void) {
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        memset(&cpus[i], 0, sizeof(struct cpu));
+        cpus[i].self = &cpus[i];
+        cpus[i].id = i;
+    }
+
+    // CPUID works before the LAPIC is mapped
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+
+    struct cpu* c = &cpus[0];
+    c->apic_id = ebx >> 24;
+    c->acpi_id = 0;
+    c->bsp = true;
+    c->online = true;
+    cpu_init_gdt(c);
+    cpu_init_percpu(c);
+    num_cpus_online = 1;
+
+    kprintf("CPU: BSP per-CPU area at %p (APIC ID %u)\n", c, c->apic_id);
+}
+
+struct cpu* cpu_get(uint32_t idx) {
+    return (idx < MAX_CPUS) ? &cpus[idx] : NULL;
+}
+
+// Address of a trampoline variable in the low-memory copy
+static void* tr_field(char* sym) {
+    return (uint8_t*)PHYS_TO_VIRT(AP_TRAMPOLINE_PHYS) + (sym - ap_trampoline_start);
+}
+
+// Fill cpus[1..] from the MADT, skipping the BSP's own entry
+static uint32_t smp_enumerate(void) {
+    uint32_t n = 1;
+    uint32_t count = acpi_initialized() ? acpi_get_cpu_count() : 1;
+    
+    for (uint32_t i = 0; i < count && n < MAX_CPUS; i++) {
+        uint8_t apic_id = acpi_get_cpu_apic_id(i);
+        if (apic_id == cpus[0].apic_id) {
+            cpus[0].acpi_id = acpi_get_cpu_acpi_id(i);
+            continue;
+        }
+        cpus[n].apic_id = apic_id;
+        cpus[n].acpi_id = acpi_get_cpu_acpi_id(i);
+        n++;
+    }
+    return n;
+}
+
+// Start every AP at once: broadcast INIT-SIPI-SIPI, each AP picks its own
+// stack in the trampoline and finds its struct cpu by APIC ID in ap_main().
+void smp_init(void) {
+    uint32_t n = smp_enumerate();
+    if (n == 1) {
+        kprintf("SMP: %u CPU online (no APs in MADT)\n", num_cpus_online);
+        return;
+    }
+    
+    // Trampoline page tables: the kernel's, plus an identity view of low
+    // memory (the higher-half direct map's PML4 slot) for the mode switch
+    uint64_t* kpml4 = vmm_get_kernel_pml4();
+    uint64_t* low_pml4 = (uint64_t*)PHYS_TO_VIRT(AP_TRAMPOLINE_PML4);
+    memcpy(low_pml4, kpml4, PAGE_SIZE);
+    low_pml4[0] = kpml4[(KERNEL_HIGHER_HALF >> 39) & 0x1FF];
+    
+    memcpy(PHYS_TO_VIRT(AP_TRAMPOLINE_PHYS), ap_trampoline_start,
+           ap_trampoline_end - ap_trampoline_start);
+    *(uint64_t*)tr_field(ap_tr_cr3) = AP_TRAMPOLINE_PML4;
+    *(uint64_t*)tr_field(ap_tr_entry) = (uint64_t)ap_main;
+    *(uint32_t*)tr_field(ap_tr_count) = 0;
+    
+    uint64_t* stacks = (uint64_t*)tr_field(ap_tr_stacks);
+    for (uint32_t i = 0; i < n - 1; i++) {
+        stacks[i] = kstack_alloc();
+        if (!stacks[i]) kernel_panic("SMP: Failed to allocate AP stack");
+    }
+    
+    num_cpus_expected = n;
+    smp_start_tsc = rdtsc();
+    
+    lapic_broadcast_init();
+    mdelay(10);
+    lapic_broadcast_sipi(AP_TRAMPOLINE_PHYS >> 12);
+    udelay(200);
+    lapic_broadcast_sipi(AP_TRAMPOLINE_PHYS >> 12);
+    
+    // Give stragglers up to 100 ms, answering their TSC sync requests
+    uint64_t deadline = rdtsc() + clock_ns_to_cycles(100000000);
+    while (num_cpus_online < n && rdtsc() < deadline) {
+        clock_sync_service();
+        pause();
+    }
+    uint64_t total = rdtsc() - smp_start_tsc;
+    
+    for (uint32_t i = 1; i < n; i++) {
+        if (cpus[i].online) {
+            int64_t off = cpus[i].tsc_offset;
+            kprintf("SMP: CPU%u (APIC ID %u) up in %lu us, TSC offset %s%lu\n",
+                i, cpus[i].apic_id, clock_cycles_to_ns(cpus[i].boot_tsc) / 1000,
+                off < 0 ? "-" : "", off < 0 ? (uint64_t)-off : (uint64_t)off);
+        } else {
+            kprintf("SMP: CPU%u (APIC ID %u) did not start\n", i, cpus[i].apic_id);
+        }
+    }
+    kprintf("SMP: %u of %u CPUs online, bring-up took %lu us\n",
+        num_cpus_online, n, clock_cycles_to_ns(total) / 1000);
+}
+
+// First C code on an AP, still on the trampoline's page tables
+void ap_main(void) {
+    uint64_t arrived = rdtsc();
+    write_cr3(VIRT_TO_PHYS(vmm_get_kernel_pml4()));
+    
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    uint8_t apic_id = ebx >> 24;
+    
+    struct cpu* c = NULL;
+    for (uint32_t i = 1; i < num_cpus_expected; i++) {
+        if (cpus[i].apic_id == apic_id) {
+            c = &cpus[i];
+            break;
+        }
+    }
+    if (!c) {
+        while (1) {
+            cli();
+            hlt();
+        }
+    }
+    
+    cpu_init_gdt(c);
+    idt_load();
+    cpu_init_percpu(c);
+    fpu_init();
+    lapic_init_ap();
+    kstack_init_cpu();
+    
+    c->boot_tsc = arrived - smp_start_tsc;
+    clock_sync_ap(c);
+    c->online = true;
+    atomic_fetch_add32(&num_cpus_online, 1, ATOMIC_RELEASE);
+    
+    scheduler_ap_entry();
+}
+
+uint32_t smp_get_cpu_count(void) {
+    return num_cpus_online;
+}
@@ -1,6 +1,15 @@
 ; smp_trampoline.asm — SMP Trampoline Code для x86_64
 ; Код для запуска дополнительных процессоров (AP - Application Processors)
-; Этот код копируется в низкую память (ниже 1MB)
+; smp_init() копирует его на физический адрес AP_TRAMPOLINE_PHYS (0x8000):
+; все адреса считаются от этой базы, а не от адреса в образе ядра.
+; Все AP стартуют одновременно (широковещательный SIPI), поэтому стек
+; каждый берёт сам по атомарному счётчику.
+
+AP_TRAMPOLINE_PHYS  equ 0x8000          ; kernel.h: AP_TRAMPOLINE_PHYS
+AP_MAX_CPUS         equ 8               ; kernel.h: MAX_CPUS
+
+; Адрес метки в копии trampoline
+%define TR(x) ((x) - ap_trampoline_start + AP_TRAMPOLINE_PHYS)
 
 section .text
 bits 16
@@ -8,118 +17,94 @@ bits 16
 ; Глобальные метки
 global ap_trampoline_start
 global ap_trampoline_end
-global ap_trampoline_size
-global ap_stack_phys
-global ap_pml4_phys
-global ap_entry_phys
+global ap_tr_cr3
+global ap_tr_entry
+global ap_tr_count
+global ap_tr_stacks
 
 ; ============================================================
 ; Начало trampoline кода
-; AP CPU начинает выполнение отсюда после INIT/SIPI
+; AP CPU начинает выполнение отсюда после INIT/SIPI (CS = 0x0800, IP = 0)
 ; ============================================================
 ap_trampoline_start:
-    ; Очищаем сегментные регистры
+    cli
+    cld
     xor ax, ax
     mov ds, ax
     mov es, ax
     mov ss, ax
-    mov sp, 0x7C00          ; Используем стек в области загрузки
-    
-    ; Очищаем направление
-    cld
     
     ; ============================================================
-    ; Включаем A20 line (критично для доступа к памяти > 1MB)
+    ; Временная GDT и переход в защищённый режим (32-bit)
+    ; A20 уже включён BSP, повторно не трогаем
     ; ============================================================
-    in al, 0x92
-    or al, 2
-    out 0x92, al
+    lgdt [TR(ap_gdt_descriptor)]
     
-    ; ============================================================
-    ; Загружаем временную GDT для перехода в protected mode
-    ; ============================================================
-    lgdt [ap_gdt_descriptor]
-    
-    ; ============================================================
-    ; Переходим в защищённый режим (32-bit)
-    ; ============================================================
     mov eax, cr0
     or eax, 1               ; PE bit
     mov cr0, eax
     
-    ; Far jump для перезагрузки сегментов
-    jmp 0x08:.protected_mode
+    jmp dword 0x08:TR(ap_protected_mode)
 
-.bits 32
-.protected_mode:
-    ; Настраиваем сегменты
+bits 32
+ap_protected_mode:
     mov ax, 0x10            ; Data segment selector
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
     mov ss, ax
     
     ; ============================================================
-    ; Включаем PAE (Physical Address Extension)
-    ; Необходимо для long mode
+    ; PAE (обязателен для long mode) + PGE (страницы ядра глобальные)
     ; ============================================================
     mov eax, cr4
-    or eax, 1 << 5          ; PAE bit
+    or eax, (1 << 5) | (1 << 7)
     mov cr4, eax
     
     ; ============================================================
-    ; Загружаем PML4 таблицу
+    ; PML4 ниже 4GB: таблицы ядра + тождественное отображение
     ; ============================================================
-    mov eax, [ap_pml4_phys]
+    mov eax, [TR(ap_tr_cr3)]
     mov cr3, eax
     
     ; ============================================================
-    ; Включаем long mode через MSR
+    ; IA32_EFER: LME + NXE (стеки ядра отображены с NX)
     ; ============================================================
-    mov ecx, 0xC0000080      ; IA32_EFER MSR
+    mov ecx, 0xC0000080
     rdmsr
-    or eax, 1 << 8           ; LME (Long Mode Enable)
+    or eax, (1 << 8) | (1 << 11)
     wrmsr
     
     ; ============================================================
-    ; Включаем paging
+    ; Включаем paging (PG) и защиту от записи в ring 0 (WP)
     ; ============================================================
     mov eax, cr0
-    or eax, 1 << 31          ; PG bit
+    or eax, (1 << 31) | (1 << 16)
     mov cr0, eax
     
-    ; ============================================================
-    ; Far jump в 64-bit режим
-    ; ============================================================
-    jmp 0x08:.long_mode
+    jmp 0x18:TR(ap_long_mode)
 
-.bits 64
-.long_mode:
-    ; Настраиваем сегменты для 64-bit режима
-    mov ax, 0x10            ; Kernel data selector
+bits 64
+ap_long_mode:
+    xor ax, ax
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
     mov ss, ax
     
     ; ============================================================
-    ; Загружаем TSS для возможности использования syscalls
-    ; ============================================================
-    mov ax, 0x28            ; TSS selector
-    ltr ax
-    
-    ; ============================================================
-    ; Переключаемся на стек AP процессора
+    ; Порядковый номер AP -> его стек из ap_tr_stacks
     ; ============================================================
-    mov rsp, [ap_stack_phys]
+    mov eax, 1
+    lock xadd [TR(ap_tr_count)], eax
+    cmp eax, AP_MAX_CPUS - 1
+    jae .halt
+    mov rsp, [TR(ap_tr_stacks) + rax * 8]
     
     ; ============================================================
-    ; Переходим на точку входа AP ядра
+    ; Переходим на ap_main (higher half); GDT, IDT, TSS и CR3
+    ; ядра загружает уже C код
     ; ============================================================
-    mov rax, [ap_entry_phys]
-    jmp rax
+    mov rax, [TR(ap_tr_entry)]
+    call rax
     
     ; Если вернётся — останавливаем CPU
 .halt:
@@ -130,50 +115,40 @@ ap_trampoline_start:
 ; ============================================================
 ; GDT для trampoline (временная)
 ; ============================================================
-align 4
+align 8
 ap_gdt_start:
     dq 0                    ; Null descriptor
-    ; Code segment (32-bit)
-    dw 0xFFFF
-    dw 0x0000
-    db 0x00
-    db 10011010b
-    db 11001111b
-    db 0x00
-    ; Data segment
-    dw 0xFFFF
-    dw 0x0000
-    db 0x00
-    db 10010010b
-    db 11001111b
-    db 0x00
+    dq 0x00CF9A000000FFFF   ; 0x08: Code segment (32-bit)
+    dq 0x00CF92000000FFFF   ; 0x10: Data segment
+    dq 0x00AF9A000000FFFF   ; 0x18: Code segment (64-bit)
 ap_gdt_end:
 
 ap_gdt_descriptor:
     dw ap_gdt_end - ap_gdt_start - 1
-    dd ap_gdt_start
+    dd TR(ap_gdt_start)
 
 ; ============================================================
-; Конец trampoline кода
+; Параметры, заполняемые smp_init() в копии trampoline
 ; ============================================================
-ap_trampoline_end:
-
-; Размер trampoline кода
-ap_trampoline_size:
-    dd ap_trampoline_end - ap_trampoline_start
-
-section .data
-
-; Эти значения заполняются ядром при инициализации SMP
-
-; Физический адрес PML4 (таблица страниц ядра)
-ap_pml4_phys:
+align 8
+; Физический адрес PML4 для AP
+ap_tr_cr3:
     dq 0
 
-; Физический адрес стека для AP
-ap_stack_phys:
+; Виртуальный адрес точки входа AP (ap_main)
+ap_tr_entry:
     dq 0
 
-; Физический адрес точки входа AP (ap_main)
-ap_entry_phys:
-    dq 0
+; Сколько AP уже взяли стек
+ap_tr_count:
+    dd 0
+    dd 0
+
+; Вершины стеков AP (по одному на AP)
+ap_tr_stacks:
+    times AP_MAX_CPUS - 1 dq 0
+
+; ============================================================
+; Конец trampoline кода
+; ============================================================
+ap_trampoline_end:
@@ -0,0 +1,229 @@
+// softirq.c — Deferred interrupt work (softirqs, tasklets, ksoftirqd)
+#include "kernel.h"
+
+// Top halves ack the device, queue work and raise a softirq on their own
+// CPU. irq_exit() then runs the pending softirqs with interrupts enabled,
+// in batches bounded by a restart count and a time budget; whatever is
+// left over is handed to that CPU's ksoftirqd thread so a flood of
+// interrupts cannot starve ordinary threads.
+
+#define SOFTIRQ_MAX_RESTART 10
+#define SOFTIRQ_MAX_NS      2000000     // 2 ms per batch
+
+struct softirq_stat {
+    uint64_t count;
+    uint64_t cycles;
+};
+
+struct tasklet_list {
+    struct tasklet* head;
+    struct tasklet* tail;
+};
+
+static void tasklet_action(void);
+static void tasklet_hi_action(void);
+
+static void (*softirq_actions[NR_SOFTIRQS])(void) = {
+    [SOFTIRQ_HI]      = tasklet_hi_action,
+    [SOFTIRQ_TASKLET] = tasklet_action,
+};
+
+static const char* softirq_names[NR_SOFTIRQS] = {
+    "HI", "NET_TX", "NET_RX", "BLOCK", "TASKLET", "RCU"
+};
+
+static struct softirq_stat softirq_stats[MAX_CPUS][NR_SOFTIRQS];
+static uint8_t softirq_vector[MAX_CPUS][NR_SOFTIRQS];  // Last raiser, for irq_account_bh()
+static struct tasklet_list tasklet_vec[MAX_CPUS];
+static struct tasklet_list tasklet_hi_vec[MAX_CPUS];
+static struct thread* ksoftirqd[MAX_CPUS];
+static uint64_t budget_cycles = 0;
+
+void open_softirq(uint32_t nr, void (*action)(void)) {
+    if (nr < NR_SOFTIRQS) softirq_actions[nr] = action;
+}
+
+// Mark nr pending on the calling CPU, IF=0
+static void raise_softirq_irqoff(uint32_t nr) {
+    this_cpu_write(softirq_pending, this_cpu_read(softirq_pending) | (1u << nr));
+    softirq_vector[this_cpu_read(id)][nr] = this_cpu_read(irq_vector);
+}
+
+// Mark nr pending on the calling CPU; it runs at the next irq_exit()
+// or in ksoftirqd, whichever comes first. Interrupt handlers run with
+// IF=0 and softirqs with softirq_active set, and both are followed by a
+// softirq pass. A raise with IF=1 outside softirqs is thread context, and
+// nothing would run it before the next interrupt, so it wakes ksoftirqd.
+// A thread that raises with interrupts disabled waits for the next tick.
+void raise_softirq(uint32_t nr) {
+    if (nr >= NR_SOFTIRQS) return;
+    uint64_t flags = local_irq_save();
+    raise_softirq_irqoff(nr);
+    if ((flags & 0x200) && !this_cpu_read(softirq_active)) {
+        struct thread* t = ksoftirqd[this_cpu_read(id)];
+        if (t) sched_wake(t);
+    }
+    local_irq_restore(flags);
+}
+
+// Run pending softirqs. Entered and left with IF=0; handlers run with
+// IF=1. Returns true if work is still pending when the budget runs out.
+static bool softirq_run(void) {
+    uint32_t cpu = this_cpu_read(id);
+    struct softirq_stat* stats = softirq_stats[cpu];
+    uint8_t vectors[NR_SOFTIRQS];
+    uint64_t deadline = rdtsc() + budget_cycles;
+    int restart = SOFTIRQ_MAX_RESTART;
+    uint32_t pending;
+
+    this_cpu_write(softirq_active, true);
+    while ((pending = this_cpu_read(softirq_pending)) != 0) {
+        this_cpu_write(softirq_pending, 0);
+        memcpy(vectors, softirq_vector[cpu], sizeof(vectors));
+        sti();
+
+        for (uint32_t nr = 0; pending; nr++, pending >>= 1) {
+            if (!(pending & 1) || !softirq_actions[nr]) continue;
+            uint64_t start = rdtsc();
+            softirq_actions[nr]();
+            uint64_t cycles = rdtsc() - start;
+            stats[nr].count++;
+            stats[nr].cycles += cycles;
+            irq_account_bh(vectors[nr], cycles);
+        }
+
+        cli();
+        if (--restart == 0 || rdtsc() >= deadline) break;
+    }
+    this_cpu_write(softirq_active, false);
+    return this_cpu_read(softirq_pending) != 0;
+}
+
+// Called on the way out of every device/system interrupt, IF=0
+void irq_exit(void) {
+    if (this_cpu_read(softirq_active) || !this_cpu_read(softirq_pending)) return;
+
+    if (softirq_run()) {
+        struct thread* t = ksoftirqd[this_cpu_read(id)];
+        if (t) sched_wake(t);
+    }
+    // A tick that arrived during the batch could not preempt it
+    sched_preempt();
+}
+
+static void ksoftirqd_main(void* arg) {
+    uint32_t cpu = (uint32_t)(uint64_t)arg;
+    while (this_cpu_read(id) != cpu) yield();
+    struct thread* self = (struct thread*)this_cpu_read(current_thread);
+
+    while (1) {
+        cli();
+        if (!this_cpu_read(softirq_pending)) {
+            // IF=0 until schedule(): a raise after the check wakes us
+            self->state = TASK_BLOCKED;
+            schedule();
+            sti();
+            continue;
+        }
+        softirq_run();
+        sti();
+        yield();
+    }
+}
+
+// One ksoftirqd per online CPU, pinned to it
+void softirq_init(void) {
+    budget_cycles = clock_ns_to_cycles(SOFTIRQ_MAX_NS);
+
+    uint32_t count = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!cpu_get(cpu)->online) continue;
+        struct thread* t = kthread_create(ksoftirqd_main, (void*)(uint64_t)cpu);
+        if (!t) continue;
+        sched_set_affinity(t, 1ULL << cpu);
+        ksoftirqd[cpu] = t;
+        count++;
+    }
+    kprintf("Softirq: %u ksoftirqd threads, budget %u restarts / %u us\n",
+        count, SOFTIRQ_MAX_RESTART, SOFTIRQ_MAX_NS / 1000);
+}
+
+void tasklet_init(struct tasklet* t, void (*func)(void*), void* data) {
+    t->next = NULL;
+    t->func = func;
+    t->data = data;
+    t->state = 0;
+}
+
+static void tasklet_enqueue(struct tasklet_list* lists, struct tasklet* t, uint32_t nr) {
+    uint64_t flags = local_irq_save();
+    struct tasklet_list* l = &lists[this_cpu_read(id)];
+    t->next = NULL;
+    if (l->tail) l->tail->next = t;
+    else l->head = t;
+    l->tail = t;
+    raise_softirq_irqoff(nr);
+    local_irq_restore(flags);
+}
+
+// Queue t on the calling CPU unless it is already queued somewhere
+void tasklet_schedule(struct tasklet* t) {
+    if (atomic_fetch_or32(&t->state, TASKLET_SCHED, ATOMIC_ACQ_REL) & TASKLET_SCHED) return;
+    tasklet_enqueue(tasklet_vec, t, SOFTIRQ_TASKLET);
+}
+
+void tasklet_hi_schedule(struct tasklet* t) {
+    if (atomic_fetch_or32(&t->state, TASKLET_SCHED, ATOMIC_ACQ_REL) & TASKLET_SCHED) return;
+    tasklet_enqueue(tasklet_hi_vec, t, SOFTIRQ_HI);
+}
+
+// Wait until t is neither queued nor running (thread context only)
+void tasklet_kill(struct tasklet* t) {
+    while (t->state & TASKLET_SCHED) yield();
+    while (t->state & TASKLET_RUN) pause();
+}
+
+// A tasklet never runs on two CPUs at once: if it is running elsewhere it
+// goes back on this CPU's list for the next pass
+static void tasklet_run_list(struct tasklet_list* lists, uint32_t nr) {
+    cli();
+    struct tasklet_list* l = &lists[this_cpu_read(id)];
+    struct tasklet* list = l->head;
+    l->head = l->tail = NULL;
+    sti();
+
+    while (list) {
+        struct tasklet* t = list;
+        list = t->next;
+
+        if (!(atomic_fetch_or32(&t->state, TASKLET_RUN, ATOMIC_ACQUIRE) & TASKLET_RUN)) {
+            // Clear SCHED first so func() may reschedule itself
+            atomic_fetch_and32(&t->state, ~TASKLET_SCHED, ATOMIC_ACQ_REL);
+            t->func(t->data);
+            atomic_fetch_and32(&t->state, ~TASKLET_RUN, ATOMIC_RELEASE);
+            continue;
+        }
+        tasklet_enqueue(lists, t, nr);
+    }
+}
+
+static void tasklet_action(void) {
+    tasklet_run_list(tasklet_vec, SOFTIRQ_TASKLET);
+}
+
+static void tasklet_hi_action(void) {
+    tasklet_run_list(tasklet_hi_vec, SOFTIRQ_HI);
+}
+
+void softirq_dump_stats(void) {
+    kprintf("Softirq: count / time (us) per CPU\n");
+    for (uint32_t nr = 0; nr < NR_SOFTIRQS; nr++) {
+        kprintf("  %s:", softirq_names[nr]);
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (!cpu_get(cpu)->online) continue;
+            struct softirq_stat* st = &softirq_stats[cpu][nr];
+            kprintf(" %lu/%lu", st->count, clock_cycles_to_ns(st->cycles) / 1000);
+        }
+        kprintf("\n");
+    }
+}
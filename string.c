@@ -1,44 +1,569 @@
 // string.c — String and memory operations FIXED
 #include "kernel.h"
 
-void* memset(void* s, int c, size_t n) {
-    uint8_t* p = (uint8_t*)s;
-    while (n--) *p++ = (uint8_t)c;
-    return s;
+// The kernel.h macros route constant sizes to the compiler builtins; the
+// real functions live here. Loop distribution would turn the fallback
+// loops below back into calls to these very functions.
+#undef memcpy
+#undef memset
+#undef memmove
+#pragma GCC optimize ("no-tree-loop-distribute-patterns")
+
+// Dispatch flags, set once by mem_init()
+#define MEM_ERMS        0x01    // Enhanced rep movsb/stosb
+#define MEM_FSRM        0x02    // Fast short rep movsb
+#define MEM_SSE2        0x04    // SSE enabled (fpu_init)
+#define MEM_AVX2        0x08
+
+#define MEM_REP_MIN     128     // ERMS: rep startup is amortized from here
+#define MEM_SIMD_MIN    512     // SIMD: state save/restore is amortized from here
+#define MEM_NT_MIN      4096    // memcpy_nt/memset_nt: below this, plain stores
+#define MEM_NT_DEFAULT  (1024 * 1024)
+
+static uint32_t mem_caps = 0;
+// memcpy/memset switch to streaming stores from here: a buffer this big
+// would push most of the last-level cache out anyway (3/4 of the LLC)
+static size_t mem_nt_threshold = ~(size_t)0;
+
+static inline uint64_t load64(const uint8_t* p) {
+    uint64_t v;
+    __builtin_memcpy(&v, p, 8);
+    return v;
+}
+
+static inline void store64(uint8_t* p, uint64_t v) {
+    __builtin_memcpy(p, &v, 8);
+}
+
+// n <= 16: two possibly overlapping moves, loads before stores
+static inline void copy_small(uint8_t* d, const uint8_t* s, size_t n) {
+    if (n >= 8) {
+        uint64_t a = load64(s), b = load64(s + n - 8);
+        store64(d, a);
+        store64(d + n - 8, b);
+    } else if (n >= 4) {
+        uint32_t a, b;
+        __builtin_memcpy(&a, s, 4);
+        __builtin_memcpy(&b, s + n - 4, 4);
+        __builtin_memcpy(d, &a, 4);
+        __builtin_memcpy(d + n - 4, &b, 4);
+    } else {
+        for (size_t i = 0; i < n; i++) d[i] = s[i];
+    }
+}
+
+// n >= 8: qwords, last one overlapping the previous
+static void copy_words(uint8_t* d, const uint8_t* s, size_t n) {
+    uint8_t* end = d + n;
+    const uint8_t* send = s + n;
+    for (; n >= 32; n -= 32, d += 32, s += 32) {
+        uint64_t a = load64(s), b = load64(s + 8), c = load64(s + 16), e = load64(s + 24);
+        store64(d, a);
+        store64(d + 8, b);
+        store64(d + 16, c);
+        store64(d + 24, e);
+    }
+    for (; n >= 8; n -= 8, d += 8, s += 8) store64(d, load64(s));
+    if (n) store64(end - 8, load64(send - 8));
+}
+
+static inline void copy_tail(uint8_t* d, const uint8_t* s, size_t n) {
+    if (n <= 16) copy_small(d, s, n);
+    else copy_words(d, s, n);
+}
+
+static inline void copy_rep(uint8_t* d, const uint8_t* s, size_t n) {
+    asm volatile ("rep movsb" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
 }
 
-void* memcpy(void* d, const void* s, size_t n) {
-    uint8_t* dst = (uint8_t*)d;
-    const uint8_t* src = (const uint8_t*)s;
-    while (n--) *dst++ = *src++;
-    return d;
+// Inside a kernel FPU section, n >= MEM_SIMD_MIN. Stores are aligned.
+static void copy_sse2(uint8_t* d, const uint8_t* s, size_t n) {
+    size_t head = -(uintptr_t)d & 15;
+    copy_small(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    size_t blocks = n / 64;
+    asm volatile (
+        "1:\n"
+        "movdqu (%1), %%xmm0\n"
+        "movdqu 16(%1), %%xmm1\n"
+        "movdqu 32(%1), %%xmm2\n"
+        "movdqu 48(%1), %%xmm3\n"
+        "movdqa %%xmm0, (%0)\n"
+        "movdqa %%xmm1, 16(%0)\n"
+        "movdqa %%xmm2, 32(%0)\n"
+        "movdqa %%xmm3, 48(%0)\n"
+        "add $64, %1\n"
+        "add $64, %0\n"
+        "dec %2\n"
+        "jnz 1b\n"
+        : "+r"(d), "+r"(s), "+r"(blocks) : : "memory", "cc");
+    copy_tail(d, s, n & 63);
 }
 
-void* memmove(void* d, const void* s, size_t n) {
-    uint8_t* dst = (uint8_t*)d;
-    const uint8_t* src = (const uint8_t*)s;
-    if (dst < src) {
-        while (n--) *dst++ = *src++;
+static void copy_avx2(uint8_t* d, const uint8_t* s, size_t n) {
+    size_t head = -(uintptr_t)d & 31;
+    copy_tail(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    size_t blocks = n / 128;
+    asm volatile (
+        "1:\n"
+        "vmovdqu (%1), %%ymm0\n"
+        "vmovdqu 32(%1), %%ymm1\n"
+        "vmovdqu 64(%1), %%ymm2\n"
+        "vmovdqu 96(%1), %%ymm3\n"
+        "vmovdqa %%ymm0, (%0)\n"
+        "vmovdqa %%ymm1, 32(%0)\n"
+        "vmovdqa %%ymm2, 64(%0)\n"
+        "vmovdqa %%ymm3, 96(%0)\n"
+        "add $128, %1\n"
+        "add $128, %0\n"
+        "dec %2\n"
+        "jnz 1b\n"
+        "vzeroupper\n"
+        : "+r"(d), "+r"(s), "+r"(blocks) : : "memory", "cc");
+    copy_tail(d, s, n & 127);
+}
+
+static void copy_cached(uint8_t* d, const uint8_t* s, size_t n) {
+    if (n <= 16) {
+        copy_small(d, s, n);
+    } else if ((mem_caps & MEM_FSRM) || ((mem_caps & MEM_ERMS) && n >= MEM_REP_MIN)) {
+        copy_rep(d, s, n);
+    } else if (n >= MEM_SIMD_MIN && (mem_caps & MEM_SSE2) && kernel_fpu_usable()) {
+        kernel_fpu_begin();
+        if (mem_caps & MEM_AVX2) copy_avx2(d, s, n);
+        else copy_sse2(d, s, n);
+        kernel_fpu_end();
     } else {
-        dst += n;
-        src += n;
-        while (n--) *--dst = *--src;
+        copy_words(d, s, n);
     }
-    return d;
+}
+
+void* memcpy(void* dst, const void* src, size_t n) {
+    if (n >= mem_nt_threshold) return memcpy_nt(dst, src, n);
+    copy_cached((uint8_t*)dst, (const uint8_t*)src, n);
+    return dst;
+}
+
+// n <= 16, v = byte pattern in every lane
+static inline void set_small(uint8_t* d, uint64_t v, size_t n) {
+    if (n >= 8) {
+        store64(d, v);
+        store64(d + n - 8, v);
+    } else if (n >= 4) {
+        __builtin_memcpy(d, &v, 4);
+        __builtin_memcpy(d + n - 4, &v, 4);
+    } else {
+        for (size_t i = 0; i < n; i++) d[i] = (uint8_t)v;
+    }
+}
+
+static void set_words(uint8_t* d, uint64_t v, size_t n) {
+    uint8_t* end = d + n;
+    for (; n >= 32; n -= 32, d += 32) {
+        store64(d, v);
+        store64(d + 8, v);
+        store64(d + 16, v);
+        store64(d + 24, v);
+    }
+    for (; n >= 8; n -= 8, d += 8) store64(d, v);
+    if (n) store64(end - 8, v);
+}
+
+static inline void set_tail(uint8_t* d, uint64_t v, size_t n) {
+    if (n <= 16) set_small(d, v, n);
+    else set_words(d, v, n);
+}
+
+static void set_sse2(uint8_t* d, uint64_t v, size_t n) {
+    size_t head = -(uintptr_t)d & 15;
+    set_small(d, v, head);
+    d += head;
+    n -= head;
+    size_t blocks = n / 64;
+    asm volatile (
+        "movq %2, %%xmm0\n"
+        "punpcklqdq %%xmm0, %%xmm0\n"
+        "1:\n"
+        "movdqa %%xmm0, (%0)\n"
+        "movdqa %%xmm0, 16(%0)\n"
+        "movdqa %%xmm0, 32(%0)\n"
+        "movdqa %%xmm0, 48(%0)\n"
+        "add $64, %0\n"
+        "dec %1\n"
+        "jnz 1b\n"
+        : "+r"(d), "+r"(blocks) : "r"(v) : "memory", "cc");
+    set_tail(d, v, n & 63);
+}
+
+static void set_avx2(uint8_t* d, uint64_t v, size_t n) {
+    size_t head = -(uintptr_t)d & 31;
+    set_tail(d, v, head);
+    d += head;
+    n -= head;
+    size_t blocks = n / 128;
+    asm volatile (
+        "vmovq %2, %%xmm0\n"
+        "vpbroadcastq %%xmm0, %%ymm0\n"
+        "1:\n"
+        "vmovdqa %%ymm0, (%0)\n"
+        "vmovdqa %%ymm0, 32(%0)\n"
+        "vmovdqa %%ymm0, 64(%0)\n"
+        "vmovdqa %%ymm0, 96(%0)\n"
+        "add $128, %0\n"
+        "dec %1\n"
+        "jnz 1b\n"
+        "vzeroupper\n"
+        : "+r"(d), "+r"(blocks) : "r"(v) : "memory", "cc");
+    set_tail(d, v, n & 127);
+}
+
+static void set_cached(uint8_t* d, int c, size_t n) {
+    uint64_t v = (uint8_t)c * 0x0101010101010101ULL;
+
+    if (n <= 16) {
+        set_small(d, v, n);
+    } else if ((mem_caps & MEM_FSRM) || ((mem_caps & MEM_ERMS) && n >= MEM_REP_MIN)) {
+        asm volatile ("rep stosb" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+    } else if (n >= MEM_SIMD_MIN && (mem_caps & MEM_SSE2) && kernel_fpu_usable()) {
+        kernel_fpu_begin();
+        if (mem_caps & MEM_AVX2) set_avx2(d, v, n);
+        else set_sse2(d, v, n);
+        kernel_fpu_end();
+    } else {
+        set_words(d, v, n);
+    }
+}
+
+void* memset(void* dst, int c, size_t n) {
+    if (n >= mem_nt_threshold) return memset_nt(dst, c, n);
+    set_cached((uint8_t*)dst, c, n);
+    return dst;
+}
+
+// Streaming (non-temporal) stores go to memory through the write-combining
+// buffers without allocating cache lines, so a bulk copy or clear leaves
+// the working set of whatever runs next alone. The trailing sfence orders
+// them before the caller's next stores (and any DMA doorbell).
+static inline void store64_nt(uint8_t* p, uint64_t v) {
+    asm volatile ("movnti %1, %0" : "=m"(*(uint64_t*)p) : "r"(v));
+}
+
+// No FPU section needed: movnti streams from general registers
+static void copy_nt_words(uint8_t* d, const uint8_t* s, size_t n) {
+    size_t head = -(uintptr_t)d & 7;
+    copy_small(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 32; n -= 32, d += 32, s += 32) {
+        uint64_t a = load64(s), b = load64(s + 8), c = load64(s + 16), e = load64(s + 24);
+        store64_nt(d, a);
+        store64_nt(d + 8, b);
+        store64_nt(d + 16, c);
+        store64_nt(d + 24, e);
+    }
+    for (; n >= 8; n -= 8, d += 8, s += 8) store64_nt(d, load64(s));
+    copy_small(d, s, n);
+}
+
+static void copy_nt_sse2(uint8_t* d, const uint8_t* s, size_t n) {
+    size_t head = -(uintptr_t)d & 15;
+    copy_small(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    size_t blocks = n / 64;
+    asm volatile (
+        "1:\n"
+        "prefetchnta 256(%1)\n"
+        "movdqu (%1), %%xmm0\n"
+        "movdqu 16(%1), %%xmm1\n"
+        "movdqu 32(%1), %%xmm2\n"
+        "movdqu 48(%1), %%xmm3\n"
+        "movntdq %%xmm0, (%0)\n"
+        "movntdq %%xmm1, 16(%0)\n"
+        "movntdq %%xmm2, 32(%0)\n"
+        "movntdq %%xmm3, 48(%0)\n"
+        "add $64, %1\n"
+        "add $64, %0\n"
+        "dec %2\n"
+        "jnz 1b\n"
+        : "+r"(d), "+r"(s), "+r"(blocks) : : "memory", "cc");
+    copy_tail(d, s, n & 63);
+}
+
+void* memcpy_nt(void* dst, const void* src, size_t n) {
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+
+    if (n < MEM_NT_MIN) {
+        copy_cached(d, s, n);
+        return dst;
+    }
+    if ((mem_caps & MEM_SSE2) && kernel_fpu_usable()) {
+        kernel_fpu_begin();
+        copy_nt_sse2(d, s, n);
+        kernel_fpu_end();
+    } else {
+        copy_nt_words(d, s, n);
+    }
+    asm volatile ("sfence" ::: "memory");
+    return dst;
+}
+
+static void set_nt_words(uint8_t* d, uint64_t v, size_t n) {
+    size_t head = -(uintptr_t)d & 7;
+    set_small(d, v, head);
+    d += head;
+    n -= head;
+    for (; n >= 32; n -= 32, d += 32) {
+        store64_nt(d, v);
+        store64_nt(d + 8, v);
+        store64_nt(d + 16, v);
+        store64_nt(d + 24, v);
+    }
+    for (; n >= 8; n -= 8, d += 8) store64_nt(d, v);
+    set_small(d, v, n);
+}
+
+static void set_nt_sse2(uint8_t* d, uint64_t v, size_t n) {
+    size_t head = -(uintptr_t)d & 15;
+    set_small(d, v, head);
+    d += head;
+    n -= head;
+    size_t blocks = n / 64;
+    asm volatile (
+        "movq %2, %%xmm0\n"
+        "punpcklqdq %%xmm0, %%xmm0\n"
+        "1:\n"
+        "movntdq %%xmm0, (%0)\n"
+        "movntdq %%xmm0, 16(%0)\n"
+        "movntdq %%xmm0, 32(%0)\n"
+        "movntdq %%xmm0, 48(%0)\n"
+        "add $64, %0\n"
+        "dec %1\n"
+        "jnz 1b\n"
+        : "+r"(d), "+r"(blocks) : "r"(v) : "memory", "cc");
+    set_tail(d, v, n & 63);
+}
+
+void* memset_nt(void* dst, int c, size_t n) {
+    uint8_t* d = (uint8_t*)dst;
+    uint64_t v = (uint8_t)c * 0x0101010101010101ULL;
+
+    if (n < MEM_NT_MIN) {
+        set_cached(d, c, n);
+        return dst;
+    }
+    if ((mem_caps & MEM_SSE2) && kernel_fpu_usable()) {
+        kernel_fpu_begin();
+        set_nt_sse2(d, v, n);
+        kernel_fpu_end();
+    } else {
+        set_nt_words(d, v, n);
+    }
+    asm volatile ("sfence" ::: "memory");
+    return dst;
+}
+
+void* memmove(void* dst, const void* src, size_t n) {
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+
+    if (d == s || n == 0) return dst;
+    if (d + n <= s || s + n <= d) return memcpy(dst, src, n);
+
+    if (d < s) {
+        // Forward: each load happens before any store that could reach it
+        if (mem_caps & MEM_ERMS) {
+            copy_rep(d, s, n);
+            return dst;
+        }
+        for (; n >= 8; n -= 8, d += 8, s += 8) store64(d, load64(s));
+        while (n--) *d++ = *s++;
+    } else {
+        d += n;
+        s += n;
+        for (; n >= 8; n -= 8) {
+            d -= 8;
+            s -= 8;
+            store64(d, load64(s));
+        }
+        while (n--) *--d = *--s;
+    }
+    return dst;
+}
+
+// Largest cache: CPUID leaf 4 (Intel) or 0x80000006 (AMD), 0 if unknown
+static size_t cache_llc_size(void) {
+    uint32_t eax, ebx, ecx, edx;
+    size_t best = 0;
+
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 4) {
+        for (uint32_t i = 0; i < 8; i++) {
+            cpuid_count(4, i, &eax, &ebx, &ecx, &edx);
+            if ((eax & 0x1F) == 0) break;           // No more caches
+            size_t size = (size_t)((ebx >> 22) + 1) * (((ebx >> 12) & 0x3FF) + 1) *
+                          ((ebx & 0xFFF) + 1) * (ecx + 1);
+            if (size > best) best = size;
+        }
+    }
+    if (best) return best;
+
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000006) {
+        cpuid(0x80000006, &eax, &ebx, &ecx, &edx);
+        best = (size_t)(edx >> 18) * 512 * 1024;    // L3, 512 KB units
+        if (!best) best = (size_t)(ecx >> 16) * 1024;
+    }
+    return best;
+}
+
+// BSP, after fpu_init()
+void mem_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t caps = MEM_SSE2;
+
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 7) {
+        cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx & (1 << 9)) caps |= MEM_ERMS;
+        if (edx & (1 << 4)) caps |= MEM_FSRM;
+    }
+    if (fpu_has_avx2()) caps |= MEM_AVX2;
+    mem_caps = caps;
+
+    size_t llc = cache_llc_size();
+    mem_nt_threshold = llc ? llc / 4 * 3 : MEM_NT_DEFAULT;
+    if (mem_nt_threshold < MEM_NT_MIN) mem_nt_threshold = MEM_NT_MIN;
+
+    kprintf("String: memcpy/memset via %s%s\n",
+        (caps & MEM_FSRM) ? "FSRM rep movsb" : (caps & MEM_ERMS) ? "ERMS rep movsb" :
+        (caps & MEM_AVX2) ? "AVX2" : "SSE2",
+        (caps & (MEM_ERMS | MEM_FSRM)) ? "" : " above 512 bytes");
+    kprintf("String: streaming stores from %lu KB (LLC %lu KB)\n",
+        (uint64_t)mem_nt_threshold / 1024, (uint64_t)llc / 1024);
+}
+
+#ifdef KOS_BENCH
+// make BENCH=1: cached vs streaming copy and clear throughput, plus the
+// time to re-read a warm working set afterwards, i.e. the cache misses the
+// next user pays for. Runs on the calling CPU.
+#define MEM_BENCH_BUF       (8 * 1024 * 1024)
+#define MEM_BENCH_WSET      (256 * 1024)
+
+enum { BENCH_COPY, BENCH_COPY_NT, BENCH_SET, BENCH_SET_NT };
+
+static const char* mem_bench_names[] = { "memcpy", "memcpy_nt", "memset", "memset_nt" };
+static volatile uint64_t bench_sink;
+
+static uint64_t bench_touch(const uint8_t* p, size_t n) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i += 64) sum += *(const volatile uint8_t*)(p + i);
+    return sum;
+}
+
+static void mem_bench_one(int mode, uint8_t* dst, uint8_t* src, uint8_t* wset, size_t n) {
+    bench_sink += bench_touch(wset, MEM_BENCH_WSET);
+
+    uint64_t t0 = rdtsc();
+    switch (mode) {
+    case BENCH_COPY:    copy_cached(dst, src, n); break;
+    case BENCH_COPY_NT: memcpy_nt(dst, src, n); break;
+    case BENCH_SET:     set_cached(dst, 0, n); break;
+    case BENCH_SET_NT:  memset_nt(dst, 0, n); break;
+    }
+    uint64_t t1 = rdtsc();
+    bench_sink += bench_touch(wset, MEM_BENCH_WSET);
+    uint64_t t2 = rdtsc();
+
+    uint64_t ns = clock_cycles_to_ns(t1 - t0);
+    kprintf("  %s %lu KB: %lu MB/s, working set re-read %lu us\n",
+        mem_bench_names[mode], (uint64_t)n / 1024, ns ? (uint64_t)n * 1000 / ns : 0,
+        clock_cycles_to_ns(t2 - t1) / 1000);
+}
+
+void mem_bench(void) {
+    size_t pages = MEM_BENCH_BUF / PAGE_SIZE;
+    uint8_t* src = pmm_alloc_pages(pages);
+    uint8_t* dst = pmm_alloc_pages(pages);
+    uint8_t* wset = pmm_alloc_pages(MEM_BENCH_WSET / PAGE_SIZE);
+    if (!src || !dst || !wset) {
+        kprintf("Mem bench: out of memory\n");
+    } else {
+        const size_t sizes[] = { 64 * 1024, 1024 * 1024, MEM_BENCH_BUF };
+        kprintf("Mem bench: %lu KB working set\n", (uint64_t)MEM_BENCH_WSET / 1024);
+        for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            for (int mode = BENCH_COPY; mode <= BENCH_SET_NT; mode++) {
+                mem_bench_one(mode, dst, src, wset, sizes[i]);
+            }
+        }
+    }
+    if (src) pmm_free_pages(src, pages);
+    if (dst) pmm_free_pages(dst, pages);
+    if (wset) pmm_free_pages(wset, MEM_BENCH_WSET / PAGE_SIZE);
+}
+#endif
+
+// Word-at-a-time scanning. has_zero() sets the top bit of the first zero
+// byte of x (bits above it may be false positives, so only the lowest
+// set bit is meaningful). Loads beyond the end of a string are either
+// aligned, hence within the page holding the terminator, or checked with
+// word_safe() so they never touch the next page.
+#define ONES    0x0101010101010101ULL
+#define HIGHS   0x8080808080808080ULL
+
+static inline uint64_t has_zero(uint64_t x) {
+    return (x - ONES) & ~x & HIGHS;
+}
+
+static inline uint32_t first_byte(uint64_t mask) {
+    return (uint32_t)__builtin_ctzll(mask) / 8;
+}
+
+static inline bool word_safe(const void* p) {
+    return ((uintptr_t)p & (PAGE_SIZE - 1)) <= PAGE_SIZE - 8;
 }
 
 size_t strlen(const char* s) {
-    size_t len = 0;
-    while (s[len]) len++;
-    return len;
+    uint32_t off = (uintptr_t)s & 7;
+    const uint8_t* p = (const uint8_t*)s - off;
+    // Bytes before s are forced non-zero
+    uint64_t w = load64(p) | (off ? ~0ULL >> (64 - 8 * off) : 0);
+    uint64_t z;
+    while (!(z = has_zero(w))) {
+        p += 8;
+        w = load64(p);
+    }
+    return (size_t)(p + first_byte(z) - (const uint8_t*)s);
 }
 
+// Returns at the first word holding a difference or a terminator
 int strcmp(const char* s1, const char* s2) {
-    while (*s1 && *s1 == *s2) {
-        s1++;
-        s2++;
+    const uint8_t* a = (const uint8_t*)s1;
+    const uint8_t* b = (const uint8_t*)s2;
+    while (1) {
+        if (word_safe(a) && word_safe(b)) {
+            uint64_t x = load64(a), y = load64(b);
+            uint64_t stop = (x ^ y) | has_zero(x);
+            if (!stop) {
+                a += 8;
+                b += 8;
+                continue;
+            }
+            uint32_t i = first_byte(stop);
+            return a[i] - b[i];
+        }
+        if (*a != *b || !*a) return *a - *b;
+        a++;
+        b++;
     }
-    return (unsigned char)*s1 - (unsigned char)*s2;
 }
 
 int strncmp(const char* s1, const char* s2, size_t n) {
@@ -64,22 +589,93 @@ char* strncpy(char* d, const char* s, size_t n) {
 }
 
 // Additional useful string functions
+
+// Compare 16-byte blocks until one differs; returns the bytes left
+// (a multiple of 16) and advances a/b to that block
+static size_t memcmp_sse2(const uint8_t** a, const uint8_t** b, size_t n) {
+    size_t blocks = n / 16;
+    uint32_t mask;
+    asm volatile (
+        "1:\n"
+        "movdqu (%[a]), %%xmm0\n"
+        "movdqu (%[b]), %%xmm1\n"
+        "pcmpeqb %%xmm1, %%xmm0\n"
+        "pmovmskb %%xmm0, %[m]\n"
+        "cmp $0xFFFF, %[m]\n"
+        "jne 2f\n"
+        "add $16, %[a]\n"
+        "add $16, %[b]\n"
+        "dec %[n]\n"
+        "jnz 1b\n"
+        "2:\n"
+        : [a]"+r"(*a), [b]"+r"(*b), [n]"+r"(blocks), [m]"=&r"(mask) : : "memory", "cc");
+    return blocks * 16;
+}
+
 int memcmp(const void* s1, const void* s2, size_t n) {
-    const uint8_t* p1 = (const uint8_t*)s1;
-    const uint8_t* p2 = (const uint8_t*)s2;
-    while (n--) {
-        if (*p1 != *p2) return *p1 - *p2;
-        p1++;
-        p2++;
+    const uint8_t* a = (const uint8_t*)s1;
+    const uint8_t* b = (const uint8_t*)s2;
+
+    if (n >= MEM_SIMD_MIN && (mem_caps & MEM_SSE2) && kernel_fpu_usable()) {
+        kernel_fpu_begin();
+        size_t left = memcmp_sse2(&a, &b, n);
+        kernel_fpu_end();
+        // Either a differing block (< 16 bytes to scan) or the tail
+        n = left ? 16 : n & 15;
+    }
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        uint64_t x = load64(a), y = load64(b);
+        if (x != y) {
+            uint32_t i = first_byte(x ^ y);
+            return a[i] - b[i];
+        }
+    }
+    for (; n; n--, a++, b++) {
+        if (*a != *b) return *a - *b;
     }
     return 0;
 }
 
+// Scan 16-byte blocks for v's byte; returns the match mask of the block
+// at *p, 0 if none matched (then *p is past the last whole block)
+static uint32_t memchr_sse2(const uint8_t** p, uint64_t v, size_t n) {
+    size_t blocks = n / 16;
+    uint32_t mask;
+    asm volatile (
+        "movq %[v], %%xmm1\n"
+        "punpcklqdq %%xmm1, %%xmm1\n"
+        "1:\n"
+        "movdqu (%[p]), %%xmm0\n"
+        "pcmpeqb %%xmm1, %%xmm0\n"
+        "pmovmskb %%xmm0, %[m]\n"
+        "test %[m], %[m]\n"
+        "jnz 2f\n"
+        "add $16, %[p]\n"
+        "dec %[n]\n"
+        "jnz 1b\n"
+        "2:\n"
+        : [p]"+r"(*p), [n]"+r"(blocks), [m]"=&r"(mask) : [v]"r"(v) : "memory", "cc");
+    return mask;
+}
+
 void* memchr(const void* s, int c, size_t n) {
     const uint8_t* p = (const uint8_t*)s;
-    while (n--) {
+    uint64_t v = (uint8_t)c * ONES;
+
+    if (n >= MEM_SIMD_MIN && (mem_caps & MEM_SSE2) && kernel_fpu_usable()) {
+        const uint8_t* start = p;
+        kernel_fpu_begin();
+        uint32_t mask = memchr_sse2(&p, v, n);
+        kernel_fpu_end();
+        if (mask) return (void*)(p + __builtin_ctz(mask));
+        n -= p - start;
+    }
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t z = has_zero(load64(p) ^ v);
+        if (z) return (void*)(p + first_byte(z));
+    }
+    for (; n; n--, p++) {
         if (*p == (uint8_t)c) return (void*)p;
-        p++;
     }
     return NULL;
 }
@@ -126,15 +722,25 @@ size_t strcspn(const char* s, const char* reject) {
     return n;
 }
 
+// memchr() skips to each candidate first byte; the last byte is checked
+// inline before memcmp() looks at the rest
 char* strstr(const char* haystack, const char* needle) {
-    size_t hlen = strlen(haystack);
     size_t nlen = strlen(needle);
-    if (hlen >= nlen) {
-        for (size_t i = 0; i <= hlen - nlen; i++) {
-            if (memcmp(haystack + i, needle, nlen) == 0) {
-                return (char*)haystack + i;
-            }
+    if (nlen == 0) return (char*)haystack;
+    size_t hlen = strlen(haystack);
+    if (hlen < nlen) return NULL;
+    const char* p = haystack;
+    const char* last = haystack + hlen - nlen;
+
+    while (p <= last) {
+        if (*p != needle[0]) {
+            p = memchr(p, needle[0], last - p + 1);
+            if (!p) break;
         }
+        if (p[nlen - 1] == needle[nlen - 1] && memcmp(p + 1, needle + 1, nlen - 1) == 0) {
+            return (char*)p;
+        }
+        p++;
     }
     return NULL;
 }
@@ -1,42 +1,29 @@
 // tcp.c — Transmission Control Protocol FIXED
 #include "net.h"
 
+// Socket list: RX lookups walk it under rcu_read_lock() only, writers
+// serialize on sockets_lock and free unlinked sockets after a grace period
 static struct socket* sockets = NULL;
+static spinlock_t sockets_lock;
 static uint16_t next_port = 49152; // Ephemeral ports
 static uint32_t tcp_seq_num = 0;
 
 uint16_t tcp_checksum(struct ipv4_header* ip, struct tcp_header* tcp, void* data, uint16_t len) {
-    struct {
-        uint32_t src;
-        uint32_t dst;
-        uint8_t zero;
-        uint8_t proto;
-        uint16_t tcp_len;
-    } pseudo_header;
-    
-    pseudo_header.src = ip->src_ip;
-    pseudo_header.dst = ip->dst_ip;
-    pseudo_header.zero = 0;
-    pseudo_header.proto = IP_P_TCP;
-    pseudo_header.tcp_len = htons(sizeof(struct tcp_header) + len);
-    
-    uint32_t sum = 0;
-    uint16_t* ptr;
-    
-    // Pseudo header
-    ptr = (uint16_t*)&pseudo_header;
-    for (size_t i = 0; i < sizeof(pseudo_header) / 2; i++) {
-        sum += *ptr++;
-    }
+    // Pseudo header, summed straight from its fields (addresses are
+    // already in network order)
+    uint32_t sum = (ip->src_ip & 0xFFFF) + (ip->src_ip >> 16) +
+                   (ip->dst_ip & 0xFFFF) + (ip->dst_ip >> 16) +
+                   htons(IP_P_TCP) + htons(sizeof(struct tcp_header) + len);
+    const csum_word_t* ptr;
     
     // TCP header
-    ptr = (uint16_t*)tcp;
+    ptr = (const csum_word_t*)tcp;
     for (size_t i = 0; i < sizeof(struct tcp_header) / 2; i++) {
         sum += *ptr++;
     }
     
     // Data
-    ptr = (uint16_t*)data;
+    ptr = (const csum_word_t*)data;
     for (size_t i = 0; i < len / 2; i++) {
         sum += *ptr++;
     }
@@ -71,6 +58,7 @@ const char* tcp_state_name(uint8_t state) {
 
 void tcp_init(void) {
     sockets = NULL;
+    spin_init(&sockets_lock);
     next_port = 49152;
     tcp_seq_num = 0x12345678; // Initial sequence number
 }
@@ -90,9 +78,11 @@ struct socket* tcp_socket(void) {
     sock->srtt = 0;
     sock->rttvar = 0;
     
-    // Add to list
+    // Publish fully initialized
+    uint64_t flags = spin_lock_irqsave(&sockets_lock);
     sock->next = sockets;
-    sockets = sock;
+    rcu_assign_pointer(sockets, sock);
+    spin_unlock_irqrestore(&sockets_lock, flags);
     
     return sock;
 }
@@ -126,14 +116,16 @@ int tcp_connect(struct socket* sock, struct sockaddr_in* addr) {
     }
     
     if (sock->local_addr == 0) {
+        rcu_read_lock();
         struct net_device* dev = net_get_device();
         if (dev) sock->local_addr = dev->ip;
+        rcu_read_unlock();
     }
     
     // Send SYN
     sock->state = TCP_SYN_SENT;
     sock->snd_una = tcp_seq_num;
-    sock->snd_nxt = tcp_seq_num + 1;
+    sock->snd_nxt = tcp_seq_num;    // The SYN carries the ISN; tcp_tx() steps past it
     
     tcp_tx(sock, TCP_SYN, NULL, 0);
     
@@ -153,7 +145,7 @@ void tcp_tx(struct socket* sock, uint8_t flags, void* data, uint16_t len) {
     tcp.dst_port = htons(sock->remote_port);
     tcp.seq = htonl(sock->snd_nxt);
     tcp.ack = htonl(sock->rcv_nxt);
-    tcp.data_off = sizeof(struct tcp_header) / 4;
+    tcp.data_off = (sizeof(struct tcp_header) / 4) << 4;   // Header length in the high nibble
     tcp.flags = flags;
     tcp.window = htons(sock->window);
     tcp.urgent = 0;
@@ -177,9 +169,7 @@ void tcp_tx(struct socket* sock, uint8_t flags, void* data, uint16_t len) {
     kfree(packet);
     
     if (flags & TCP_SYN) {
-        if (!(flags & TCP_ACK)) {
-            sock->snd_nxt++;
-        }
+        sock->snd_nxt++;            // SYN and SYN-ACK each take a sequence number
     }
     if (flags & TCP_FIN) {
         sock->snd_nxt++;
@@ -189,12 +179,9 @@ void tcp_tx(struct socket* sock, uint8_t flags, void* data, uint16_t len) {
     }
 }
 
-void tcp_rx(struct tcp_header* tcp, void* payload, uint16_t len) {
-    uint16_t dport = ntohs(tcp->dst_port);
-    uint16_t sport = ntohs(tcp->src_port);
-    
-    // Find socket
-    struct socket* sock = sockets;
+// Caller holds rcu_read_lock()
+static struct socket* tcp_lookup(uint16_t dport, uint16_t sport) {
+    struct socket* sock = rcu_dereference(sockets);
     while (sock) {
         if (sock->local_port == dport &&
             sock->remote_port == sport) {
@@ -203,11 +190,20 @@ void tcp_rx(struct tcp_header* tcp, void* payload, uint16_t len) {
         if (sock->state == TCP_LISTEN && sock->local_port == dport) {
             break;
         }
-        sock = sock->next;
+        sock = rcu_dereference(sock->next);
     }
+    return sock;
+}
+
+void tcp_rx(struct tcp_header* tcp, void* payload, uint16_t len) {
+    uint16_t dport = ntohs(tcp->dst_port);
+    uint16_t sport = ntohs(tcp->src_port);
     
+    rcu_read_lock();
+    struct socket* sock = tcp_lookup(dport, sport);
     if (!sock) {
         // No socket found, send RST
+        rcu_read_unlock();
         return;
     }
     
@@ -296,6 +292,7 @@ void tcp_rx(struct tcp_header* tcp, void* payload, uint16_t len) {
         default:
             break;
     }
+    rcu_read_unlock();
 }
 
 int tcp_send(struct socket* sock, void* data, uint16_t len) {
@@ -351,7 +348,8 @@ void tcp_close(struct socket* sock) {
 }
 
 void tcp_timer_tick(void) {
-    struct socket* sock = sockets;
+    rcu_read_lock();
+    struct socket* sock = rcu_dereference(sockets);
     while (sock) {
         if (sock->state == TCP_TIME_WAIT) {
             if (sock->time_wait_timer > 0) {
@@ -360,24 +358,33 @@ void tcp_timer_tick(void) {
                 sock->state = TCP_CLOSED;
             }
         }
-        sock = sock->next;
+        sock = rcu_dereference(sock->next);
     }
+    rcu_read_unlock();
+}
+
+static void tcp_socket_free(struct rcu_head* head) {
+    struct socket* sock = container_of(head, struct socket, rcu);
+    if (sock->rx_buf) kfree(sock->rx_buf);
+    if (sock->tx_buf) kfree(sock->tx_buf);
+    kfree(sock);
 }
 
+// Unlink closed sockets; readers may still hold them until a grace period
 void tcp_cleanup(void) {
+    uint64_t flags = spin_lock_irqsave(&sockets_lock);
     struct socket** prev = &sockets;
     struct socket* sock = sockets;
     
     while (sock) {
         if (sock->state == TCP_CLOSED) {
-            *prev = sock->next;
-            if (sock->rx_buf) kfree(sock->rx_buf);
-            if (sock->tx_buf) kfree(sock->tx_buf);
-            kfree(sock);
+            rcu_assign_pointer(*prev, sock->next);
+            call_rcu(&sock->rcu, tcp_socket_free);
             sock = *prev;
         } else {
             prev = &sock->next;
             sock = sock->next;
         }
     }
+    spin_unlock_irqrestore(&sockets_lock, flags);
 }
@@ -0,0 +1,107 @@
+#!/bin/bash
+# bench_boot.sh — Headless QEMU boot of kos.iso, timed by the kernel's BOOT: lines
+#
+# Usage: bench_boot.sh <iso> <serial log>
+#
+# The image should boot straight through GRUB (timeout=0): the first
+# stage, "firmware", runs from CPU reset and would otherwise include the
+# menu countdown. make bench-boot builds such an image.
+#
+# Boots the image with COM1 going to the log, waits for "BOOT: done" and
+# compares every stage (and the total) against a baseline from an earlier
+# run on the same accelerator. A stage regresses when it exceeds
+# baseline * (100 + BOOT_TOLERANCE) / 100 + BOOT_SLACK_US; the slack keeps
+# short stages from failing on jitter. Output is one key=value line per
+# stage plus a result line; the exit status is 1 on any regression, a
+# timeout or QEMU exiting early.
+#
+# Environment:
+#   QEMU            emulator binary (qemu-system-x86_64)
+#   BOOT_ACCEL      kvm or tcg; default kvm when /dev/kvm is usable
+#   BOOT_SMP        CPUs (4)
+#   BOOT_MEM        memory (4G)
+#   BOOT_TIMEOUT    seconds to wait for "BOOT: done" (120)
+#   BOOT_BASELINE   baseline file (boot-baseline-<accel>.txt next to the log)
+#   BOOT_TOLERANCE  allowed growth in percent (25)
+#   BOOT_SLACK_US   allowed growth in microseconds per stage (2000)
+#   BOOT_UPDATE=1   store this run as the baseline instead of comparing
+set -eu
+
+if [ $# -ne 2 ]; then
+    echo "usage: $0 <iso> <serial log>" >&2
+    exit 2
+fi
+iso=$1
+log=$2
+
+qemu=${QEMU:-qemu-system-x86_64}
+smp=${BOOT_SMP:-4}
+mem=${BOOT_MEM:-4G}
+timeout=${BOOT_TIMEOUT:-120}
+tolerance=${BOOT_TOLERANCE:-25}
+slack=${BOOT_SLACK_US:-2000}
+
+accel=${BOOT_ACCEL:-}
+if [ -z "$accel" ]; then
+    if [ -r /dev/kvm ] && [ -w /dev/kvm ]; then accel=kvm; else accel=tcg; fi
+fi
+case $accel in
+    kvm) cpu=host ;;
+    tcg) cpu=max ;;
+    *) echo "BOOT_ACCEL must be kvm or tcg" >&2; exit 2 ;;
+esac
+baseline=${BOOT_BASELINE:-$(dirname "$log")/boot-baseline-$accel.txt}
+
+mkdir -p "$(dirname "$log")"
+rm -f "$log"
+"$qemu" -cdrom "$iso" -m "$mem" -smp "$smp" -accel "$accel" -cpu "$cpu" \
+    -display none -monitor none -no-reboot -serial "file:$log" &
+pid=$!
+trap 'kill $pid 2>/dev/null || true' EXIT
+
+fail() {
+    echo "bench=boot accel=$accel result=fail reason=$1"
+    [ -f "$log" ] && tail -n 20 "$log" | tr -d '\r' | sed 's/^/  | /'
+    exit 1
+}
+
+ticks=0
+until grep -q '^BOOT: done' "$log" 2>/dev/null; do
+    kill -0 $pid 2>/dev/null || fail qemu_exited
+    [ $ticks -ge $((timeout * 10)) ] && fail timeout
+    sleep 0.1
+    ticks=$((ticks + 1))
+done
+kill $pid 2>/dev/null || true
+wait $pid 2>/dev/null || true
+trap - EXIT
+
+# "<stage> <us>" per line, total last
+current=$(tr -d '\r' < "$log" | sed -n \
+    -e 's/^BOOT: stage=\([^ ]*\) us=\([0-9]*\)$/\1 \2/p' \
+    -e 's/^BOOT: total_us=\([0-9]*\)$/total \1/p')
+[ -n "$current" ] || fail no_milestones
+tr -d '\r' < "$log" | sed -n 's/^BOOT: \(tsc_khz=.*\)$/bench=boot accel='"$accel"' \1/p'
+
+if [ "${BOOT_UPDATE:-0}" = 1 ] || [ ! -f "$baseline" ]; then
+    echo "$current" > "$baseline"
+    echo "$current" | awk -v accel="$accel" \
+        '{ printf "bench=boot accel=%s stage=%s us=%d\n", accel, $1, $2 }'
+    echo "bench=boot accel=$accel result=baseline file=$baseline"
+    exit 0
+fi
+
+echo "$current" | awk -v accel="$accel" -v tol="$tolerance" -v slack="$slack" '
+    NR == FNR { base[$1] = $2; next }
+    {
+        limit = ($1 in base) ? int(base[$1] * (100 + tol) / 100) + slack : -1
+        status = "ok"
+        if (limit < 0) status = "new"
+        else if ($2 > limit) { status = "regressed"; bad++ }
+        printf "bench=boot accel=%s stage=%s us=%d baseline_us=%s limit_us=%d status=%s\n",
+            accel, $1, $2, ($1 in base) ? base[$1] : "none", limit, status
+    }
+    END {
+        printf "bench=boot accel=%s result=%s regressions=%d\n", accel, bad ? "fail" : "pass", bad
+        exit bad ? 1 : 0
+    }' "$baseline" -
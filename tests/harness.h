@@ -0,0 +1,64 @@
+// harness.h — Checks, random input and timing shared by the host tests
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Each test is one translation unit plus the kernel code it links, so the
+// state below is per binary. Results go to stdout as one line per check
+// failure (first 20) and a final PASS/FAIL line; the exit code is what
+// make test looks at. Benchmarks print one key=value line per result.
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+static unsigned long checks = 0;
+static unsigned long failures = 0;
+static volatile size_t sink __attribute__((unused));
+
+static inline uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+#define CHECK(cond, ...) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        if (failures <= 20) { printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } \
+    } \
+} while (0)
+
+static inline int harness_result(const char* name) {
+    printf("%s %s: %lu checks, %lu failures\n", failures ? "FAIL" : "PASS", name, checks, failures);
+    return failures ? 1 : 0;
+}
+
+static inline double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Mean ns per evaluation of expr
+#define TIME_LOOP(iters, expr) ({ \
+    double t0 = now_ns(); \
+    for (long it = 0; it < (iters); it++) sink += (size_t)(expr); \
+    (now_ns() - t0) / (iters); })
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts the samples; p in [0, 100]
+static inline double percentile(double* v, size_t n, double p) {
+    qsort(v, n, sizeof(*v), cmp_double);
+    size_t i = (size_t)(p / 100.0 * (n - 1) + 0.5);
+    return v[i < n ? i : n - 1];
+}
+
+#endif
@@ -0,0 +1,107 @@
+// shim.c — Hosted stand-ins for the kernel services the tested code calls
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "kernel.h"
+
+// <unistd.h> clashes with kernel.h (pause, sleep)
+int ftruncate(int fd, off_t length);
+int close(int fd);
+
+// Everything here is built with -DKOS_HOSTED: kernel.h then maps this_cpu_*
+// to hosted_cpu, makes cli/sti no-ops and translates PHYS_TO_VIRT through
+// hosted_phys_offset. Only the symbols the tested units reference are
+// provided.
+
+struct cpu hosted_cpu = { .self = &hosted_cpu, .id = 0, .online = true, .bsp = true };
+uint64_t hosted_phys_offset = 0;
+
+void kvprintf(const char* fmt, va_list args) {
+    vprintf(fmt, args);
+}
+
+void kprintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+void kernel_panic(const char* msg) {
+    fprintf(stderr, "panic: %s\n", msg);
+    abort();
+}
+
+// Linux already saves vector state across context switches
+bool fpu_has_avx2(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+bool kernel_fpu_usable(void) {
+    return true;
+}
+
+void kernel_fpu_begin(void) {}
+void kernel_fpu_end(void) {}
+
+// Single threaded: no reader can still hold the object
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head)) {
+    func(head);
+}
+
+// Fake physical memory for memory.c, laid out like a small PC:
+//   [0, 1MB)          low memory, holds the multiboot info at 0x1000
+//   [1MB, 16MB)       kernel image and pmm_early_alloc() area
+//   [16MB, 16MB + n)  the RAM handed to the allocator
+// One memfd backs it all. The whole file is mapped once as the direct map
+// (PHYS_TO_VIRT), and [1MB, 16MB) is mapped a second time at the same
+// virtual address, because pmm_init() uses early allocations unmapped just
+// like the boot identity map allows. A phys/virt mix-up anywhere else
+// lands in the wrong mapping instead of passing by accident.
+#define HOSTED_LOW_END      0x100000ULL
+#define HOSTED_RAM_START    0x1000000ULL
+#define HOSTED_MBI          0x1000ULL
+
+uint64_t hosted_mem_init(uint64_t ram_bytes) {
+    uint64_t size = HOSTED_RAM_START + ram_bytes;
+    int fd = memfd_create("kos-phys", 0);
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0) {
+        perror("memfd");
+        exit(2);
+    }
+
+    void* direct = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    void* ident = mmap((void*)HOSTED_LOW_END, HOSTED_RAM_START - HOSTED_LOW_END,
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE,
+                       fd, HOSTED_LOW_END);
+    if (direct == MAP_FAILED || ident != (void*)HOSTED_LOW_END) {
+        perror("mmap fake physical memory");
+        exit(2);
+    }
+    close(fd);
+    hosted_phys_offset = (uint64_t)direct;
+
+    // Multiboot2 info: total size, reserved, one mmap tag, end tag
+    uint8_t* mbi = PHYS_TO_VIRT(HOSTED_MBI);
+    struct multiboot_tag_mmap* tag = (struct multiboot_tag_mmap*)(mbi + 8);
+    const uint32_t entries = 3;
+    tag->type = MULTIBOOT_TAG_TYPE_MMAP;
+    tag->size = sizeof(*tag) + entries * sizeof(struct multiboot_mmap_entry);
+    tag->entry_size = sizeof(struct multiboot_mmap_entry);
+    tag->entry_version = 0;
+    tag->entries[0] = (struct multiboot_mmap_entry){ 0, 0x9F000, MULTIBOOT_MEMORY_AVAILABLE, 0 };
+    tag->entries[1] = (struct multiboot_mmap_entry){ HOSTED_LOW_END,
+        HOSTED_RAM_START - HOSTED_LOW_END, 2, 0 };
+    tag->entries[2] = (struct multiboot_mmap_entry){ HOSTED_RAM_START, ram_bytes,
+        MULTIBOOT_MEMORY_AVAILABLE, 0 };
+
+    struct multiboot_tag* end = (struct multiboot_tag*)((uint8_t*)tag + ((tag->size + 7) & ~7u));
+    end->type = MULTIBOOT_TAG_TYPE_END;
+    end->size = 8;
+    ((uint32_t*)mbi)[0] = (uint32_t)((uint8_t*)end + 8 - mbi);
+    ((uint32_t*)mbi)[1] = 0;
+    return HOSTED_MBI;
+}
@@ -0,0 +1,180 @@
+// test_kmalloc.c — Host tests and timings for the kernel heap
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel.h"
+#include "harness.h"
+
+// kmalloc.c on top of the real memory.c, both on the shim's fake RAM
+
+#define TEST_RAM        (64ULL << 20)
+#define SLOTS           4096
+
+uint64_t hosted_mem_init(uint64_t ram_bytes);
+
+struct slot {
+    uint8_t* ptr;
+    size_t size;
+    uint8_t tag;
+};
+
+static struct slot slots[SLOTS];
+
+// Mostly small, like the kernel's own callers, with a tail up to 3KB
+// that also covers the page path
+static size_t random_size(void) {
+    uint64_t r = rng();
+    switch (r & 3) {
+    case 0:  return 1 + (r >> 8) % 64;
+    case 1:  return 1 + (r >> 8) % 256;
+    case 2:  return 1 + (r >> 8) % 1024;
+    default: return 1 + (r >> 8) % 3072;
+    }
+}
+
+static bool tag_intact(const struct slot* s) {
+    for (size_t i = 0; i < s->size; i++) {
+        if (s->ptr[i] != s->tag) return false;
+    }
+    return true;
+}
+
+static void test_basic(void) {
+    CHECK(kmalloc(0) == NULL, "kmalloc(0)");
+    kfree(NULL);
+
+    // Every request size up to past the largest class: aligned, writable
+    // end to end without touching a neighbour (checked by the stress test)
+    for (size_t n = 1; n <= 2100; n++) {
+        uint8_t* p = kmalloc(n);
+        CHECK(p && ((uintptr_t)p & 15) == 0, "kmalloc(%zu) = %p", n, (void*)p);
+        if (!p) continue;
+        memset(p, 0xEE, n);
+        kfree(p);
+    }
+
+    // A reused, dirty object comes back zeroed from kzalloc
+    uint8_t* p = kmalloc(100);
+    memset(p, 0xFF, 100);
+    kfree(p);
+    uint8_t* z = kzalloc(100);
+    CHECK(z == p, "LIFO reuse %p %p", (void*)z, (void*)p);
+    bool zero = true;
+    for (int i = 0; i < 100; i++) zero &= z[i] == 0;
+    CHECK(zero, "kzalloc not zeroed");
+    kfree(z);
+
+    // Large allocations are whole zeroed pages
+    uint8_t* big = kmalloc(3 * PAGE_SIZE + 5);
+    CHECK(big && ((uintptr_t)big & (PAGE_SIZE - 1)) == 0, "large allocation %p", (void*)big);
+    zero = true;
+    for (size_t i = 0; big && i < 4 * PAGE_SIZE; i++) zero &= big[i] == 0;
+    CHECK(zero, "large allocation not zeroed");
+
+    // ...and go back to the PMM, header page included
+    uint64_t total, used_before, used_after, free;
+    pmm_get_stats(&total, &used_before, &free);
+    kfree(big);
+    pmm_get_stats(&total, &used_after, &free);
+    CHECK(used_before - used_after == 5 * PAGE_SIZE, "large free returned %lu bytes",
+        (unsigned long)(used_before - used_after));
+
+    // Just past the largest class takes the page path and frees the same way
+    for (size_t n = 2033; n <= 2048 + PAGE_SIZE; n += 509) {
+        pmm_get_stats(&total, &used_before, &free);
+        kfree(kmalloc(n));
+        pmm_get_stats(&total, &used_after, &free);
+        CHECK(used_before == used_after, "kmalloc(%zu) leaked %lu bytes", n,
+            (unsigned long)(used_after - used_before));
+    }
+}
+
+// Random alloc/free with every live object filled with its own tag byte:
+// overlapping objects or a free list running through live data shows up
+// as a changed tag
+static void test_stress(void) {
+    uint8_t next_tag = 1;
+    for (int round = 0; round < 200000; round++) {
+        struct slot* s = &slots[rng() % SLOTS];
+        if (s->ptr) {
+            CHECK(tag_intact(s), "object %p size %zu overwritten", (void*)s->ptr, s->size);
+            kfree(s->ptr);
+            s->ptr = NULL;
+            continue;
+        }
+        s->size = random_size();
+        s->ptr = kmalloc(s->size);
+        CHECK(s->ptr != NULL, "kmalloc(%zu) failed", s->size);
+        if (!s->ptr) continue;
+        s->tag = next_tag++ | 1;
+        memset(s->ptr, s->tag, s->size);
+    }
+    for (int i = 0; i < SLOTS; i++) {
+        if (!slots[i].ptr) continue;
+        CHECK(tag_intact(&slots[i]), "object %d overwritten", i);
+        kfree(slots[i].ptr);
+        slots[i].ptr = NULL;
+    }
+}
+
+// Steady state: the object goes straight back to its free list
+static void bench_pair(size_t size) {
+    long iters = 2000000;
+    kfree(kmalloc(size));
+    double t0 = now_ns();
+    for (long i = 0; i < iters; i++) {
+        void* p = kmalloc(size);
+        sink += (size_t)p;
+        kfree(p);
+    }
+    double ns = (now_ns() - t0) / iters;
+    printf("bench=kmalloc op=alloc_free size=%zu ns_per_op=%.1f ops_per_s=%.0f\n",
+        size, ns, 1e9 / ns);
+}
+
+// Bursts of allocations then frees; latency per call, slab refills included
+static void bench_burst(size_t size) {
+    enum { BURST = 1024, ROUNDS = 64 };
+    static void* ptrs[BURST];
+    static double alloc_ns[BURST * ROUNDS], free_ns[BURST * ROUNDS];
+    double alloc_total = 0, free_total = 0;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BURST; i++) {
+            double t0 = now_ns();
+            ptrs[i] = kmalloc(size);
+            alloc_ns[r * BURST + i] = now_ns() - t0;
+            alloc_total += alloc_ns[r * BURST + i];
+        }
+        for (int i = 0; i < BURST; i++) {
+            double t0 = now_ns();
+            kfree(ptrs[i]);
+            free_ns[r * BURST + i] = now_ns() - t0;
+            free_total += free_ns[r * BURST + i];
+        }
+    }
+    size_t n = BURST * ROUNDS;
+    printf("bench=kmalloc op=burst_alloc size=%zu ns_per_op=%.1f p50_ns=%.1f p99_ns=%.1f\n",
+        size, alloc_total / n, percentile(alloc_ns, n, 50), percentile(alloc_ns, n, 99));
+    printf("bench=kmalloc op=burst_free size=%zu ns_per_op=%.1f p50_ns=%.1f p99_ns=%.1f\n",
+        size, free_total / n, percentile(free_ns, n, 50), percentile(free_ns, n, 99));
+}
+
+int main(int argc, char** argv) {
+    mem_init();
+    pmm_init(hosted_mem_init(TEST_RAM));
+    kmalloc_init();
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        static const size_t sizes[] = { 8, 48, 112, 240, 1000, 2000 };
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) bench_pair(sizes[i]);
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) bench_burst(sizes[i]);
+        return 0;
+    }
+
+    test_basic();
+    test_stress();
+    return harness_result("test_kmalloc");
+}
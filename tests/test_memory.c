@@ -0,0 +1,185 @@
+// test_memory.c — Host tests and timings for the physical memory manager
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel.h"
+#include "harness.h"
+
+// memory.c runs unmodified on the shim's fake physical memory: a multiboot
+// map with TEST_RAM bytes of RAM at 16MB, reached through PHYS_TO_VIRT.
+
+#define TEST_RAM        (32ULL << 20)
+#define TEST_PAGES      (TEST_RAM / PAGE_SIZE)
+#define RAM_START       0x1000000ULL
+
+uint64_t hosted_mem_init(uint64_t ram_bytes);
+
+static bool in_ram(void* p, uint64_t bytes) {
+    uint64_t phys = VIRT_TO_PHYS(p);
+    return phys >= RAM_START && phys + bytes <= RAM_START + TEST_RAM;
+}
+
+static bool all_zero(const uint8_t* p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (p[i]) return false;
+    }
+    return true;
+}
+
+static uint64_t free_bytes(void) {
+    uint64_t total, used, free;
+    pmm_get_stats(&total, &used, &free);
+    return free;
+}
+
+static void test_init(void) {
+    uint64_t total, used, free;
+    pmm_get_stats(&total, &used, &free);
+    CHECK(total == TEST_RAM, "total %lu", (unsigned long)total);
+    CHECK(free == TEST_RAM && used == 0, "free %lu used %lu", (unsigned long)free, (unsigned long)used);
+    CHECK(pmm_get_free() == free, "approximate free %lu", (unsigned long)pmm_get_free());
+}
+
+static void test_pages(void) {
+    static void* pages[512];
+    uint64_t before = free_bytes();
+
+    for (int i = 0; i < 512; i++) {
+        pages[i] = pmm_alloc_page();
+        CHECK(pages[i] && ((uint64_t)pages[i] & (PAGE_SIZE - 1)) == 0, "page %d at %p", i, pages[i]);
+        CHECK(pages[i] && in_ram(pages[i], PAGE_SIZE), "page %d outside RAM", i);
+        CHECK(pages[i] && all_zero(pages[i], PAGE_SIZE), "page %d not zeroed", i);
+        if (pages[i]) memset(pages[i], 0xA5, PAGE_SIZE);
+        for (int j = 0; j < i; j++) {
+            if (pages[j] == pages[i]) CHECK(false, "page %d handed out twice", i);
+        }
+    }
+    CHECK(free_bytes() == before - 512 * PAGE_SIZE, "free after alloc");
+
+    // Free in random order; every page must come back
+    for (int i = 511; i > 0; i--) {
+        int j = (int)(rng() % (uint64_t)(i + 1));
+        void* t = pages[i];
+        pages[i] = pages[j];
+        pages[j] = t;
+    }
+    for (int i = 0; i < 512; i++) pmm_free_page(pages[i]);
+    CHECK(free_bytes() == before, "free after release %lu", (unsigned long)free_bytes());
+
+    // Reused pages come back zeroed
+    void* p = pmm_alloc_page();
+    CHECK(p && all_zero(p, PAGE_SIZE), "reused page not zeroed");
+    pmm_free_page(p);
+
+    // A double free is reported and does not inflate the count
+    pmm_free_page(p);
+    CHECK(free_bytes() == before, "double free changed the count");
+}
+
+static void test_contiguous(void) {
+    static const size_t counts[] = { 2, 15, 16, 17, 64, 300 };
+    uint64_t before = free_bytes();
+
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        size_t n = counts[i];
+        uint8_t* p = pmm_alloc_pages(n);
+        CHECK(p && in_ram(p, n * PAGE_SIZE), "%zu pages outside RAM", n);
+        if (!p) continue;
+        memset(p, 0x5A, n * PAGE_SIZE);
+        pmm_free_pages(p, n);
+
+        // First fit hands the same, now dirty, block out again
+        uint8_t* q = pmm_alloc_pages(n);
+        CHECK(q == p, "%zu pages: first fit moved", n);
+        CHECK(q && all_zero(q, n * PAGE_SIZE), "%zu pages not zeroed", n);
+        if (q) pmm_free_pages(q, n);
+    }
+    CHECK(free_bytes() == before, "free after contiguous runs");
+
+    uint8_t* huge = pmm_alloc_huge_page();
+    CHECK(huge && (VIRT_TO_PHYS(huge) & (HUGE_PAGE_SIZE - 1)) == 0, "huge page alignment");
+    CHECK(huge && in_ram(huge, HUGE_PAGE_SIZE) && all_zero(huge, HUGE_PAGE_SIZE), "huge page");
+    if (huge) pmm_free_pages(huge, HUGE_PAGE_SIZE / PAGE_SIZE);
+    CHECK(free_bytes() == before, "free after huge page");
+}
+
+static void test_exhaust(void) {
+    static void* pages[TEST_PAGES];
+    uint64_t before = free_bytes();
+    size_t n = 0;
+
+    while (n < TEST_PAGES && (pages[n] = pmm_alloc_page())) n++;
+    CHECK(n == before / PAGE_SIZE, "allocated %zu of %lu pages", n, (unsigned long)(before / PAGE_SIZE));
+    CHECK(pmm_alloc_page() == NULL && pmm_alloc_pages(2) == NULL, "allocation past the end");
+    CHECK(free_bytes() == 0, "free when exhausted %lu", (unsigned long)free_bytes());
+
+    for (size_t i = 0; i < n; i++) pmm_free_page(pages[i]);
+    CHECK(free_bytes() == before, "free after exhaustion");
+}
+
+// Fills the lowest used_pct percent of RAM so allocations start behind it
+static size_t occupy(void** hold, uint32_t used_pct) {
+    size_t n = TEST_PAGES * used_pct / 100;
+    for (size_t i = 0; i < n; i++) hold[i] = pmm_alloc_page();
+    return n;
+}
+
+static void bench_page(uint32_t used_pct) {
+    static void* hold[TEST_PAGES];
+    static double samples[4096];
+    size_t held = occupy(hold, used_pct);
+
+    for (size_t i = 0; i < 4096; i++) {
+        double t0 = now_ns();
+        void* p = pmm_alloc_page();
+        pmm_free_page(p);
+        samples[i] = now_ns() - t0;
+    }
+    double t0 = now_ns();
+    for (int i = 0; i < 4096; i++) pmm_free_page(pmm_alloc_page());
+    double ns = (now_ns() - t0) / 4096;
+
+    printf("bench=pmm op=alloc_free_page size=%u used_pct=%u ns_per_op=%.1f p50_ns=%.1f "
+           "p99_ns=%.1f ops_per_s=%.0f\n", PAGE_SIZE, used_pct, ns,
+           percentile(samples, 4096, 50), percentile(samples, 4096, 99), 1e9 / ns);
+    for (size_t i = 0; i < held; i++) pmm_free_page(hold[i]);
+}
+
+static void bench_pages(size_t n) {
+    static double samples[512];
+    double total = 0;
+    for (size_t i = 0; i < 512; i++) {
+        double t0 = now_ns();
+        void* p = pmm_alloc_pages(n);
+        samples[i] = now_ns() - t0;
+        total += samples[i];
+        pmm_free_pages(p, n);
+    }
+    double ns = total / 512;
+    printf("bench=pmm op=alloc_pages size=%zu ns_per_op=%.1f p50_ns=%.1f p99_ns=%.1f "
+           "mb_per_s=%.0f\n", n * PAGE_SIZE, ns, percentile(samples, 512, 50),
+           percentile(samples, 512, 99), n * PAGE_SIZE / ns * 1e9 / (1 << 20));
+}
+
+int main(int argc, char** argv) {
+    mem_init();
+    pmm_init(hosted_mem_init(TEST_RAM));
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench_page(0);
+        bench_page(50);
+        bench_page(90);
+        bench_pages(4);
+        bench_pages(16);
+        bench_pages(256);
+        return 0;
+    }
+
+    test_init();
+    test_pages();
+    test_contiguous();
+    test_exhaust();
+    return harness_result("test_memory");
+}
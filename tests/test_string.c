@@ -0,0 +1,230 @@
+// test_string.c — Host tests and timings for string.c
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "harness.h"
+
+// string.c is linked in and overrides the C library's routines in this
+// binary; the ref_* byte loops below are the oracle. Built with
+// -fno-builtin so neither side is replaced by compiler builtins.
+
+void mem_init(void);
+
+// Bytes that trip naive has-zero tricks (0x80, 0x01, 0xFF) show up often
+static uint8_t rng_byte(void) {
+    static const uint8_t tricky[] = { 0x01, 0x80, 0x81, 0x7F, 0xFF, 0xFE };
+    uint64_t r = rng();
+    return (r & 3) ? tricky[(r >> 8) % sizeof(tricky)] : (uint8_t)(r >> 16);
+}
+
+static int sign(int x) {
+    return (x > 0) - (x < 0);
+}
+
+static size_t ref_strlen(const char* s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+static int ref_strcmp(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (uint8_t)*a - (uint8_t)*b;
+}
+
+static int ref_memcmp(const void* x, const void* y, size_t n) {
+    const uint8_t* a = x;
+    const uint8_t* b = y;
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i]) return a[i] - b[i];
+    }
+    return 0;
+}
+
+static const void* ref_memchr(const void* s, int c, size_t n) {
+    const uint8_t* p = s;
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] == (uint8_t)c) return p + i;
+    }
+    return NULL;
+}
+
+static const char* ref_strstr(const char* h, const char* n) {
+    size_t nl = ref_strlen(n);
+    for (; *h; h++) {
+        if (ref_memcmp(h, n, nl) == 0) return h;
+    }
+    return nl ? NULL : h;
+}
+
+// Non-zero bytes; the terminator is written separately
+static void fill_string(char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = rng_byte();
+        s[i] = b ? (char)b : 'x';
+    }
+    s[len] = 0;
+}
+
+static void test_strlen(void) {
+    static char buf[512];
+    for (size_t align = 0; align < 16; align++) {
+        for (size_t len = 0; len < 300; len++) {
+            fill_string(buf + align, len);
+            CHECK(strlen(buf + align) == len, "strlen align %zu len %zu", align, len);
+        }
+    }
+}
+
+static void test_strcmp(void) {
+    static char a[512], b[512];
+    for (int i = 0; i < 20000; i++) {
+        size_t aa = rng() % 16, ab = rng() % 16, len = rng() % 200;
+        fill_string(a + aa, len);
+        memcpy(b + ab, a + aa, len + 1);
+        switch (rng() % 3) {
+        case 0: break;                                          // Equal
+        case 1: if (len) b[ab + rng() % len] = (char)rng_byte() | 1; break;
+        case 2: b[ab + rng() % (len + 1)] = 0; break;           // Shorter
+        }
+        CHECK(sign(strcmp(a + aa, b + ab)) == sign(ref_strcmp(a + aa, b + ab)),
+              "strcmp len %zu align %zu/%zu", len, aa, ab);
+    }
+}
+
+static void test_memcmp_memchr(void) {
+    static uint8_t a[4096], b[4096];
+    for (int i = 0; i < 20000; i++) {
+        size_t n = (i & 1) ? rng() % 64 : rng() % 2048;
+        size_t aa = rng() % 32, ab = rng() % 32;
+        for (size_t k = 0; k < n; k++) a[aa + k] = rng_byte();
+        memcpy(b + ab, a + aa, n);
+        if (n && (rng() & 1)) b[ab + rng() % n] ^= (uint8_t)(1 + rng() % 255);
+        CHECK(sign(memcmp(a + aa, b + ab, n)) == sign(ref_memcmp(a + aa, b + ab, n)),
+              "memcmp n %zu", n);
+
+        int c = (rng() & 1) ? rng_byte() : 0;
+        CHECK(memchr(a + aa, c, n) == ref_memchr(a + aa, c, n), "memchr n %zu c %02x", n, c);
+    }
+}
+
+static void test_strstr(void) {
+    static char h[256], n[16];
+    for (int i = 0; i < 20000; i++) {
+        size_t hl = rng() % 200, nl = rng() % 6;
+        for (size_t k = 0; k < hl; k++) h[k] = "ab"[rng() & 1];
+        for (size_t k = 0; k < nl; k++) n[k] = "ab"[rng() & 1];
+        h[hl] = n[nl] = 0;
+        CHECK(strstr(h, n) == ref_strstr(h, n), "strstr \"%s\" in \"%s\"", n, h);
+    }
+}
+
+// Strings and buffers ending on the last byte before an inaccessible page:
+// an over-read that crosses the boundary faults the test
+static void test_page_boundary(void) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uint8_t* map = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        exit(2);
+    }
+    mprotect(map + page, page, PROT_NONE);
+    uint8_t* end = map + page;
+    static char other[128];
+
+    for (size_t len = 0; len < 64; len++) {
+        char* s = (char*)end - len - 1;
+        fill_string(s, len);
+        CHECK(strlen(s) == len, "boundary strlen %zu", len);
+
+        memcpy(other, s, len + 1);
+        CHECK(strcmp(s, other) == 0 && strcmp(other, s) == 0, "boundary strcmp %zu", len);
+        CHECK(strstr(s, "\x01\x02\x03") == ref_strstr(s, "\x01\x02\x03"), "boundary strstr %zu", len);
+
+        uint8_t* m = end - len;
+        CHECK(memchr(m, 0x42, len) == ref_memchr(m, 0x42, len), "boundary memchr %zu", len);
+        CHECK(memcmp(m, m, len) == 0, "boundary memcmp %zu", len);
+    }
+    munmap(map, 2 * page);
+}
+
+static void test_mem(void) {
+    static uint8_t a[9000], b[9000], r[9000];
+    for (int i = 0; i < 5000; i++) {
+        size_t n = (i & 1) ? rng() % 40 : rng() % 3000;
+        size_t so = rng() % 64, dof = rng() % 64;
+        for (size_t k = 0; k < sizeof(a); k++) a[k] = (uint8_t)rng(), b[k] = r[k] = (uint8_t)rng();
+
+        for (size_t k = 0; k < n; k++) r[dof + k] = a[so + k];
+        memcpy(b + dof, a + so, n);
+        CHECK(ref_memcmp(r, b, sizeof(b)) == 0, "memcpy n %zu", n);
+
+        int v = (int)(rng() & 255);
+        for (size_t k = 0; k < n; k++) r[dof + k] = (uint8_t)v;
+        memset(b + dof, v, n);
+        CHECK(ref_memcmp(r, b, sizeof(b)) == 0, "memset n %zu", n);
+
+        size_t x = rng() % 3000, y = rng() % 3000;
+        uint8_t tmp[3000];
+        for (size_t k = 0; k < n; k++) tmp[k] = a[x + k];
+        memcpy(r, a, sizeof(a));
+        for (size_t k = 0; k < n; k++) r[y + k] = tmp[k];
+        memmove(a + y, a + x, n);
+        CHECK(ref_memcmp(r, a, sizeof(a)) == 0, "memmove n %zu %zu->%zu", n, x, y);
+    }
+}
+
+// One result per line: key=value pairs, stable names
+static void bench_report(const char* op, size_t size, double ns, double ref_ns) {
+    printf("bench=string op=%s size=%zu ns_per_op=%.2f ref_ns_per_op=%.2f speedup=%.2f\n",
+        op, size, ns, ref_ns, ns > 0 ? ref_ns / ns : 0);
+}
+
+static void bench(void) {
+    static const size_t sizes[] = { 16, 64, 256, 4096 };
+    static char a[8192], b[8192];
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t n = sizes[i];
+        long iters = (long)(200000000 / (n + 32));
+        memset(a, 'a', n);
+        a[n] = 0;
+        memcpy(b, a, n + 1);
+
+        bench_report("strlen", n, TIME_LOOP(iters, strlen(a)), TIME_LOOP(iters, ref_strlen(a)));
+        bench_report("strcmp", n, TIME_LOOP(iters, strcmp(a, b)), TIME_LOOP(iters, ref_strcmp(a, b)));
+        bench_report("memcmp", n, TIME_LOOP(iters, memcmp(a, b, n)),
+                     TIME_LOOP(iters, ref_memcmp(a, b, n)));
+        bench_report("memchr", n, TIME_LOOP(iters, (uintptr_t)memchr(a, 'z', n)),
+                     TIME_LOOP(iters, (uintptr_t)ref_memchr(a, 'z', n)));
+        b[n - 1] = 'b';
+        bench_report("strstr", n, TIME_LOOP(iters / 4, (uintptr_t)strstr(b, "ab")),
+                     TIME_LOOP(iters / 4, (uintptr_t)ref_strstr(b, "ab")));
+        b[n - 1] = 'a';
+    }
+}
+
+int main(int argc, char** argv) {
+    mem_init();
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench();
+        return 0;
+    }
+
+    test_strlen();
+    test_strcmp();
+    test_memcmp_memchr();
+    test_strstr();
+    test_page_boundary();
+    test_mem();
+
+    return harness_result("test_string");
+}
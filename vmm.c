@@ -171,6 +171,10 @@ uint64_t vmm_create_address_space(void) {
     return VIRT_TO_PHYS((uint64_t)pml4);
 }
 
+uint64_t* vmm_get_kernel_pml4(void) {
+    return kernel_pml4;
+}
+
 void vmm_switch_pml4(uint64_t pml4_phys) {
     write_cr3(pml4_phys);
 }